@@ -50,6 +50,95 @@
 
 #define BCC_CONTEXT_DATA_SIZE_ (128 * 1024)
 
+//---------------------------------------------------------------------------
+// Configuration for Cache
+//---------------------------------------------------------------------------
+
+// The directory of the content-addressed caches shared by the scripts of the
+// applications of each uid, in its subdirectory <uid>/ (see
+// BCC_UID_SHARED_CACHE in bcc.h).  It should be world-writable and sticky.
+// It can be overridden with the "debug.bcc.sharedcachedir" property.
+#define BCC_SHARED_CACHE_DIR "/data/bcc-cache/"
+
+// The total size of the cache files kept in a cache directory.  The least
+// recently used files are removed beyond this.  It can be overridden with
+// the "debug.bcc.cachebudget" property (in bytes).
+#define BCC_CACHE_BUDGET (8ULL * 1024 * 1024)
+
+//---------------------------------------------------------------------------
+// Configuration for CompilerResourcePool
+//---------------------------------------------------------------------------
+
+// The number of idle LLVMContexts kept by each thread.
+#define BCC_POOL_CONTEXT_COUNT 2
+
+// The number of compilations an LLVMContext serves before it is discarded.
+// (The types and constants uniqued in a context are never freed.)
+#define BCC_POOL_CONTEXT_MAX_USES 32
+
+//---------------------------------------------------------------------------
+// Configuration for ParallelCodeGen
+//---------------------------------------------------------------------------
+
+// The maximum number of threads generating code for a script (see
+// BCC_PARALLEL_CODEGEN in bcc.h).  The number of online CPUs is used if it
+// is smaller.  It can be overridden with the "debug.bcc.codegenthreads"
+// property.
+#define BCC_CODEGEN_MAX_THREADS 8
+
+// The minimum number of IR instructions in a partition.  Smaller modules
+// are not worth partitioning.
+#define BCC_CODEGEN_MIN_PARTITION_SIZE 1000
+
+// The number of IR instructions read before a partition is compiled, with
+// BCC_STREAMING_COMPILE (in bcc.h).
+#define BCC_CODEGEN_STREAM_PARTITION_SIZE 4000
+
+//---------------------------------------------------------------------------
+// Configuration for ObjectBuffer
+//---------------------------------------------------------------------------
+
+// The expected size of the ELF object per IR instruction, to reserve the
+// buffer the object is emitted into.
+#define BCC_OBJECT_BYTES_PER_INSTRUCTION 16
+
+// The total capacity of the idle object buffers kept for the next
+// compilations.  A buffer released beyond this is freed.
+#define BCC_OBJECT_BUFFER_POOL_SIZE (4 * 1024 * 1024)
+
+//---------------------------------------------------------------------------
+// Configuration for the choice of the pipeline
+//---------------------------------------------------------------------------
+
+// Unless the script or its caller chooses the pipeline, a script (linked
+// with the library) of fewer IR instructions is compiled at O1, and one of
+// more at O2 without GVN.
+#define BCC_PIPELINE_SMALL_MODULE_SIZE 100
+#define BCC_PIPELINE_LARGE_MODULE_SIZE 50000
+
+// The estimated time of the LTO and of the code generation at O3 per IR
+// instruction, against the budget of bccSetCompileBudget (in bcc.h).  The
+// estimate of the code generation is corrected by the time the LTO took.
+#define BCC_LTO_NS_PER_INSTRUCTION 15000
+#define BCC_CODEGEN_NS_PER_INSTRUCTION 30000
+
+//---------------------------------------------------------------------------
+// Configuration for LazyCompiler
+//---------------------------------------------------------------------------
+
+// The smaller functions (in IR instructions) of a script compiled with
+// BCC_LAZY_COMPILE (in bcc.h) are not worth a stub, and are compiled with
+// the script.
+#define BCC_LAZY_COMPILE_MIN_SIZE 64
+
+//---------------------------------------------------------------------------
+// Configuration for LibraryObject
+//---------------------------------------------------------------------------
+
+// The library functions with fewer IR instructions are still linked into
+// the scripts compiled with BCC_SHARED_LIBRARY (in bcc.h), to be inlined.
+#define BCC_SHARED_LIBRARY_INLINE_SIZE 32
+
 //---------------------------------------------------------------------------
 // Configuration for CodeGen and CompilerRT
 //---------------------------------------------------------------------------
@@ -32,7 +32,10 @@ LOCAL_MODULE_CLASS := STATIC_LIBRARIES
 LOCAL_CFLAGS += $(libbcc_CFLAGS)
 LOCAL_C_INCLUDES := $(libbcc_C_INCLUDES)
 
-LOCAL_SRC_FILES := sha1.c
+LOCAL_SRC_FILES := \
+  fasthash.c \
+  sha1.c \
+  sha1_hw.c
 
 include $(LIBBCC_ROOT_PATH)/libbcc-gen-config-from-mk.mk
 include $(LIBBCC_ROOT_PATH)/libbcc-build-rules.mk
@@ -56,9 +59,29 @@ LOCAL_C_INCLUDES := $(libbcc_C_INCLUDES)
 
 LOCAL_SRC_FILES := \
   DebugHelper.c \
-  sha1.c
+  fasthash.c \
+  sha1.c \
+  sha1_hw.c
 
 include $(LIBBCC_ROOT_PATH)/libbcc-gen-config-from-mk.mk
 include $(LIBBCC_ROOT_PATH)/libbcc-build-rules.mk
 include $(LLVM_ROOT_PATH)/llvm-host-build.mk
 include $(BUILD_HOST_STATIC_LIBRARY)
+
+
+#=====================================================================
+# Host Executable: bcc_hashbench
+#=====================================================================
+
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := bcc_hashbench
+LOCAL_MODULE_TAGS := tests
+
+LOCAL_SRC_FILES := hashbench.c
+
+LOCAL_STATIC_LIBRARIES := libbccHelper
+
+LOCAL_LDLIBS := -lrt
+
+include $(BUILD_HOST_EXECUTABLE)
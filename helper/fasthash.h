@@ -0,0 +1,41 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_FASTHASH_H
+#define BCC_FASTHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define FASTHASHSIZE 16
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/*
+ * 128-bit non-cryptographic hash (MurmurHash3_x64_128).  Several times
+ * faster than SHA-1, but it must only be used where a collision is not a
+ * security problem, e.g. the keys of the caches owned by the same user.
+ */
+void FastHash128(unsigned char digest[FASTHASHSIZE],
+                 const void *data, size_t len, uint32_t seed);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* BCC_FASTHASH_H */
@@ -0,0 +1,161 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Measure the throughput (MB/s) of the hash functions used by libbcc on the
+ * given files (e.g. libRS.so and the bitcode files):
+ *
+ *   bcc_hashbench <file> [<file> ...]
+ *
+ *  - sha1-read256: the portable SHA-1 reading through a 256-byte buffer,
+ *                  which was how calcFileSHA1() used to work.
+ *  - sha1-mmap:    the portable SHA-1 over the mapped file.
+ *  - sha1-hw:      the SHA-1 instructions over the mapped file (if any).
+ *  - fasthash:     the 128-bit non-cryptographic hash over the mapped file.
+ */
+
+#include "fasthash.h"
+#include "sha1.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#define MIN_BENCH_SECONDS 0.5
+
+static double now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sha1Read256(int fd, unsigned char *digest)
+{
+    SHA1_CTX ctx;
+    unsigned char buf[256];
+    ssize_t nread;
+
+    SHA1Init(&ctx);
+    lseek(fd, 0, SEEK_SET);
+    while ((nread = read(fd, buf, sizeof(buf))) > 0) {
+        SHA1Update(&ctx, buf, (unsigned long)nread);
+    }
+    SHA1Final(digest, &ctx);
+}
+
+static void sha1Map(const unsigned char *map, size_t size,
+                    unsigned char *digest)
+{
+    SHA1_CTX ctx;
+    SHA1Init(&ctx);
+    SHA1Update(&ctx, map, (unsigned long)size);
+    SHA1Final(digest, &ctx);
+}
+
+static void report(const char *name, size_t size, int iterations,
+                   double seconds, const unsigned char *digest, int len)
+{
+    int i;
+    printf("  %-13s %9.1f MB/s  ", name,
+           (double)size * iterations / seconds / (1024 * 1024));
+    for (i = 0; i < len; ++i) {
+        printf("%02x", digest[i]);
+    }
+    printf("\n");
+}
+
+/* Run the statement until MIN_BENCH_SECONDS elapsed, then report. */
+#define BENCH(NAME, DIGEST, LEN, STMT)                                  \
+    do {                                                                \
+        int iterations = 0;                                             \
+        double start = now();                                           \
+        double elapsed;                                                 \
+        do {                                                            \
+            STMT;                                                       \
+            ++iterations;                                               \
+        } while ((elapsed = now() - start) < MIN_BENCH_SECONDS);        \
+        report(NAME, size, iterations, elapsed, DIGEST, LEN);           \
+    } while (0)
+
+static int benchFile(const char *path)
+{
+    unsigned char digest[HASHSIZE];
+    unsigned char fastDigest[FASTHASHSIZE];
+    struct stat sfile;
+    size_t size;
+    void *map;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &sfile) != 0 || sfile.st_size <= 0) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 1;
+    }
+
+    size = (size_t)sfile.st_size;
+    map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Unable to map %s\n", path);
+        close(fd);
+        return 1;
+    }
+
+    printf("%s (%lu bytes)\n", path, (unsigned long)size);
+
+    SHA1SetHardwareAcceleration(0);
+    BENCH("sha1-read256", digest, HASHSIZE, sha1Read256(fd, digest));
+    BENCH("sha1-mmap", digest, HASHSIZE,
+          sha1Map((const unsigned char *)map, size, digest));
+
+    if (SHA1SetHardwareAcceleration(1)) {
+        BENCH("sha1-hw", digest, HASHSIZE,
+              sha1Map((const unsigned char *)map, size, digest));
+    } else {
+        printf("  %-13s (not supported by this CPU)\n", "sha1-hw");
+    }
+
+    BENCH("fasthash", fastDigest, FASTHASHSIZE,
+          FastHash128(fastDigest, map, size, 0));
+
+    munmap(map, size);
+    close(fd);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    int i;
+    int status = 0;
+
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s <file> [<file> ...]\n", argv[0]);
+        return 1;
+    }
+
+    for (i = 1; i < argc; ++i) {
+        status |= benchFile(argv[i]);
+    }
+
+    return status;
+}
@@ -85,6 +85,7 @@ A million repetitions of "a"
 //#endif
 
 #include "sha1.h"
+#include "sha1_hw.h"
 
 #include <stdio.h>
 #include <string.h>
@@ -103,7 +104,7 @@ A million repetitions of "a"
 
 #define LINESIZE 2048
 
-static void SHA1Transform(unsigned long state[5],
+static void SHA1Transform(uint32_t state[5],
     const unsigned char buffer[64]);
 
 #define rol(value,bits) \
@@ -131,18 +132,20 @@ static void SHA1Transform(unsigned long state[5],
 
 /* Hash a single 512-bit block. This is the core of the algorithm. */
 
-static void SHA1Transform(unsigned long state[5],
+static void SHA1Transform(uint32_t state[5],
     const unsigned char buffer[64])
 {
-unsigned long a, b, c, d, e;
+/* Use 32-bit words, so that rol() is also correct on LP64 hosts. */
+uint32_t a, b, c, d, e;
 typedef union {
     unsigned char c[64];
-    unsigned long l[16];
+    uint32_t l[16];
 } CHAR64LONG16;
 CHAR64LONG16* block;
 #ifdef SHA1HANDSOFF
-static unsigned char workspace[64];
-    block = (CHAR64LONG16*)workspace;
+/* Not static, so that several threads can hash at the same time. */
+CHAR64LONG16 workspace;
+    block = &workspace;
     memcpy(block, buffer, 64);
 #else
     block = (CHAR64LONG16*)buffer;
@@ -195,6 +198,37 @@ warning. */
 }
 
 
+/* Hash nblocks consecutive 512-bit blocks. */
+
+static void SHA1TransformBlocksGeneric(uint32_t state[5],
+    const unsigned char *data, unsigned long nblocks)
+{
+    for ( ; nblocks > 0; --nblocks, data += 64) {
+        SHA1Transform(state, data);
+    }
+}
+
+typedef void (*SHA1TransformBlocksFn)(uint32_t state[5],
+    const unsigned char *data, unsigned long nblocks);
+
+/* Selected on the first use.  (Racing threads select the same one.) */
+static SHA1TransformBlocksFn SHA1TransformBlocks = NULL;
+
+static SHA1TransformBlocksFn SHA1SelectTransformBlocks(int allowHardware)
+{
+    if (allowHardware && SHA1HardwareAvailable()) {
+        return SHA1TransformBlocksHardware;
+    }
+    return SHA1TransformBlocksGeneric;
+}
+
+int SHA1SetHardwareAcceleration(int enable)
+{
+    SHA1TransformBlocks = SHA1SelectTransformBlocks(enable);
+    return SHA1TransformBlocks != SHA1TransformBlocksGeneric;
+}
+
+
 /* SHA1Init - Initialize new context */
 
 void SHA1Init(SHA1_CTX* context)
@@ -215,6 +249,11 @@ void SHA1Update(SHA1_CTX* context, const unsigned char* data,
     unsigned long len)  /* JHB */
 {
     unsigned long i, j; /* JHB */
+    unsigned long nblocks;
+
+    if (SHA1TransformBlocks == NULL) {
+        SHA1TransformBlocks = SHA1SelectTransformBlocks(1);
+    }
 
     j = (context->count[0] >> 3) & 63;
     if ((context->count[0] += len << 3) < (len << 3))
@@ -223,10 +262,10 @@ void SHA1Update(SHA1_CTX* context, const unsigned char* data,
     if ((j + len) > 63)
     {
         memcpy(&context->buffer[j], data, (i = 64-j));
-        SHA1Transform(context->state, context->buffer);
-        for ( ; i + 63 < len; i += 64) {
-            SHA1Transform(context->state, &data[i]);
-        }
+        SHA1TransformBlocks(context->state, context->buffer, 1);
+        nblocks = (len - i) / 64;
+        SHA1TransformBlocks(context->state, &data[i], nblocks);
+        i += nblocks * 64;
         j = 0;
     }
     else
@@ -4,8 +4,10 @@
 #ifndef _DALVIK_SHA1
 #define _DALVIK_SHA1
 
+#include <stdint.h>
+
 typedef struct {
-    unsigned long state[5];
+    uint32_t state[5];
     unsigned long count[2];
     unsigned char buffer[64];
 } SHA1_CTX;
@@ -21,6 +23,14 @@ void SHA1Update(SHA1_CTX* context, const unsigned char* data,
     unsigned long len);
 void SHA1Final(unsigned char digest[HASHSIZE], SHA1_CTX* context);
 
+/*
+ * The SHA-1 instructions (SHA-NI on x86, ARMv8 crypto extension on AArch64)
+ * are used when the CPU supports them.  Pass 0 to force the portable C
+ * implementation (e.g. for benchmarking).  Returns nonzero if the hardware
+ * implementation is in use afterwards.
+ */
+int SHA1SetHardwareAcceleration(int enable);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,226 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * SHA-1 block transform with the SHA instructions of the CPU:
+ *  - x86/x86_64: SHA-NI (SHA1RNDS4, SHA1NEXTE, SHA1MSG1, SHA1MSG2).
+ *  - AArch64: ARMv8 crypto extension (SHA1C, SHA1P, SHA1M, SHA1H,
+ *    SHA1SU0, SHA1SU1).
+ *
+ * The instructions are enabled per function with the target attribute, so
+ * that the rest of libbcc still runs on the CPUs without them.  The caller
+ * must check SHA1HardwareAvailable() at runtime.
+ *
+ * Both implementations process 4 rounds per step.  The message schedule
+ * W[t..t+3] for t >= 16 is derived from the previous 16 words, which are
+ * kept in a ring of 4 vectors.
+ */
+
+#include "sha1_hw.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    (defined(__clang__) || \
+     (defined(__GNUC__) && \
+      (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9))))
+#define SHA1_HW_X86 1
+#elif defined(__aarch64__) && (defined(__clang__) || defined(__GNUC__))
+#define SHA1_HW_ARM64 1
+#endif
+
+
+#if defined(SHA1_HW_X86)
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define SHA1_HW_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+
+int SHA1HardwareAvailable(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_max(0, 0) < 7) {
+        return 0;
+    }
+
+    /* SSSE3 (pshufb) and SSE4.1 (pextrd) are needed besides SHA. */
+    __cpuid(1, eax, ebx, ecx, edx);
+    if (!(ecx & (1u << 9)) || !(ecx & (1u << 19))) {
+        return 0;
+    }
+
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    return (ebx & (1u << 29)) != 0;
+}
+
+SHA1_HW_TARGET
+static __m128i SHA1RoundsX86(__m128i abcd, __m128i e, int step)
+{
+    /* The function selector of SHA1RNDS4 must be an immediate. */
+    switch (step / 5) {
+    case 0:  return _mm_sha1rnds4_epu32(abcd, e, 0);
+    case 1:  return _mm_sha1rnds4_epu32(abcd, e, 1);
+    case 2:  return _mm_sha1rnds4_epu32(abcd, e, 2);
+    default: return _mm_sha1rnds4_epu32(abcd, e, 3);
+    }
+}
+
+SHA1_HW_TARGET
+void SHA1TransformBlocksHardware(uint32_t state[5],
+                                 const unsigned char *data,
+                                 unsigned long nblocks)
+{
+    /* Big-endian words; ABCD is kept with A in the highest lane. */
+    const __m128i bswap = _mm_set_epi64x(0x0001020304050607ULL,
+                                         0x08090a0b0c0d0e0fULL);
+
+    __m128i abcd = _mm_shuffle_epi32(
+        _mm_loadu_si128((const __m128i *)state), 0x1B);
+    __m128i e0 = _mm_set_epi32((int)state[4], 0, 0, 0);
+
+    for ( ; nblocks > 0; --nblocks, data += 64) {
+        __m128i abcdSaved = abcd;
+        __m128i e0Saved = e0;
+        __m128i prevAbcd = abcd;
+        __m128i msg[4];
+        __m128i e;
+        int step;
+
+        for (step = 0; step < 4; ++step) {
+            msg[step] = _mm_shuffle_epi8(
+                _mm_loadu_si128((const __m128i *)(data + step * 16)), bswap);
+        }
+
+        for (step = 0; step < 20; ++step) {
+            __m128i *w = &msg[step & 3];
+
+            if (step >= 4) {
+                /* W[t..t+3] from W[t-16..t-1]. */
+                *w = _mm_sha1msg2_epu32(
+                    _mm_xor_si128(_mm_sha1msg1_epu32(*w, msg[(step + 1) & 3]),
+                                  msg[(step + 2) & 3]),
+                    msg[(step + 3) & 3]);
+            }
+
+            e = (step == 0) ? _mm_add_epi32(e0, *w)
+                            : _mm_sha1nexte_epu32(prevAbcd, *w);
+
+            prevAbcd = abcd;
+            abcd = SHA1RoundsX86(abcd, e, step);
+        }
+
+        e0 = _mm_sha1nexte_epu32(prevAbcd, e0Saved);
+        abcd = _mm_add_epi32(abcd, abcdSaved);
+    }
+
+    _mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1B));
+    state[4] = (uint32_t)_mm_extract_epi32(e0, 3);
+}
+
+
+#elif defined(SHA1_HW_ARM64)
+
+#include <arm_neon.h>
+#include <sys/auxv.h>
+
+#ifndef HWCAP_SHA1
+#define HWCAP_SHA1 (1 << 5)
+#endif
+
+#if defined(__clang__)
+#define SHA1_HW_TARGET __attribute__((target("crypto")))
+#else
+#define SHA1_HW_TARGET __attribute__((target("+crypto")))
+#endif
+
+int SHA1HardwareAvailable(void)
+{
+    return (getauxval(AT_HWCAP) & HWCAP_SHA1) != 0;
+}
+
+SHA1_HW_TARGET
+void SHA1TransformBlocksHardware(uint32_t state[5],
+                                 const unsigned char *data,
+                                 unsigned long nblocks)
+{
+    static const uint32_t K[4] = {
+        0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6
+    };
+
+    uint32x4_t abcd = vld1q_u32(state);
+    uint32_t e0 = state[4];
+
+    for ( ; nblocks > 0; --nblocks, data += 64) {
+        uint32x4_t abcdSaved = abcd;
+        uint32_t e0Saved = e0;
+        uint32x4_t msg[4];
+        uint32_t e = e0;
+        int step;
+
+        for (step = 0; step < 4; ++step) {
+            msg[step] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + step * 16)));
+        }
+
+        for (step = 0; step < 20; ++step) {
+            uint32x4_t *w = &msg[step & 3];
+            uint32x4_t wk;
+            uint32_t eNext;
+
+            if (step >= 4) {
+                /* W[t..t+3] from W[t-16..t-1]. */
+                *w = vsha1su1q_u32(
+                    vsha1su0q_u32(*w, msg[(step + 1) & 3], msg[(step + 2) & 3]),
+                    msg[(step + 3) & 3]);
+            }
+
+            wk = vaddq_u32(*w, vdupq_n_u32(K[step / 5]));
+            eNext = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+
+            switch (step / 5) {
+            case 0:  abcd = vsha1cq_u32(abcd, e, wk); break;
+            case 2:  abcd = vsha1mq_u32(abcd, e, wk); break;
+            default: abcd = vsha1pq_u32(abcd, e, wk); break;
+            }
+
+            e = eNext;
+        }
+
+        e0 = e + e0Saved;
+        abcd = vaddq_u32(abcd, abcdSaved);
+    }
+
+    vst1q_u32(state, abcd);
+    state[4] = e0;
+}
+
+
+#else
+
+int SHA1HardwareAvailable(void)
+{
+    return 0;
+}
+
+void SHA1TransformBlocksHardware(uint32_t state[5],
+                                 const unsigned char *data,
+                                 unsigned long nblocks)
+{
+    (void)state;
+    (void)data;
+    (void)nblocks;
+}
+
+#endif
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_SHA1_HW_H
+#define BCC_SHA1_HW_H
+
+#include <stdint.h>
+
+#if defined(__cplusplus)
+extern "C" {
+#endif
+
+/* Returns nonzero if the CPU provides the SHA-1 instructions. */
+int SHA1HardwareAvailable(void);
+
+/* Hash nblocks consecutive 64-byte blocks with the SHA-1 instructions.
+ * Only call this if SHA1HardwareAvailable() returns nonzero. */
+void SHA1TransformBlocksHardware(uint32_t state[5],
+                                 const unsigned char *data,
+                                 unsigned long nblocks);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif /* BCC_SHA1_HW_H */
@@ -30,6 +30,14 @@ typedef struct BCCOpaqueScript *BCCScriptRef;
 typedef void *(*BCCSymbolLookupFn)(void *context, char const *symbolName);
 
 
+/* Cache write callback type.  status is BCC_NO_ERROR if cachePath has been
+ * written, or BCC_CACHE_WRITE_ERROR otherwise.  May be called from the cache
+ * writer thread (see BCC_ASYNC_CACHE_WRITE). */
+typedef void (*BCCCacheWriteCallbackFn)(void *context,
+                                        char const *cachePath,
+                                        int status);
+
+
 /* llvm::Module (see <llvm>/include/llvm-c/Core.h for details) */
 typedef struct LLVMOpaqueModule *LLVMModuleRef;
 
@@ -43,6 +51,8 @@ typedef struct LLVMOpaqueModule *LLVMModuleRef;
 #define BCC_INVALID_VALUE     0x0501
 #define BCC_OUT_OF_MEMORY     0x0505
 
+#define BCC_CACHE_WRITE_ERROR 0x0600
+
 
 /*-------------------------------------------------------------------------*/
 
@@ -51,6 +61,82 @@ typedef struct LLVMOpaqueModule *LLVMModuleRef;
 #define BCC_SKIP_DEP_SHA1 (1 << 0)
 
 
+/* Optional Flags for bccPrepareExecutable, bccPrepareSharedObject */
+
+/* Look up and store the cache in the cache directory of the uid of the
+ * caller, keyed by the content of the sources and the code generation
+ * settings, instead of cacheDir/cacheName.  Identical scripts of the
+ * applications running as the same uid (e.g. with a shared user id) are
+ * compiled only once; the code is never shared between uids, since the
+ * files written by another uid can't be trusted.  cacheDir/cacheName are
+ * still used when the key cannot be computed (e.g. for a source given as
+ * llvm::Module). */
+#define BCC_UID_SHARED_CACHE (1 << 0)
+
+/* Return as soon as the script is loaded, and write its cache file on a
+ * background thread.  Use bccRegisterCacheWriteCallback to learn the
+ * result, and bccWaitForCacheWrites before exiting the process if the cache
+ * files must be written. */
+#define BCC_ASYNC_CACHE_WRITE (1 << 1)
+
+/* Generate the machine code of a large script on several threads.  The
+ * module is split into partitions of functions, which are compiled
+ * separately and linked into one object. */
+#define BCC_PARALLEL_CODEGEN (1 << 2)
+
+/* Return after a quick unoptimized compilation, and generate the optimized
+ * code on a background thread.  The exported functions (and bccGetFuncAddr)
+ * switch to the optimized code once it is loaded; the addresses of the
+ * exported variables stay the same.  Only the optimized code is written to
+ * the cache.  Ignored by bccPrepareSharedObject. */
+#define BCC_TIERED_COMPILE (1 << 3)
+
+/* Read only the function bodies reachable from the exported functions,
+ * root(), init(), .rs.dtor() and the symbols of bccMarkExternalSymbol (in
+ * the script and the library bitcode), instead of parsing all of them
+ * before the unused ones are thrown away. */
+#define BCC_LAZY_BITCODE (1 << 4)
+
+/* Compile the library bitcode (bccLinkBC, bccLinkFile) once into an object
+ * shared by the scripts of the process (and cached in cacheDir), instead of
+ * into every script.  Only the small library functions (to be inlined), and
+ * the variables of the library which are not constant with the functions
+ * using them, are still linked into each script. */
+#define BCC_SHARED_LIBRARY (1 << 5)
+
+/* Generate the machine code of the script while its bitcode is read, on
+ * the codegen threads of BCC_PARALLEL_CODEGEN, instead of after the whole
+ * module is read.  Implies BCC_LAZY_BITCODE.  Ignored for the scripts
+ * linked with a library bitcode (which is optimized with the script as a
+ * whole), with BCC_TIERED_COMPILE, or on a single CPU. */
+#define BCC_STREAMING_COMPILE (1 << 6)
+
+/* Compile the exported functions, root(), init() and .rs.dtor() now, and
+ * each of the other large functions on its first call, so the code never
+ * called (e.g. error paths) is never compiled.  A function referring to a
+ * symbol the symbol lookup doesn't resolve is compiled now, so the script
+ * fails to prepare instead; a function which still fails to compile on its
+ * first call is a fatal error.  The script is not written to the cache.
+ * Ignored with BCC_TIERED_COMPILE and BCC_STREAMING_COMPILE, and by
+ * bccPrepareSharedObject. */
+#define BCC_LAZY_COMPILE (1 << 7)
+
+/* Optimization level of the script, from BCC_OPT_LEVEL(0) (the fastest to
+ * compile; e.g. for the code run once) to BCC_OPT_LEVEL(3) (the default).
+ * It overrides "#pragma bcc_pipeline(...)" of the script (see README). */
+#define BCC_OPT_LEVEL(level) ((((level) & 0x3) | 0x4) << 8)
+#define BCC_OPT_LEVEL_MASK (0x7 << 8)
+#define BCC_OPT_LEVEL_GET(flags) (((flags) >> 8) & 0x3)
+
+/* Keep the machine code of each function of the script next to the cache
+ * file (in cacheDir/cacheName.fncache/), keyed by a hash of the function
+ * and the declarations it refers to.  When the script is compiled again
+ * (e.g. after an edit invalidated the cache file), only the changed
+ * functions go through the code generator.  Ignored without a cache path,
+ * and for the scripts with debug information or aliases. */
+#define BCC_INCREMENTAL_COMPILE (1 << 11)
+
+
 /*-------------------------------------------------------------------------*/
 
 
@@ -97,6 +183,16 @@ int bccLinkFile(BCCScriptRef script,
 
 void bccMarkExternalSymbol(BCCScriptRef script, char const *name);
 
+/* Compile the script within milliseconds (0, the default, for no limit) in
+ * the next bccPrepareExecutable or bccPrepareSharedObject, when it is not
+ * loaded from the cache: cheaper optimizations (e.g. no GVN, then O1, then
+ * the fast register allocator, then O0) are chosen when the estimate of the
+ * compile time doesn't fit.  The code of such a cheaper pipeline is neither
+ * written to the cache nor to the function objects of
+ * BCC_INCREMENTAL_COMPILE, so the script is compiled again on its next
+ * load.  Not applied to the baseline of BCC_TIERED_COMPILE. */
+void bccSetCompileBudget(BCCScriptRef script, unsigned long milliseconds);
+
 int bccPrepareSharedObject(BCCScriptRef script,
                          char const *cacheDir,
                          char const *cacheName,
@@ -107,6 +203,11 @@ int bccPrepareExecutable(BCCScriptRef script,
                          char const *cacheName,
                          unsigned long flags);
 
+void bccRegisterCacheWriteCallback(BCCCacheWriteCallbackFn pFn,
+                                   void *pContext);
+
+void bccWaitForCacheWrites();
+
 void *bccGetFuncAddr(BCCScriptRef script, char const *funcname);
 
 void bccGetExportVarList(BCCScriptRef script,
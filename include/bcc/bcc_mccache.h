@@ -26,7 +26,7 @@
 #define MCO_MAGIC "\0bcc"
 
 /* BCC Cache File Version, encoded in 4 bytes of ASCII */
-#define MCO_VERSION "001\0"
+#define MCO_VERSION "003\0"
 
 /* BCC Cache Header Structure */
 struct MCO_Header {
@@ -72,6 +72,15 @@ struct MCO_Header {
   off_t export_func_name_list_offset;
   size_t export_func_name_list_size;
 
+  /* ELF relocatable object, aligned to a page size */
+  off_t obj_offset;
+  size_t obj_size;
+
+  /* sha1 of the whole dependency table (see calcDependencyDigest() in
+   * Sha1Helper.h), so that a cache file can be validated with the header
+   * alone */
+  uint8_t depend_digest[20];
+
   /* dirty hack for libRS */
   /* TODO: This should be removed in the future */
   uint32_t libRS_threadable;
@@ -24,7 +24,10 @@ include $(LOCAL_PATH)/../../libbcc-config.mk
 
 libbcc_executionengine_SRC_FILES := \
   Compiler.cpp \
+  CompilerResourcePool.cpp \
   FileHandle.cpp \
+  LibraryIndex.cpp \
+  PipelineConfig.cpp \
   Runtime.c \
   RuntimeStub.c \
   Script.cpp \
@@ -36,6 +39,18 @@ libbcc_executionengine_SRC_FILES += \
   OldJIT/ContextManager.cpp
 endif
 
+ifeq ($(libbcc_USE_MCJIT),1)
+libbcc_executionengine_SRC_FILES += \
+  ELFObjectMerger.cpp \
+  HostCPU.cpp \
+  LazyCompiler.cpp \
+  LibraryObject.cpp \
+  ModuleUtils.cpp \
+  ObjectBuffer.cpp \
+  ParallelCodeGen.cpp \
+  TierUpCompiler.cpp
+endif
+
 ifeq ($(libbcc_USE_CACHE),1)
 ifeq ($(libbcc_USE_OLD_JIT),1)
 libbcc_executionengine_SRC_FILES += \
@@ -45,6 +60,8 @@ endif
 
 ifeq ($(libbcc_USE_MCJIT),1)
 libbcc_executionengine_SRC_FILES += \
+  AsyncCacheWriter.cpp \
+  CacheManager.cpp \
   MCCacheWriter.cpp \
   MCCacheReader.cpp
 endif
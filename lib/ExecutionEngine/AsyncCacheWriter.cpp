@@ -0,0 +1,168 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "AsyncCacheWriter.h"
+
+#include "CacheManager.h"
+#include "DebugHelper.h"
+#include "FileHandle.h"
+#include "MCCacheWriter.h"
+
+#include <string.h>
+
+namespace bcc {
+
+CacheWriteJob::~CacheWriteJob() {
+  delete mWriter;
+}
+
+
+bool CacheWriteJob::run() {
+  std::string cachePath(mCacheDir + mFileName);
+
+  // Write to a temporary file and rename() it over the old one when it is
+  // complete.  The old file may still be mapped elsewhere in memory (the
+  // same script may be running concurrently in the same process or a
+  // different process!), and it keeps its contents until it is unmapped.
+  FileHandle cacheFile;
+  bool result = false;
+
+  if (cacheFile.createTemporary(cachePath.c_str()) >= 0) {
+    if (!mWriter->writeCacheFile(&cacheFile)) {
+      // Nothing has been published; just drop the temporary file.
+      cacheFile.discard();
+    } else if (!cacheFile.publish(cachePath.c_str())) {
+      LOGE("Unable to publish the cache file: %s\n", cachePath.c_str());
+    } else {
+      result = true;
+    }
+  }
+
+  if (result && mManaged) {
+    CacheManager(mCacheDir, mLibDigest).add(mFileName, mLibraryFileName);
+  }
+
+  AsyncCacheWriter::get().report(cachePath.c_str(),
+                                 result ? BCC_NO_ERROR : BCC_CACHE_WRITE_ERROR);
+  return result;
+}
+
+
+AsyncCacheWriter AsyncCacheWriter::TheAsyncCacheWriter;
+
+
+AsyncCacheWriter::AsyncCacheWriter()
+  : mBusy(false), mThreadStarted(false),
+    mpCallback(NULL), mpCallbackContext(NULL) {
+  pthread_mutex_init(&mLock, NULL);
+  pthread_cond_init(&mJobAvailable, NULL);
+  pthread_cond_init(&mIdle, NULL);
+}
+
+
+void AsyncCacheWriter::enqueue(CacheWriteJob *job) {
+  pthread_mutex_lock(&mLock);
+
+  if (!mThreadStarted) {
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    mThreadStarted = (pthread_create(&thread, &attr, threadMain, this) == 0);
+    pthread_attr_destroy(&attr);
+
+    if (!mThreadStarted) {
+      pthread_mutex_unlock(&mLock);
+
+      LOGE("Unable to start the cache writer thread.  Write synchronously.\n");
+      job->run();
+      delete job;
+      return;
+    }
+  }
+
+  mQueue.push_back(job);
+  pthread_cond_signal(&mJobAvailable);
+  pthread_mutex_unlock(&mLock);
+}
+
+
+void AsyncCacheWriter::waitForIdle() {
+  pthread_mutex_lock(&mLock);
+  while (mBusy || !mQueue.empty()) {
+    pthread_cond_wait(&mIdle, &mLock);
+  }
+  pthread_mutex_unlock(&mLock);
+}
+
+
+void AsyncCacheWriter::registerCallback(BCCCacheWriteCallbackFn pFn,
+                                        void *pContext) {
+  pthread_mutex_lock(&mLock);
+  mpCallback = pFn;
+  mpCallbackContext = pContext;
+  pthread_mutex_unlock(&mLock);
+}
+
+
+void AsyncCacheWriter::report(char const *cachePath, int status) {
+  pthread_mutex_lock(&mLock);
+  BCCCacheWriteCallbackFn pFn = mpCallback;
+  void *pContext = mpCallbackContext;
+  pthread_mutex_unlock(&mLock);
+
+  if (status != BCC_NO_ERROR) {
+    LOGE("Unable to write the cache file: %s\n", cachePath);
+  }
+
+  if (pFn) {
+    pFn(pContext, cachePath, status);
+  }
+}
+
+
+void *AsyncCacheWriter::threadMain(void *arg) {
+  static_cast<AsyncCacheWriter *>(arg)->processJobs();
+  return NULL;
+}
+
+
+void AsyncCacheWriter::processJobs() {
+  pthread_mutex_lock(&mLock);
+
+  while (true) {
+    while (mQueue.empty()) {
+      pthread_cond_wait(&mJobAvailable, &mLock);
+    }
+
+    CacheWriteJob *job = mQueue.front();
+    mQueue.pop_front();
+    mBusy = true;
+
+    pthread_mutex_unlock(&mLock);
+    job->run();
+    delete job;
+    pthread_mutex_lock(&mLock);
+
+    mBusy = false;
+    if (mQueue.empty()) {
+      pthread_cond_broadcast(&mIdle);
+    }
+  }
+}
+
+} // namespace bcc
@@ -0,0 +1,99 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_ASYNCCACHEWRITER_H
+#define BCC_ASYNCCACHEWRITER_H
+
+#include <bcc/bcc.h>
+
+#include "Config.h"
+
+#include <pthread.h>
+
+#include <deque>
+#include <string>
+
+namespace bcc {
+  class MCCacheWriter;
+
+  // A prepared cache file to be published as mCacheDir + mFileName.
+  struct CacheWriteJob {
+    MCCacheWriter *mWriter;     // Owned by the job.
+
+    std::string mCacheDir;
+    std::string mFileName;
+
+    // The library object in mCacheDir the script was compiled with, if any
+    std::string mLibraryFileName;
+
+    // Record the files in the CacheManager of mCacheDir with mLibDigest.
+    bool mManaged;
+    unsigned char mLibDigest[20];
+
+    CacheWriteJob() : mWriter(NULL), mManaged(false) {
+    }
+
+    ~CacheWriteJob();
+
+    // Write, publish and record the cache file, then report the result to
+    // the callback registered by bccRegisterCacheWriteCallback().
+    bool run();
+  };
+
+  // Writes the cache files on a background thread, so that the script is
+  // usable before its cache file reaches the disk.
+  class AsyncCacheWriter {
+  private:
+    static AsyncCacheWriter TheAsyncCacheWriter;
+
+    pthread_mutex_t mLock;
+    pthread_cond_t mJobAvailable;
+    pthread_cond_t mIdle;
+
+    std::deque<CacheWriteJob *> mQueue;
+    bool mBusy;
+    bool mThreadStarted;
+
+    BCCCacheWriteCallbackFn mpCallback;
+    void *mpCallbackContext;
+
+    AsyncCacheWriter();
+
+  public:
+    static AsyncCacheWriter &get() {
+      return TheAsyncCacheWriter;
+    }
+
+    // Take the ownership of the job and run it on the writer thread.  The
+    // job must not refer to the script (see MCCacheWriter::detach()).
+    void enqueue(CacheWriteJob *job);
+
+    // Block until all enqueued jobs are done.
+    void waitForIdle();
+
+    void registerCallback(BCCCacheWriteCallbackFn pFn, void *pContext);
+
+    void report(char const *cachePath, int status);
+
+  private:
+    static void *threadMain(void *arg);
+
+    void processJobs();
+  };
+
+} // namespace bcc
+
+#endif // BCC_ASYNCCACHEWRITER_H
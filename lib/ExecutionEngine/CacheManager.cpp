@@ -0,0 +1,513 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CacheManager.h"
+
+#include "DebugHelper.h"
+#include "FileHandle.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include <cutils/properties.h>
+
+namespace {
+
+// On-disk layout of the index: IndexHeader, followed by IndexHeader::count
+// records of IndexRecord, each followed by nameLength bytes of the name.
+struct IndexHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+};
+
+struct IndexRecord {
+  uint64_t size;
+  int64_t lastAccess;
+  unsigned char libDigest[20];
+  uint32_t nameLength;
+};
+
+char const IndexMagic[8] = { 'b', 'c', 'c', 'i', 'n', 'd', 'e', 'x' };
+uint32_t const IndexVersion = 1;
+
+char const IndexFileName[] = "bcc.index";
+char const LockFileName[] = "bcc.index.lock";
+
+// Cache files handled by CacheManager: the scripts, the library objects
+// (see BCC_SHARED_LIBRARY), and the directories of the function objects
+// (see BCC_INCREMENTAL_COMPILE), which are accounted and evicted as a whole.
+char const *const CacheFileSuffixes[] = { ".mco", ".libo", ".fncache" };
+char const FunctionCacheSuffix[] = ".fncache";
+char const ScriptCacheSuffix[] = ".mco";
+
+// The older versions kept the ELF object and the metadata of a script in
+// <name>.o and <name>.info.  They are never loaded again.
+char const *const LegacyCacheFileSuffixes[] = { ".o", ".info" };
+
+// The digest of the cache files whose libbcc and libRS are unknown.  It
+// never matches, so they are removed unless they are loaded (see touch()).
+unsigned char const UnknownLibDigest[20] = { 0 };
+
+// The last access time is only written back when it is older than this, so
+// that a cache hit usually doesn't write the index.
+int64_t const TouchGranularity = 60 * 60;
+
+// A temporary file (see FileHandle::createTemporary()) older than this is
+// left by a crashed writer.
+time_t const TemporaryFileMaxAge = 60 * 60;
+
+bool endsWith(std::string const &str, char const *suffix) {
+  size_t len = strlen(suffix);
+  return str.size() >= len &&
+         str.compare(str.size() - len, len, suffix) == 0;
+}
+
+bool isCacheFile(std::string const &name) {
+  for (size_t i = 0; i < sizeof(CacheFileSuffixes) / sizeof(char const *);
+       ++i) {
+    if (endsWith(name, CacheFileSuffixes[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool isFunctionCache(std::string const &name) {
+  return endsWith(name, FunctionCacheSuffix);
+}
+
+bool isLegacyCacheFile(std::string const &name) {
+  for (size_t i = 0;
+       i < sizeof(LegacyCacheFileSuffixes) / sizeof(char const *); ++i) {
+    if (endsWith(name, LegacyCacheFileSuffixes[i])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The size of path, or of the files in it if it is a directory.  Return
+// false if it doesn't exist.
+bool getSize(std::string const &path, uint64_t &size, time_t &mtime) {
+  struct stat sfile;
+  if (stat(path.c_str(), &sfile) != 0) {
+    return false;
+  }
+
+  mtime = sfile.st_mtime;
+
+  if (!S_ISDIR(sfile.st_mode)) {
+    size = sfile.st_size;
+    return true;
+  }
+
+  size = 0;
+
+  DIR *dir = opendir(path.c_str());
+  if (!dir) {
+    return true;
+  }
+
+  while (struct dirent *ent = readdir(dir)) {
+    if (stat((path + "/" + ent->d_name).c_str(), &sfile) == 0 &&
+        S_ISREG(sfile.st_mode)) {
+      size += sfile.st_size;
+    }
+  }
+
+  closedir(dir);
+  return true;
+}
+
+// Temporary files are named <target>.XXXXXX.
+bool isTemporaryFile(std::string const &name) {
+  size_t dot = name.rfind('.');
+  if (dot == std::string::npos || name.size() - dot != 7) {
+    return false;
+  }
+
+  std::string target(name, 0, dot);
+  return isCacheFile(target) ||
+         target == IndexFileName ||
+         target == "bcc.sha1memo";
+}
+
+} // anonymous namespace
+
+namespace bcc {
+
+CacheManager::CacheManager(std::string const &cacheDir,
+                           unsigned char const *libDigest)
+  : mCacheDir(cacheDir) {
+  memcpy(mLibDigest, libDigest, sizeof(mLibDigest));
+}
+
+
+uint64_t CacheManager::getBudget() {
+  char buf[PROPERTY_VALUE_MAX];
+  property_get("debug.bcc.cachebudget", buf, "");
+
+  if (buf[0] != '\0') {
+    char *end;
+    unsigned long long budget = strtoull(buf, &end, 10);
+    if (*end == '\0') {
+      return budget;
+    }
+  }
+
+  return BCC_CACHE_BUDGET;
+}
+
+
+void CacheManager::touch(std::string const &name) {
+  // A cache hit reads the index without the lock, and only takes the lock
+  // when the last access time is due to be written, without waiting for
+  // it: a busy index just misses an update.
+  load();
+
+  int64_t now = time(NULL);
+  EntryMap::iterator I = mEntries.find(name);
+
+  if (I != mEntries.end() && now - I->second.lastAccess < TouchGranularity &&
+      memcmp(I->second.libDigest, mLibDigest, sizeof(mLibDigest)) == 0) {
+    return;
+  }
+
+  FileHandle lockFile;
+  if (!lock(lockFile, /* wait= */ false)) {
+    return;
+  }
+
+  load();
+  I = mEntries.find(name);
+
+  if (I == mEntries.end()) {
+    // Written before the index existed.
+    if (!addEntry(name, now, mLibDigest)) {
+      return;
+    }
+  } else if (memcmp(I->second.libDigest, mLibDigest,
+                    sizeof(mLibDigest)) != 0) {
+    // Found in the directory by collectGarbage(), and usable after all.
+    memcpy(I->second.libDigest, mLibDigest, sizeof(mLibDigest));
+    I->second.lastAccess = now;
+  } else if (now - I->second.lastAccess >= TouchGranularity) {
+    I->second.lastAccess = now;
+  } else {
+    return;
+  }
+
+  save();
+}
+
+
+void CacheManager::add(std::string const &name, std::string const &libName) {
+  FileHandle lockFile;
+  if (!lock(lockFile, /* wait= */ true)) {
+    return;
+  }
+
+  load();
+
+  time_t now = time(NULL);
+  addEntry(name, now, mLibDigest);
+  if (!libName.empty()) {
+    addEntry(libName, now, mLibDigest);
+  }
+  collectGarbage(now);
+  evict(name);
+
+  save();
+}
+
+
+bool CacheManager::lock(FileHandle &lockFile, bool wait) {
+  std::string lockPath(mCacheDir + LockFileName);
+
+  if (lockFile.open(lockPath.c_str(),
+                    wait ? OpenMode::Write : OpenMode::TryWrite) < 0) {
+    if (wait) {
+      LOGE("Unable to lock the cache index in %s\n", mCacheDir.c_str());
+    }
+    return false;
+  }
+
+  return true;
+}
+
+
+void CacheManager::load() {
+  mEntries.clear();
+
+  std::string indexPath(mCacheDir + IndexFileName);
+
+  FileHandle file;
+  if (file.open(indexPath.c_str(), OpenMode::ReadUnlocked) < 0) {
+    // No index yet.
+    return;
+  }
+
+  struct stat sfile;
+  if (fstat(file.getFD(), &sfile) != 0 ||
+      sfile.st_size < (off_t)sizeof(IndexHeader)) {
+    return;
+  }
+
+  std::vector<char> buf(sfile.st_size);
+  if (file.pread(&*buf.begin(), buf.size(), 0) != (ssize_t)buf.size()) {
+    LOGE("Unable to read the cache index: %s\n", indexPath.c_str());
+    return;
+  }
+
+  IndexHeader header;
+  memcpy(&header, &*buf.begin(), sizeof(header));
+
+  if (memcmp(header.magic, IndexMagic, sizeof(IndexMagic)) != 0 ||
+      header.version != IndexVersion) {
+    LOGW("Ignore the invalid cache index: %s\n", indexPath.c_str());
+    return;
+  }
+
+  size_t pos = sizeof(header);
+  for (uint32_t i = 0; i < header.count; ++i) {
+    IndexRecord record;
+
+    if (buf.size() - pos < sizeof(record)) {
+      break;
+    }
+    memcpy(&record, &buf[pos], sizeof(record));
+    pos += sizeof(record);
+
+    if (buf.size() - pos < record.nameLength) {
+      break;
+    }
+    std::string name(&buf[pos], record.nameLength);
+    pos += record.nameLength;
+
+    Entry &entry = mEntries[name];
+    entry.size = record.size;
+    entry.lastAccess = record.lastAccess;
+    memcpy(entry.libDigest, record.libDigest, sizeof(entry.libDigest));
+  }
+}
+
+
+void CacheManager::save() {
+  std::string buf;
+
+  IndexHeader header;
+  memcpy(header.magic, IndexMagic, sizeof(IndexMagic));
+  header.version = IndexVersion;
+  header.count = mEntries.size();
+  buf.append(reinterpret_cast<char const *>(&header), sizeof(header));
+
+  for (EntryMap::const_iterator I = mEntries.begin(), E = mEntries.end();
+       I != E; ++I) {
+    IndexRecord record;
+    memset(&record, '\0', sizeof(record));
+    record.size = I->second.size;
+    record.lastAccess = I->second.lastAccess;
+    memcpy(record.libDigest, I->second.libDigest, sizeof(record.libDigest));
+    record.nameLength = I->first.size();
+
+    buf.append(reinterpret_cast<char const *>(&record), sizeof(record));
+    buf.append(I->first);
+  }
+
+  std::string indexPath(mCacheDir + IndexFileName);
+
+  FileHandle file;
+  if (file.createTemporary(indexPath.c_str()) < 0) {
+    return;
+  }
+
+  if (file.write(buf.data(), buf.size()) != (ssize_t)buf.size()) {
+    LOGE("Unable to write the cache index: %s\n", indexPath.c_str());
+    file.discard();
+    return;
+  }
+
+  file.publish(indexPath.c_str());
+}
+
+
+bool CacheManager::addEntry(std::string const &name, int64_t lastAccess,
+                            unsigned char const *libDigest) {
+  uint64_t size;
+  time_t mtime;
+  if (!getSize(mCacheDir + name, size, mtime)) {
+    return false;
+  }
+
+  Entry &entry = mEntries[name];
+  entry.size = size;
+  entry.lastAccess = lastAccess;
+  memcpy(entry.libDigest, libDigest, sizeof(entry.libDigest));
+  return true;
+}
+
+
+void CacheManager::collectGarbage(time_t now) {
+  // Drop the entries which can never be loaded again, and the entries whose
+  // files are gone.
+  for (EntryMap::iterator I = mEntries.begin(); I != mEntries.end(); ) {
+    EntryMap::iterator Cur = I++;
+
+    if (memcmp(Cur->second.libDigest, mLibDigest, sizeof(mLibDigest)) != 0) {
+      LOGI("Remove cache file built with another libbcc or libRS: %s\n",
+           Cur->first.c_str());
+      removeFile(Cur->first);
+      mEntries.erase(Cur);
+    } else if (access((mCacheDir + Cur->first).c_str(), F_OK) != 0) {
+      mEntries.erase(Cur);
+    }
+  }
+
+  DIR *dir = opendir(mCacheDir.c_str());
+  if (!dir) {
+    LOGE("Unable to scan cache directory %s.  (reason: %s)\n",
+         mCacheDir.c_str(), strerror(errno));
+    return;
+  }
+
+  while (struct dirent *ent = readdir(dir)) {
+    std::string name(ent->d_name);
+    struct stat sfile;
+
+    if (isTemporaryFile(name)) {
+      if (stat((mCacheDir + name).c_str(), &sfile) == 0 &&
+          now - sfile.st_mtime > TemporaryFileMaxAge) {
+        LOGI("Remove stale temporary file: %s\n", name.c_str());
+        removeFile(name);
+      }
+    } else if (isLegacyCacheFile(name)) {
+      if (stat((mCacheDir + name).c_str(), &sfile) == 0 &&
+          S_ISREG(sfile.st_mode)) {
+        LOGI("Remove cache file of an older version: %s\n", name.c_str());
+        removeFile(name);
+      }
+    } else if (isCacheFile(name)) {
+      EntryMap::iterator I = mEntries.find(name);
+      uint64_t size;
+      time_t mtime;
+
+      if (!getSize(mCacheDir + name, size, mtime)) {
+        continue;
+      }
+
+      if (I == mEntries.end()) {
+        // Written before the index existed, or by another writer; its age
+        // is all we know.  The function objects are as usable as their
+        // script.  The others are removed by the next pass unless they are
+        // loaded in the meantime.
+        unsigned char const *libDigest = UnknownLibDigest;
+
+        if (isFunctionCache(name)) {
+          std::string script(name, 0, name.size() -
+                                      (sizeof(FunctionCacheSuffix) - 1));
+          EntryMap::const_iterator S =
+            mEntries.find(script + ScriptCacheSuffix);
+          if (S != mEntries.end()) {
+            libDigest = S->second.libDigest;
+          }
+        }
+
+        addEntry(name, mtime, libDigest);
+      } else if (isFunctionCache(name)) {
+        // The function objects change with each compilation of the script.
+        I->second.size = size;
+        if (mtime > I->second.lastAccess) {
+          I->second.lastAccess = mtime;
+        }
+      }
+    }
+  }
+
+  closedir(dir);
+}
+
+
+void CacheManager::evict(std::string const &keep) {
+  uint64_t budget = getBudget();
+  uint64_t total = 0;
+
+  for (EntryMap::const_iterator I = mEntries.begin(), E = mEntries.end();
+       I != E; ++I) {
+    total += I->second.size;
+  }
+
+  while (total > budget) {
+    EntryMap::iterator Victim = mEntries.end();
+
+    for (EntryMap::iterator I = mEntries.begin(), E = mEntries.end();
+         I != E; ++I) {
+      if (I->first != keep &&
+          (Victim == mEntries.end() ||
+           I->second.lastAccess < Victim->second.lastAccess)) {
+        Victim = I;
+      }
+    }
+
+    if (Victim == mEntries.end()) {
+      // Only the newly written file is left.  Keep it even if it exceeds the
+      // budget by itself.
+      break;
+    }
+
+    LOGI("Evict cache file: %s (%llu bytes)\n", Victim->first.c_str(),
+         (unsigned long long)Victim->second.size);
+
+    total -= Victim->second.size;
+    removeFile(Victim->first);
+    mEntries.erase(Victim);
+  }
+}
+
+
+void CacheManager::removeFile(std::string const &name) {
+  std::string path(mCacheDir + name);
+
+  if (isFunctionCache(name)) {
+    if (DIR *dir = opendir(path.c_str())) {
+      while (struct dirent *ent = readdir(dir)) {
+        if (strcmp(ent->d_name, ".") != 0 && strcmp(ent->d_name, "..") != 0) {
+          unlink((path + "/" + ent->d_name).c_str());
+        }
+      }
+      closedir(dir);
+    }
+
+    if (rmdir(path.c_str()) != 0 && errno != ENOENT) {
+      LOGE("Unable to remove %s.  (reason: %s)\n", path.c_str(),
+           strerror(errno));
+    }
+    return;
+  }
+
+  if (unlink(path.c_str()) != 0 && errno != ENOENT) {
+    LOGE("Unable to remove %s.  (reason: %s)\n", path.c_str(), strerror(errno));
+  }
+}
+
+} // namespace bcc
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_CACHEMANAGER_H
+#define BCC_CACHEMANAGER_H
+
+#include "Config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <map>
+#include <string>
+
+namespace bcc {
+  class FileHandle;
+
+  // Keeps an index (bcc.index) of the cache files in a cache directory (the
+  // scripts, the library objects and the function object directories), with
+  // their sizes and last access times, and bounds their total size.  Each
+  // update holds the lock of the index, so the processes sharing the
+  // directory see a consistent index.
+  class CacheManager {
+  private:
+    struct Entry {
+      uint64_t size;
+      int64_t lastAccess;
+      unsigned char libDigest[20];
+    };
+
+    typedef std::map<std::string, Entry> EntryMap;
+
+    std::string mCacheDir;
+    unsigned char mLibDigest[20];
+
+    EntryMap mEntries;
+
+  public:
+    // libDigest identifies the libbcc and libRS in use.  The cache files
+    // written with a different libDigest will never be loaded again.
+    CacheManager(std::string const &cacheDir, unsigned char const *libDigest);
+
+    // Record a use of the cache file, which has just been loaded, so it is
+    // usable with libDigest.  Skipped if the index is locked.
+    void touch(std::string const &name);
+
+    // Record a newly written cache file, and the library object (libName)
+    // written along with it, if any.  Then remove the unusable files and
+    // evict the least recently used ones until the budget is met.
+    void add(std::string const &name, std::string const &libName);
+
+    // The byte budget of a cache directory.
+    static uint64_t getBudget();
+
+  private:
+    // Return false if the lock is not taken, at once unless wait.
+    bool lock(FileHandle &lockFile, bool wait);
+
+    void load();
+
+    void save();
+
+    bool addEntry(std::string const &name, int64_t lastAccess,
+                  unsigned char const *libDigest);
+
+    void collectGarbage(time_t now);
+
+    void evict(std::string const &keep);
+
+    void removeFile(std::string const &name);
+  };
+
+} // namespace bcc
+
+#endif // BCC_CACHEMANAGER_H
@@ -16,6 +16,7 @@
 
 #include "Compiler.h"
 
+#include "CompilerResourcePool.h"
 #include "Config.h"
 
 #if USE_OLD_JIT
@@ -28,11 +29,18 @@
 
 #include "DebugHelper.h"
 #include "FileHandle.h"
+#include "LibraryIndex.h"
+#include "LibraryObject.h"
+#include "ObjectBuffer.h"
+#include "ParallelCodeGen.h"
 #include "Runtime.h"
 #include "ScriptCompiled.h"
 #include "Sha1Helper.h"
 
 #if USE_MCJIT
+#include "HostCPU.h"
+#include "LazyCompiler.h"
+#include "TierUpCompiler.h"
 #include "librsloader.h"
 #endif
 
@@ -50,6 +58,7 @@
 
 #include "llvm/Transforms/IPO.h"
 #include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Utils/Cloning.h"
 
 #include "llvm/Target/TargetData.h"
 #include "llvm/Target/TargetMachine.h"
@@ -60,8 +69,10 @@
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/TargetRegistry.h"
 #include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/Threading.h"
 
 #include "llvm/Type.h"
+#include "llvm/Constants.h"
 #include "llvm/GlobalValue.h"
 #include "llvm/Linker.h"
 #include "llvm/LLVMContext.h"
@@ -77,23 +88,115 @@
 #include <unistd.h>
 
 #include <string.h>
+#include <time.h>
 
 #include <algorithm>
 #include <iterator>
+#include <set>
 #include <string>
 #include <vector>
 
+#include <pthread.h>
+
+namespace {
+
+// The register allocator is passed to the code generator through a global
+// default, which is read as the passes are added.
+pthread_mutex_t RegAllocLock = PTHREAD_MUTEX_INITIALIZER;
+
+pthread_once_t GlobalInitOnce = PTHREAD_ONCE_INIT;
+
+
+// The monotonic time in nanoseconds
+int64_t getTime() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+
+size_t getInstructionCount(llvm::Module const *M) {
+  size_t numInsts = 0;
+  for (llvm::Module::const_iterator F = M->begin(), FE = M->end();
+       F != FE; ++F) {
+    for (llvm::Function::const_iterator
+         BB = F->begin(), BE = F->end(); BB != BE; ++BB) {
+      numInsts += BB->size();
+    }
+  }
+  return numInsts;
+}
+
+
+// The speed of the device, in percent of the one the estimates of
+// Compiler::fitPipeline() are for, given that the LTO of config took time
+// for numInsts instructions.
+unsigned getSpeed(bcc::PipelineConfig const &config, size_t numInsts,
+                  int64_t time) {
+  uint64_t estimate = static_cast<uint64_t>(config.getLTOCost()) *
+                      BCC_LTO_NS_PER_INSTRUCTION * numInsts / 100;
+
+  if (time <= 0 || estimate == 0) {
+    return 100;
+  }
+
+  // A single measurement says little; keep the correction moderate.
+  uint64_t speed = estimate * 100 / time;
+  return std::max<uint64_t>(25, std::min<uint64_t>(speed, 400));
+}
+
+// The worklist of Compiler::materializeReachable()
+class ReachableValues {
+private:
+  std::set<llvm::Value *> mVisited;
+  std::vector<llvm::GlobalValue *> mWorklist;
+
+public:
+  void add(llvm::GlobalValue *GV) {
+    if (GV && mVisited.insert(GV).second) {
+      mWorklist.push_back(GV);
+    }
+  }
+
+  // Add the global values C refers to.
+  void addConstant(llvm::Constant *C) {
+    if (llvm::GlobalValue *GV = llvm::dyn_cast<llvm::GlobalValue>(C)) {
+      add(GV);
+      return;
+    }
+
+    if (!mVisited.insert(C).second) {
+      return;
+    }
+
+    // (The operands of a blockaddress include a basic block.)
+    for (unsigned i = 0, e = C->getNumOperands(); i != e; ++i) {
+      llvm::Value *Op = C->getOperand(i);
+      if (llvm::isa<llvm::Constant>(Op)) {
+        addConstant(llvm::cast<llvm::Constant>(Op));
+      }
+    }
+  }
+
+  llvm::GlobalValue *next() {
+    if (mWorklist.empty()) {
+      return NULL;
+    }
+
+    llvm::GlobalValue *GV = mWorklist.back();
+    mWorklist.pop_back();
+    return GV;
+  }
+};
+
+} // namespace anonymous
+
 namespace bcc {
 
 //////////////////////////////////////////////////////////////////////////////
 // BCC Compiler Static Variables
 //////////////////////////////////////////////////////////////////////////////
 
-bool Compiler::GlobalInitialized = false;
-
-// Code generation optimization level for the compiler
-llvm::CodeGenOpt::Level Compiler::CodeGenOptLevel;
-
 std::string Compiler::Triple;
 
 std::string Compiler::CPU;
@@ -104,6 +207,10 @@ std::vector<std::string> Compiler::Features;
 // slang.cpp)
 const llvm::StringRef Compiler::PragmaMetadataName = "#pragma";
 
+// Name of the pragma describing the optimization pipeline of the script (see
+// PipelineConfig.h)
+const llvm::StringRef Compiler::PipelinePragmaName = "bcc_pipeline";
+
 // Name of metadata node where exported variable names reside (should be
 // synced with slang_rs_metadata.h)
 const llvm::StringRef Compiler::ExportVarMetadataName = "#rs_export_var";
@@ -121,40 +228,60 @@ const llvm::StringRef Compiler::ObjectSlotMetadataName = "#rs_object_slots";
 //////////////////////////////////////////////////////////////////////////////
 
 void Compiler::GlobalInitialization() {
-  if (GlobalInitialized)
-    return;
-  // if (!llvm::llvm_is_multithreaded())
-  //   llvm::llvm_start_multithreaded();
+  pthread_once(&GlobalInitOnce, initializeGlobals);
+}
+
+
+void Compiler::initializeGlobals() {
+  // The scripts may be compiled on several threads at once, so LLVM must
+  // guard its global state (e.g. the pass registry) from now on.
+  llvm::llvm_start_multithreaded();
+
+  // The handler is global too, so it can't refer to a compilation.
+  llvm::install_fatal_error_handler(LLVMErrorHandler, NULL);
 
   // Set Triple, CPU and Features here
   Triple = TARGET_TRIPLE_STRING;
 
+  // The code runs on this device, so MCJIT tunes it for the CPU found here
+  // when it can.  (The ARMCodeEmitter of the old JIT can't emit NEON.)
+  bool detected = false;
+#if USE_MCJIT && ((defined(DEFAULT_ARM_CODEGEN) && defined(__arm__)) || \
+                  (defined(DEFAULT_X86_CODEGEN) && defined(__i386__)) || \
+                  (defined(DEFAULT_X86_64_CODEGEN) && defined(__x86_64__)))
+  detected = detectHostCPU(CPU, Features);
+#endif
+
 #if defined(DEFAULT_ARM_CODEGEN)
+  if (!detected) {
 
 #if defined(ARCH_ARM_HAVE_VFP) && __ARM_ARCH__ >= 7
-  Features.push_back("+vfp3");
+    Features.push_back("+vfp3");
 #if !defined(ARCH_ARM_HAVE_VFP_D32)
-  Features.push_back("+d16");
+    Features.push_back("+d16");
 #endif
 #elif defined(ARCH_ARM_HAVE_VFP)
-  Features.push_back("+vfp2");
+    Features.push_back("+vfp2");
 #endif
 
-  // NOTE: Currently, we have to turn off the support for NEON explicitly.
-  // Since the ARMCodeEmitter.cpp is not ready for JITing NEON
-  // instructions.
+    // NOTE: Currently, we have to turn off the support for NEON explicitly.
+    // Since the ARMCodeEmitter.cpp is not ready for JITing NEON
+    // instructions.
 
-  // FIXME: Re-enable NEON when ARMCodeEmitter supports NEON.
+    // FIXME: Re-enable NEON when ARMCodeEmitter supports NEON.
 #define USE_ARM_NEON 0
 #if USE_ARM_NEON
-  Features.push_back("+neon");
-  Features.push_back("+neonfp");
+    Features.push_back("+neon");
+    Features.push_back("+neonfp");
 #else
-  Features.push_back("-neon");
-  Features.push_back("-neonfp");
+    Features.push_back("-neon");
+    Features.push_back("-neonfp");
 #endif // USE_ARM_NEON
+  }
 #endif // DEFAULT_ARM_CODEGEN
 
+  (void)detected;
+
 #if defined(PROVIDE_ARM_CODEGEN)
   LLVMInitializeARMAsmPrinter();
   LLVMInitializeARMTargetMC();
@@ -173,12 +300,6 @@ void Compiler::GlobalInitialization() {
   InitializeDisassembler();
 #endif
 
-  // -O0: llvm::CodeGenOpt::None
-  // -O1: llvm::CodeGenOpt::Less
-  // -O2: llvm::CodeGenOpt::Default
-  // -O3: llvm::CodeGenOpt::Aggressive
-  CodeGenOptLevel = llvm::CodeGenOpt::Aggressive;
-
   // Below are the global settings to LLVM
 
   // Disable frame pointer elimination optimization
@@ -198,28 +319,18 @@ void Compiler::GlobalInitialization() {
   // Register the scheduler
   llvm::RegisterScheduler::setDefault(llvm::createDefaultScheduler);
 
-  // Register allocation policy:
-  //  createFastRegisterAllocator: fast but bad quality
-  //  createLinearScanRegisterAllocator: not so fast but good quality
-  llvm::RegisterRegAlloc::setDefault
-    ((CodeGenOptLevel == llvm::CodeGenOpt::None) ?
-     llvm::createFastRegisterAllocator :
-     llvm::createLinearScanRegisterAllocator);
+  // The register allocator and the opt level are chosen per script (see
+  // PipelineConfig.)
 
 #if USE_CACHE
-  // Read in SHA1 checksum of libbcc and libRS.
+  // Read in SHA1 checksum of libbcc.  (The checksum of libRS is calculated
+  // when the cache is checked, see Script::internalLoadCache().)
   readSHA1(sha1LibBCC_SHA1, sizeof(sha1LibBCC_SHA1), pathLibBCC_SHA1);
-
-  calcFileSHA1(sha1LibRS, pathLibRS);
 #endif
-
-  GlobalInitialized = true;
 }
 
 
 void Compiler::LLVMErrorHandler(void *UserData, const std::string &Message) {
-  std::string *Error = static_cast<std::string*>(UserData);
-  Error->assign(Message);
   LOGE("%s", Message.c_str());
   exit(1);
 }
@@ -244,22 +355,38 @@ CodeEmitter *Compiler::createCodeEmitter() {
 Compiler::Compiler(ScriptCompiled *result)
   : mpResult(result),
 #if USE_MCJIT
+    mObject(NULL),
     mRSExecutable(NULL),
+    mTierUp(NULL),
+    mLazy(NULL),
+    mLibraryObject(NULL),
+    mFunctionCacheFastHash(false),
 #endif
     mpSymbolLookupFn(NULL),
     mpSymbolLookupContext(NULL),
-    mContext(NULL),
     mModule(NULL),
-    mHasLinked(false) /* Turn off linker */ {
-  llvm::remove_fatal_error_handler();
-  llvm::install_fatal_error_handler(LLVMErrorHandler, &mError);
-  mContext = new llvm::LLVMContext();
+    mHasLinked(false) /* Turn off linker */,
+    mCompileFlags(0),
+    mDeadline(0),
+    mPipelineDegraded(false) {
+  CompilerResourcePool::get().acquireContext(mContext);
   return;
 }
 
 
-llvm::Module *Compiler::parseBitcodeFile(llvm::MemoryBuffer *MEM) {
-  llvm::Module *result = llvm::ParseBitcodeFile(MEM, *mContext, &mError);
+llvm::Module *Compiler::parseBitcodeFile(
+    llvm::OwningPtr<llvm::MemoryBuffer> &MEM) {
+  llvm::Module *result;
+
+  if (mCompileFlags & (BCC_LAZY_BITCODE | BCC_STREAMING_COMPILE)) {
+    result = llvm::getLazyBitcodeModule(MEM.get(), *mContext.mContext,
+                                        &mError);
+    if (result) {
+      MEM.take();  // Owned by the materializer of the module
+    }
+  } else {
+    result = llvm::ParseBitcodeFile(MEM.get(), *mContext.mContext, &mError);
+  }
 
   if (!result) {
     LOGE("Unable to ParseBitcodeFile: %s\n", mError.c_str());
@@ -271,6 +398,28 @@ llvm::Module *Compiler::parseBitcodeFile(llvm::MemoryBuffer *MEM) {
 
 
 int Compiler::linkModule(llvm::Module *moduleWith) {
+#if USE_MCJIT
+  // All of the library goes into the library object.
+  if (!mLibraryObjectKey.empty() &&
+      moduleWith->MaterializeAllPermanently(&mError)) {
+    LOGE("Unable to read the library: %s\n", mError.c_str());
+    delete moduleWith;
+    return hasError();
+  }
+#endif
+
+  // The function bodies must be read before the linker sees them.
+  if (!materializeReachable(moduleWith)) {
+    delete moduleWith;
+    return hasError();
+  }
+
+#if USE_MCJIT
+  if (!mLibraryObjectKey.empty()) {
+    shareLibrary(moduleWith);
+  }
+#endif
+
   if (llvm::Linker::LinkModules(mModule, moduleWith,
                                 llvm::Linker::DestroySource,
                                 &mError) != 0) {
@@ -283,54 +432,85 @@ int Compiler::linkModule(llvm::Module *moduleWith) {
 }
 
 
+llvm::Module *Compiler::cloneLibrary(unsigned char const *sha1) {
+  if (!mContext.mLibrary ||
+      memcmp(mContext.mLibrarySHA1, sha1, sizeof(mContext.mLibrarySHA1))) {
+    return NULL;
+  }
+
+  return copyLibrary();
+}
+
+
+llvm::Module *Compiler::copyLibrary() {
+#if USE_MCJIT
+  // The library object is compiled from the whole library, and shared by
+  // the scripts reaching different parts of it.
+  if (!mLibraryObjectKey.empty()) {
+    return llvm::CloneModule(mContext.mLibrary);
+  }
+#endif
+
+  return mContext.mLibraryIndex->extract(mModule);
+}
+
+
+llvm::Module *Compiler::keepLibrary(unsigned char const *sha1,
+                                    llvm::Module *library) {
+  // A lazily read library is read completely once, for all the scripts.
+  if (library->MaterializeAllPermanently(&mError)) {
+    LOGE("Unable to read the library: %s\n", mError.c_str());
+    delete library;
+    return NULL;
+  }
+
+  delete mContext.mLibraryIndex;
+  delete mContext.mLibrary;
+  mContext.mLibrary = library;
+  mContext.mLibraryIndex = new LibraryIndex(library);
+  memcpy(mContext.mLibrarySHA1, sha1, sizeof(mContext.mLibrarySHA1));
+
+  return copyLibrary();
+}
+
+
 int Compiler::compile(bool compileOnly) {
-  llvm::Target const *Target = NULL;
   llvm::TargetData *TD = NULL;
   llvm::TargetMachine *TM = NULL;
 
-  std::string FeaturesStr;
-
   llvm::NamedMDNode const *PragmaMetadata;
   llvm::NamedMDNode const *ExportVarMetadata;
   llvm::NamedMDNode const *ExportFuncMetadata;
   llvm::NamedMDNode const *ObjectSlotMetadata;
 
+  bool streaming = false;
+  bool tiered = false;
+  size_t numInsts = 0;
+  int64_t ltoTime = 0;
+
   if (mModule == NULL)  // No module was loaded
     return 0;
 
-  // Create TargetMachine
-  Target = llvm::TargetRegistry::lookupTarget(Triple, mError);
-  if (hasError())
-    goto on_bcc_compile_error;
-
-  if (!CPU.empty() || !Features.empty()) {
-    llvm::SubtargetFeatures F;
+#if USE_MCJIT
+  // The bodies are read by runMCCodeGen() then, unless the whole module is
+  // needed first by the LTO of the library or by the tier-up.
+  streaming = (mCompileFlags & BCC_STREAMING_COMPILE) && !mHasLinked &&
+              !(mCompileFlags & BCC_TIERED_COMPILE) &&
+              ParallelCodeGen::canStream(mModule);
+#endif
 
-    for (std::vector<std::string>::const_iterator
-         I = Features.begin(), E = Features.end(); I != E; I++) {
-      F.AddFeature(*I);
-    }
+  // The library has read the bodies of the script already.
+  if (!mHasLinked && !streaming && !materializeReachable(NULL))
+    goto on_bcc_compile_done;
 
-    FeaturesStr = F.getString();
-  }
+  // (The bodies of a streamed module are not read yet.)
+  if (!streaming)
+    numInsts = getInstructionCount(mModule);
 
-#if defined(DEFAULT_X86_64_CODEGEN)
-  // Data address in X86_64 architecture may reside in a far-away place
-  TM = Target->createTargetMachine(Triple, CPU, FeaturesStr,
-                                   llvm::Reloc::Static,
-                                   llvm::CodeModel::Medium);
-#else
-  // This is set for the linker (specify how large of the virtual addresses
-  // we can access for all unknown symbols.)
-  TM = Target->createTargetMachine(Triple, CPU, FeaturesStr,
-                                   llvm::Reloc::Static,
-                                   llvm::CodeModel::Small);
-#endif
-  if (TM == NULL) {
-    setError("Failed to create target machine implementation for the"
-             " specified triple '" + Triple + "'");
-    goto on_bcc_compile_error;
-  }
+  // Check out the TargetMachine of this thread
+  TM = CompilerResourcePool::get().acquireTargetMachine(mError);
+  if (TM == NULL)
+    goto on_bcc_compile_done;
 
   // Get target data from Module
   TD = new llvm::TargetData(mModule);
@@ -341,36 +521,88 @@ int Compiler::compile(bool compileOnly) {
   PragmaMetadata = mModule->getNamedMetadata(PragmaMetadataName);
   ObjectSlotMetadata = mModule->getNamedMetadata(ObjectSlotMetadataName);
 
+  if (!configurePipeline(PragmaMetadata, numInsts))
+    goto on_bcc_compile_done;
+
+#if USE_MCJIT
+  // Compile the baseline at O0 now, and the code of mConfig on the tier-up
+  // thread once the script is loaded (see Script::internalCompile()).
+  if ((mCompileFlags & BCC_TIERED_COMPILE) && !compileOnly &&
+      mConfig.getOptLevel() > 0) {
+    mTierUp = TierUpCompiler::create(this);
+    if (mTierUp) {
+      mConfig.reset(0);
+      tiered = true;
+    }
+  }
+#endif
+
+  // The baseline of a script compiled in tiers is as cheap as it gets.
+  if (!tiered)
+    fitPipeline(numInsts, mHasLinked, 100);
+
   // Perform link-time optimization if we have multiple modules
   if (mHasLinked) {
-    runLTO(new llvm::TargetData(*TD), ExportVarMetadata, ExportFuncMetadata);
+    std::vector<char const *> ExportSymbols;
+    collectExportSymbols(ExportVarMetadata, ExportFuncMetadata, ExportSymbols);
+
+#if USE_MCJIT
+    if (mTierUp) {
+      std::vector<std::string> const &Symbols = mTierUp->getExternalSymbols();
+      for (size_t i = 0; i < Symbols.size(); ++i) {
+        ExportSymbols.push_back(Symbols[i].c_str());
+      }
+    }
+#endif
+
+    ltoTime = getTime();
+    runLTO(mModule, new llvm::TargetData(*TD), mConfig, ExportSymbols);
+    ltoTime = getTime() - ltoTime;
+
+    // Check the code generation of what is left against the budget again,
+    // at the speed the LTO has shown.
+    if (!tiered)
+      fitPipeline(getInstructionCount(mModule), false,
+                  getSpeed(mConfig, numInsts, ltoTime));
   }
 
+#if USE_MCJIT
+  // Put the stubs in once the LTO has inlined what it would.
+  if ((mCompileFlags & BCC_LAZY_COMPILE) && !compileOnly && !mTierUp &&
+      !streaming) {
+    mLazy = LazyCompiler::create(this);
+  }
+#endif
+
   // Perform code generation
 #if USE_OLD_JIT
   if (runCodeGen(new llvm::TargetData(*TD), TM,
                  ExportVarMetadata, ExportFuncMetadata) != 0) {
-    goto on_bcc_compile_error;
+    goto on_bcc_compile_done;
   }
 #endif
 
 #if USE_MCJIT
-  if (runMCCodeGen(new llvm::TargetData(*TD), TM) != 0) {
-    goto on_bcc_compile_error;
+  if (runMCCodeGen(new llvm::TargetData(*TD), TM, streaming) != 0) {
+    goto on_bcc_compile_done;
   }
 
   if (compileOnly)
-    return 0;
+    goto on_bcc_compile_done;
 
   // Load the ELF Object
   mRSExecutable =
-    rsloaderCreateExec((unsigned char *)&*mEmittedELFExecutable.begin(),
-                       mEmittedELFExecutable.size(),
+    rsloaderCreateExec((unsigned char *)mObject->begin(), mObject->size(),
                        &resolveSymbolAdapter, this);
 
   if (!mRSExecutable) {
     setError("Fail to load emitted ELF relocatable file");
-    goto on_bcc_compile_error;
+    goto on_bcc_compile_done;
+  }
+
+  if (mLazy && !mLazy->start(mRSExecutable)) {
+    setError("Unable to set up the functions compiled lazily");
+    goto on_bcc_compile_done;
   }
 
   if (ExportVarMetadata) {
@@ -439,7 +671,8 @@ int Compiler::compile(bool compileOnly) {
       if (func) {
         size_t size = rsloaderGetSymbolSize(mRSExecutable, func_list[i]);
         Disassemble(DEBUG_MCJIT_DISASSEMBLER_FILE,
-                    Target, TM, func_list[i], (unsigned char const *)func, size);
+                    &TM->getTarget(), TM, func_list[i],
+                    (unsigned char const *)func, size);
       }
     }
   }
@@ -493,7 +726,7 @@ int Compiler::compile(bool compileOnly) {
           uint32_t USlot = 0;
           if (Slot.getAsInteger(10, USlot)) {
             setError("Non-integer object slot value '" + Slot.str() + "'");
-            goto on_bcc_compile_error;
+            goto on_bcc_compile_done;
           }
           objectSlotList.push_back(USlot);
 #if DEBUG_BCC_REFLECT
@@ -504,16 +737,26 @@ int Compiler::compile(bool compileOnly) {
     }
   }
 
-on_bcc_compile_error:
-  // LOGE("on_bcc_compiler_error");
+on_bcc_compile_done:
+  // Reached on success as well; mError tells them apart.
   if (TD) {
     delete TD;
   }
 
   if (TM) {
-    delete TM;
+    CompilerResourcePool::get().releaseTargetMachine(TM);
   }
 
+#if USE_MCJIT
+  // Everything needed later has been copied out of the module (the loaded
+  // executable and the ELF object do not refer to it), so give the context
+  // back for the next compilation.
+  delete mModule;
+  mModule = NULL;
+
+  CompilerResourcePool::get().releaseContext(mContext);
+#endif
+
   if (mError.empty()) {
     return 0;
   }
@@ -523,6 +766,212 @@ on_bcc_compile_error:
 }
 
 
+bool Compiler::materializeReachable(llvm::Module *library,
+                                    CodeGenStream *stream) {
+  if ((mCompileFlags & (BCC_LAZY_BITCODE | BCC_STREAMING_COMPILE)) == 0) {
+    return true;
+  }
+
+  llvm::Module *modules[] = { mModule, library };
+  size_t const numModules = (library != NULL) ? 2 : 1;
+
+  ReachableValues reachable;
+
+  // The entry points, and (conservatively) everything the global variables
+  // and the aliases refer to.
+  std::vector<char const *> entryPoints;
+  collectExportSymbols(mModule->getNamedMetadata(ExportVarMetadataName),
+                       mModule->getNamedMetadata(ExportFuncMetadataName),
+                       entryPoints);
+
+  for (size_t i = 0; i < numModules; ++i) {
+    llvm::Module *M = modules[i];
+
+    for (size_t j = 0; j < entryPoints.size(); ++j) {
+      reachable.add(M->getNamedValue(entryPoints[j]));
+    }
+
+    for (llvm::Module::global_iterator
+         I = M->global_begin(), E = M->global_end(); I != E; ++I) {
+      reachable.add(&*I);
+    }
+
+    for (llvm::Module::alias_iterator
+         I = M->alias_begin(), E = M->alias_end(); I != E; ++I) {
+      reachable.add(&*I);
+    }
+  }
+
+  size_t numMaterialized = 0;
+
+  while (llvm::GlobalValue *GV = reachable.next()) {
+    // A declaration refers to the definition in the other module.
+    if (!GV->hasLocalLinkage() && GV->hasName()) {
+      for (size_t i = 0; i < numModules; ++i) {
+        reachable.add(modules[i]->getNamedValue(GV->getName()));
+      }
+    }
+
+    if (llvm::GlobalVariable *Var = llvm::dyn_cast<llvm::GlobalVariable>(GV)) {
+      if (Var->hasInitializer()) {
+        reachable.addConstant(Var->getInitializer());
+      }
+    } else if (llvm::GlobalAlias *Alias =
+                 llvm::dyn_cast<llvm::GlobalAlias>(GV)) {
+      reachable.addConstant(Alias->getAliasee());
+    } else if (llvm::Function *F = llvm::dyn_cast<llvm::Function>(GV)) {
+      bool materialized = false;
+      if (F->isMaterializable()) {
+        if (F->Materialize(&mError)) {
+          return false;
+        }
+        ++numMaterialized;
+        materialized = true;
+      }
+
+      for (llvm::Function::iterator BB = F->begin(), BE = F->end();
+           BB != BE; ++BB) {
+        for (llvm::BasicBlock::iterator I = BB->begin(), IE = BB->end();
+             I != IE; ++I) {
+          for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i) {
+            if (llvm::Constant *C =
+                  llvm::dyn_cast<llvm::Constant>(I->getOperand(i))) {
+              reachable.addConstant(C);
+            }
+          }
+        }
+      }
+
+#if USE_MCJIT
+      // The walk above is done with the body; the stream may drop it.
+      if (stream && materialized) {
+        stream->add(F);
+      }
+#else
+      (void)materialized;
+#endif
+    }
+  }
+
+  // The bodies left are never read.  Make them valid declarations (a
+  // declaration can't have a local linkage) for the linker and the passes.
+  size_t numSkipped = 0;
+
+  for (size_t i = 0; i < numModules; ++i) {
+    for (llvm::Module::iterator
+         I = modules[i]->begin(), E = modules[i]->end(); I != E; ++I) {
+      if (I->isMaterializable()) {
+        I->setLinkage(llvm::GlobalValue::ExternalLinkage);
+        I->setVisibility(llvm::GlobalValue::DefaultVisibility);
+        ++numSkipped;
+      }
+    }
+  }
+
+  if (numMaterialized > 0 || numSkipped > 0) {
+    LOGV("Read %lu function bodies lazily, skipped %lu.\n",
+         (unsigned long)numMaterialized, (unsigned long)numSkipped);
+  }
+
+  return true;
+}
+
+
+void Compiler::setCompileBudget(unsigned long milliseconds) {
+  mDeadline = (milliseconds > 0)
+              ? getTime() + static_cast<int64_t>(milliseconds) * 1000000LL
+              : 0;
+}
+
+
+bool Compiler::configurePipeline(llvm::NamedMDNode const *PragmaMetadata,
+                                 size_t numInsts) {
+  unsigned OptLevel;
+  bool HasPipelinePragma = false;
+
+  // The flags of the caller take precedence over the pragma.
+  if (PipelineConfig::getOptLevelFromFlags(mCompileFlags, OptLevel)) {
+    mConfig.reset(OptLevel);
+    return true;
+  }
+
+  mConfig.reset(3);
+
+  for (int i = 0, e = PragmaMetadata ? PragmaMetadata->getNumOperands() : 0;
+       i != e; i++) {
+    llvm::MDNode *Pragma = PragmaMetadata->getOperand(i);
+    if (Pragma == NULL || Pragma->getNumOperands() != 2) {
+      continue;
+    }
+
+    llvm::Value *PragmaNameMDS = Pragma->getOperand(0);
+    llvm::Value *PragmaValueMDS = Pragma->getOperand(1);
+
+    if ((PragmaNameMDS->getValueID() == llvm::Value::MDStringVal) &&
+        (PragmaValueMDS->getValueID() == llvm::Value::MDStringVal) &&
+        static_cast<llvm::MDString*>(PragmaNameMDS)->getString() ==
+          PipelinePragmaName) {
+      llvm::StringRef PragmaValue =
+        static_cast<llvm::MDString*>(PragmaValueMDS)->getString();
+
+      if (!mConfig.parse(PragmaValue.str(), mError)) {
+        mError = "Invalid #pragma " + PipelinePragmaName.str() + ": " + mError;
+        return false;
+      }
+      HasPipelinePragma = true;
+    }
+  }
+
+  // The fixed cost of the full pipeline dominates for a tiny script, and
+  // GVN takes too long on a huge one.
+  if (!HasPipelinePragma && numInsts > 0) {
+    if (numInsts < BCC_PIPELINE_SMALL_MODULE_SIZE) {
+      mConfig.reset(1);
+    } else if (numInsts > BCC_PIPELINE_LARGE_MODULE_SIZE) {
+      mConfig.reset(2);
+      mConfig.degrade();
+    }
+
+    LOGV("Pipeline for %lu instructions: %s\n", (unsigned long)numInsts,
+         mConfig.getDescription().c_str());
+  }
+
+  return true;
+}
+
+
+void Compiler::fitPipeline(size_t numInsts, bool withLTO, unsigned speed) {
+  if (mDeadline == 0) {
+    return;
+  }
+
+  while (true) {
+    uint64_t cost = static_cast<uint64_t>(mConfig.getCodeGenCost()) *
+                    BCC_CODEGEN_NS_PER_INSTRUCTION;
+    if (withLTO) {
+      cost += static_cast<uint64_t>(mConfig.getLTOCost()) *
+              BCC_LTO_NS_PER_INSTRUCTION;
+    }
+
+    int64_t estimate = cost * numInsts / speed;
+    if (getTime() + estimate <= mDeadline) {
+      return;
+    }
+
+    if (!mConfig.degrade()) {
+      LOGW("Unable to compile %lu instructions within the budget\n",
+           (unsigned long)numInsts);
+      return;
+    }
+
+    mPipelineDegraded = true;
+
+    LOGV("Pipeline within the budget: %s\n",
+         mConfig.getDescription().c_str());
+  }
+}
+
+
 #if USE_OLD_JIT
 int Compiler::runCodeGen(llvm::TargetData *TD, llvm::TargetMachine *TM,
                          llvm::NamedMDNode const *ExportVarMetadata,
@@ -558,9 +1007,15 @@ int Compiler::runCodeGen(llvm::TargetData *TD, llvm::TargetMachine *TM,
   CodeGenPasses->add(TD);
 
   // Add code emit passes
-  if (TM->addPassesToEmitMachineCode(*CodeGenPasses,
-                                     *mCodeEmitter,
-                                     CodeGenOptLevel)) {
+  pthread_mutex_lock(&RegAllocLock);
+  llvm::RegisterRegAlloc::setDefault(mConfig.getRegAllocCtor());
+  bool Unsupported =
+    TM->addPassesToEmitMachineCode(*CodeGenPasses,
+                                   *mCodeEmitter,
+                                   mConfig.getCodeGenOptLevel());
+  pthread_mutex_unlock(&RegAllocLock);
+
+  if (Unsupported) {
     setError("The machine code emission is not supported on '" + Triple + "'");
     return 1;
   }
@@ -650,9 +1105,63 @@ int Compiler::runCodeGen(llvm::TargetData *TD, llvm::TargetMachine *TM,
 
 
 #if USE_MCJIT
-int Compiler::runMCCodeGen(llvm::TargetData *TD, llvm::TargetMachine *TM) {
-  // Decorate mEmittedELFExecutable with formatted ostream
-  llvm::raw_svector_ostream OutSVOS(mEmittedELFExecutable);
+int Compiler::runMCCodeGen(llvm::TargetData *TD, llvm::TargetMachine *TM,
+                           bool streaming) {
+  // Reserve the object up front, so that it is not copied as it grows.
+  size_t numInsts = getInstructionCount(mModule);
+
+  mObject = ObjectBuffer::acquire(numInsts * BCC_OBJECT_BYTES_PER_INSTRUCTION);
+
+  if (streaming) {
+    delete TD;
+
+    CodeGenStream stream(mModule, mConfig);
+    if (!materializeReachable(NULL, &stream)) {
+      return 1;
+    }
+
+    return stream.finish(mObject->getData(), mError) ? 0 : 1;
+  }
+
+#if USE_CACHE
+  // The objects of a degraded pipeline would be keyed by the budget of the
+  // moment; leave the function cache to the full pipeline.
+  if ((mCompileFlags & BCC_INCREMENTAL_COMPILE) &&
+      !mFunctionCacheDir.empty() && !mPipelineDegraded &&
+      ParallelCodeGen::canPartition(mModule)) {
+    delete TD;
+    std::string key(mFunctionCacheKey);
+    key.append(mConfig.getDescription());
+    return ParallelCodeGen::emitIncremental(mModule, mFunctionCacheDir, key,
+                                            mFunctionCacheFastHash, mConfig,
+                                            mObject->getData(),
+                                            mError) ? 0 : 1;
+  }
+#endif
+
+  if (mCompileFlags & BCC_PARALLEL_CODEGEN) {
+    unsigned numPartitions = ParallelCodeGen::getPartitionCount(mModule);
+
+    if (numPartitions > 1) {
+      delete TD;
+      return ParallelCodeGen::emit(mModule, numPartitions, mConfig,
+                                   mObject->getData(), mError) ? 0 : 1;
+    }
+  }
+
+  return emitMC(mModule, TD, TM, mConfig, mObject->getData(), mError)
+         ? 0 : 1;
+}
+
+
+bool Compiler::emitMC(llvm::Module *M,
+                      llvm::TargetData *TD,
+                      llvm::TargetMachine *TM,
+                      PipelineConfig const &config,
+                      llvm::SmallVectorImpl<char> &result,
+                      std::string &error) {
+  // Decorate result with formatted ostream
+  llvm::raw_svector_ostream OutSVOS(result);
 
   // Relax all machine instructions
   TM->setMCRelaxAll(/* RelaxAll= */ true);
@@ -665,30 +1174,29 @@ int Compiler::runMCCodeGen(llvm::TargetData *TD, llvm::TargetMachine *TM) {
 
   // Add MC code generation passes to pass manager
   llvm::MCContext *Ctx;
-  if (TM->addPassesToEmitMC(MCCodeGenPasses, Ctx, OutSVOS,
-                            CodeGenOptLevel, false)) {
-    setError("Fail to add passes to emit file");
-    return 1;
+  pthread_mutex_lock(&RegAllocLock);
+  llvm::RegisterRegAlloc::setDefault(config.getRegAllocCtor());
+  bool Unsupported =
+    TM->addPassesToEmitMC(MCCodeGenPasses, Ctx, OutSVOS,
+                          config.getCodeGenOptLevel(), false);
+  pthread_mutex_unlock(&RegAllocLock);
+
+  if (Unsupported) {
+    error = "Fail to add passes to emit file";
+    return false;
   }
 
-  MCCodeGenPasses.run(*mModule);
+  MCCodeGenPasses.run(*M);
   OutSVOS.flush();
-  return 0;
+  return true;
 }
 #endif // USE_MCJIT
 
 
-int Compiler::runLTO(llvm::TargetData *TD,
-                     llvm::NamedMDNode const *ExportVarMetadata,
-                     llvm::NamedMDNode const *ExportFuncMetadata) {
-  llvm::PassManager LTOPasses;
-
-  // Add TargetData to LTO passes
-  LTOPasses.add(TD);
-
-  // Collect All Exported Symbols
-  std::vector<const char*> ExportSymbols;
-
+void Compiler::collectExportSymbols(
+    llvm::NamedMDNode const *ExportVarMetadata,
+    llvm::NamedMDNode const *ExportFuncMetadata,
+    std::vector<char const *> &ExportSymbols) const {
   // Note: This is a workaround for getting export variable and function name.
   // We should refine it soon.
   if (ExportVarMetadata) {
@@ -734,111 +1242,122 @@ int Compiler::runLTO(llvm::TargetData *TD,
   std::copy(UserDefinedExternalSymbols.begin(),
             UserDefinedExternalSymbols.end(),
             std::back_inserter(ExportSymbols));
+}
 
-  // We now create passes list performing LTO. These are copied from
-  // (including comments) llvm::createStandardLTOPasses().
+
+int Compiler::runLTO(llvm::Module *M,
+                     llvm::TargetData *TD,
+                     PipelineConfig const &config,
+                     std::vector<char const *> const &ExportSymbols) {
+  llvm::PassManager LTOPasses;
+
+  // Add TargetData to LTO passes
+  LTOPasses.add(TD);
 
   // Internalize all other symbols not listed in ExportSymbols
   LTOPasses.add(llvm::createInternalizePass(ExportSymbols));
 
-  // Propagate constants at call sites into the functions they call. This
-  // opens opportunities for globalopt (and inlining) by substituting
-  // function pointers passed as arguments to direct uses of functions.
-  LTOPasses.add(llvm::createIPSCCPPass());
+  // The rest of the passes depend on the opt level of the script
+  config.addLTOPasses(LTOPasses);
 
-  // Now that we internalized some globals, see if we can hack on them!
-  LTOPasses.add(llvm::createGlobalOptimizerPass());
+  LTOPasses.run(*M);
 
-  // Linking modules together can lead to duplicated global constants, only
-  // keep one copy of each constant...
-  LTOPasses.add(llvm::createConstantMergePass());
+  return 0;
+}
 
-  // Remove unused arguments from functions...
-  LTOPasses.add(llvm::createDeadArgEliminationPass());
 
-  // Reduce the code after globalopt and ipsccp. Both can open up
-  // significant simplification opportunities, and both can propagate
-  // functions through function pointers. When this happens, we often have
-  // to resolve varargs calls, etc, so let instcombine do this.
-  LTOPasses.add(llvm::createInstructionCombiningPass());
+#if USE_MCJIT
+void *Compiler::getSymbolAddress(char const *name) {
+  return rsloaderGetSymbolAddress(mRSExecutable, name);
+}
 
-  // Inline small functions
-  LTOPasses.add(llvm::createFunctionInliningPass());
 
-  // Remove dead EH info.
-  LTOPasses.add(llvm::createPruneEHPass());
+ObjectBuffer *Compiler::getObject() const {
+  // The baseline of a script compiled in tiers is not worth caching.
+  return mTierUp ? mTierUp->getCacheObject() : mObject;
+}
 
-  // Internalize the globals again after inlining
-  LTOPasses.add(llvm::createGlobalOptimizerPass());
 
-  // Remove dead functions.
-  LTOPasses.add(llvm::createGlobalDCEPass());
+void Compiler::releaseObject() {
+  if (mObject) {
+    mObject->release();
+    mObject = NULL;
+  }
+}
 
-  // If we didn't decide to inline a function, check to see if we can
-  // transform it to pass arguments by value instead of by reference.
-  LTOPasses.add(llvm::createArgumentPromotionPass());
 
-  // The IPO passes may leave cruft around.  Clean up after them.
-  LTOPasses.add(llvm::createInstructionCombiningPass());
-  LTOPasses.add(llvm::createJumpThreadingPass());
+bool Compiler::startTierUp(bool needCacheObject,
+                           void (*pFn)(void *context), void *pContext) {
+  if (!mTierUp || !mRSExecutable) {
+    return false;
+  }
 
-  // Break up allocas
-  LTOPasses.add(llvm::createScalarReplAggregatesPass());
+  mTierUp->start(mRSExecutable, needCacheObject, pFn, pContext);
+  return true;
+}
 
-  // Run a few AA driven optimizations here and now, to cleanup the code.
-  LTOPasses.add(llvm::createFunctionAttrsPass());  // Add nocapture.
-  LTOPasses.add(llvm::createGlobalsModRefPass());  // IP alias analysis.
 
-  // Hoist loop invariants.
-  LTOPasses.add(llvm::createLICMPass());
+void Compiler::waitForTierUp() {
+  if (mTierUp) {
+    mTierUp->wait();
+  }
+}
+#endif
 
-  // Remove redundancies.
-  LTOPasses.add(llvm::createGVNPass());
 
-  // Remove dead memcpys.
-  LTOPasses.add(llvm::createMemCpyOptPass());
+#if USE_MCJIT
+void Compiler::shareLibrary(llvm::Module *library) {
+  LibraryObject::externalizeLocals(library);
 
-  // Nuke dead stores.
-  LTOPasses.add(llvm::createDeadStoreEliminationPass());
+  std::string error;
+  mLibraryObject =
+    LibraryObject::getOrCreate(mLibraryObjectKey, mLibraryObjectPath,
+                               library, mpSymbolLookupFn,
+                               mpSymbolLookupContext, error);
 
-  // Cleanup and simplify the code after the scalar optimizations.
-  LTOPasses.add(llvm::createInstructionCombiningPass());
+  if (!mLibraryObject) {
+    LOGW("Unable to compile the library object: %s\n", error.c_str());
+    return;
+  }
 
-  LTOPasses.add(llvm::createJumpThreadingPass());
+  LibraryObject::strip(library);
+}
 
-  // Delete basic blocks, which optimization passes may have killed.
-  LTOPasses.add(llvm::createCFGSimplificationPass());
 
-  // Now that we have optimized the program, discard unreachable functions.
-  LTOPasses.add(llvm::createGlobalDCEPass());
+void *Compiler::lookupSymbol(char const *name) const {
+  if (void *Addr = FindRuntimeFunction(name)) {
+    return Addr;
+  }
 
-  LTOPasses.run(*mModule);
+  if (mLazy) {
+    if (void *Addr = LazyCompiler::lookupRuntime(name)) {
+      return Addr;
+    }
+  }
 
-  return 0;
-}
+  if (mLibraryObject) {
+    if (void *Addr = mLibraryObject->lookup(name)) {
+      return Addr;
+    }
+  }
 
+  if (mpSymbolLookupFn) {
+    if (void *Addr = mpSymbolLookupFn(mpSymbolLookupContext, name)) {
+      return Addr;
+    }
+  }
 
-#if USE_MCJIT
-void *Compiler::getSymbolAddress(char const *name) {
-  return rsloaderGetSymbolAddress(mRSExecutable, name);
+  return NULL;
 }
-#endif
 
 
-#if USE_MCJIT
 void *Compiler::resolveSymbolAdapter(void *context, char const *name) {
   Compiler *self = reinterpret_cast<Compiler *>(context);
 
-  if (void *Addr = FindRuntimeFunction(name)) {
+  if (void *Addr = self->lookupSymbol(name)) {
     return Addr;
   }
 
-  if (self->mpSymbolLookupFn) {
-    if (void *Addr = self->mpSymbolLookupFn(self->mpSymbolLookupContext, name)) {
-      return Addr;
-    }
-  }
-
   LOGE("Unable to resolve symbol: %s\n", name);
   return NULL;
 }
@@ -846,11 +1365,20 @@ void *Compiler::resolveSymbolAdapter(void *context, char const *name) {
 
 
 Compiler::~Compiler() {
+#if USE_MCJIT
+  // The optimized code refers to the variables of the baseline, and the
+  // code compiled lazily to the rest of the script.
+  delete mTierUp;
+  delete mLazy;
+#endif
+
   delete mModule;
-  delete mContext;
+
+  CompilerResourcePool::get().releaseContext(mContext);
 
 #if USE_MCJIT
   rsloaderDisposeExec(mRSExecutable);
+  releaseObject();
 #endif
 
   // llvm::llvm_shutdown();
@@ -21,6 +21,8 @@
 
 #include "CodeGen/CodeEmitter.h"
 #include "CodeGen/CodeMemoryManager.h"
+#include "CompilerResourcePool.h"
+#include "PipelineConfig.h"
 
 #if USE_MCJIT
 #include "librsloader.h"
@@ -32,6 +34,7 @@
 #include "llvm/Target/TargetMachine.h"
 
 #include <stddef.h>
+#include <stdint.h>
 
 #include <list>
 #include <string>
@@ -49,22 +52,23 @@ namespace llvm {
 
 
 namespace bcc {
+  class CodeGenStream;
+  class LazyCompiler;
+  class LibraryObject;
+  class ObjectBuffer;
   class ScriptCompiled;
+  class TierUpCompiler;
 
   class Compiler {
   private:
     //////////////////////////////////////////////////////////////////////////
-    // The variable section below (e.g., Triple, CodeGenOptLevel)
-    // is initialized in GlobalInitialization()
+    // The variable section below (e.g., Triple) is initialized in
+    // GlobalInitialization(), and never changed afterwards
     //
-    static bool GlobalInitialized;
-
     // If given, this will be the name of the target triple to compile for.
     // If not given, the initial values defined in this file will be used.
     static std::string Triple;
 
-    static llvm::CodeGenOpt::Level CodeGenOptLevel;
-
     // End of section of GlobalInitializing variables
     /////////////////////////////////////////////////////////////////////////
     // If given, the name of the target CPU to generate code for.
@@ -74,15 +78,21 @@ namespace bcc {
     // be a list of strings starting with '+' (enable) or '-' (disable).
     static std::vector<std::string> Features;
 
+    static void initializeGlobals();
+
     static void LLVMErrorHandler(void *UserData, const std::string &Message);
 
     static const llvm::StringRef PragmaMetadataName;
+    static const llvm::StringRef PipelinePragmaName;
     static const llvm::StringRef ExportVarMetadataName;
     static const llvm::StringRef ExportFuncMetadataName;
     static const llvm::StringRef ObjectSlotMetadataName;
 
     friend class CodeEmitter;
     friend class CodeMemoryManager;
+    friend class LazyCompiler;
+    friend class LibraryObject;
+    friend class TierUpCompiler;
 
 
   private:
@@ -99,35 +109,110 @@ namespace bcc {
 #endif
 
 #if USE_MCJIT
-    // Compilation buffer for MCJIT
-    llvm::SmallVector<char, 1024> mEmittedELFExecutable;
+    // The emitted ELF object, until it is loaded and handed to the cache
+    // writer (see releaseObject())
+    ObjectBuffer *mObject;
 
     // Loaded and relocated executable
     RSExecRef mRSExecutable;
+
+    // The optimized code of a script compiled in tiers (see
+    // BCC_TIERED_COMPILE), in which case mRSExecutable is the baseline.
+    TierUpCompiler *mTierUp;
+
+    // The internal functions compiled on their first call (see
+    // BCC_LAZY_COMPILE)
+    LazyCompiler *mLazy;
+
+    // The library object to compile against (see BCC_SHARED_LIBRARY), and
+    // the file caching it
+    std::string mLibraryObjectKey;
+    std::string mLibraryObjectPath;
+    LibraryObject *mLibraryObject;
+
+    // The directory of the objects of the functions, and the key they are
+    // hashed with (see BCC_INCREMENTAL_COMPILE)
+    std::string mFunctionCacheDir;
+    std::string mFunctionCacheKey;
+    bool mFunctionCacheFastHash;
 #endif
 
     BCCSymbolLookupFn mpSymbolLookupFn;
     void *mpSymbolLookupContext;
 
-    llvm::LLVMContext *mContext;
+    // Checked out of the CompilerResourcePool of the constructing thread
+    PooledContext mContext;
+
     llvm::Module *mModule;
 
     bool mHasLinked;
 
+    // The flags of bccPrepareExecutable() (e.g. BCC_PARALLEL_CODEGEN)
+    unsigned long mCompileFlags;
+
+    // The optimizations of this script, see configurePipeline()
+    PipelineConfig mConfig;
+
+    // The monotonic time (in nanoseconds) by which the compilation should be
+    // done, or 0 (see fitPipeline())
+    int64_t mDeadline;
+
+    // Whether fitPipeline() made mConfig cheaper than the script asked for
+    bool mPipelineDegraded;
+
   public:
     Compiler(ScriptCompiled *result);
 
+    // Initialize LLVM and the target settings once per process.  Safe to
+    // call from any thread.
     static void GlobalInitialization();
 
     static std::string const &getTargetTriple() {
       return Triple;
     }
 
+    static std::string const &getTargetCPU() {
+      return CPU;
+    }
+
+    static std::vector<std::string> const &getTargetFeatures() {
+      return Features;
+    }
+
     void registerSymbolCallback(BCCSymbolLookupFn pFn, void *pContext) {
       mpSymbolLookupFn = pFn;
       mpSymbolLookupContext = pContext;
     }
 
+    void setCompileFlags(unsigned long flags) {
+      mCompileFlags = flags;
+    }
+
+    // Compile within milliseconds from now, if possible, or without a limit
+    // if it is 0 (see bccSetCompileBudget()).
+    void setCompileBudget(unsigned long milliseconds);
+
+#if USE_MCJIT
+    // Use the library object of key (compiled from the library linked by
+    // linkModule() if necessary) instead of most of the library.  path may
+    // be empty.
+    void setLibraryObject(std::string const &key, std::string const &path) {
+      mLibraryObjectKey = key;
+      mLibraryObjectPath = path;
+    }
+
+    // Keep the object of each function in dir (see BCC_INCREMENTAL_COMPILE).
+    // key covers what the code depends on besides the bitcode, except the
+    // pipeline, which is added to it.  fastHash names the objects by
+    // calcFastHash() instead of calcSHA1().
+    void setFunctionCache(std::string const &dir, std::string const &key,
+                          bool fastHash) {
+      mFunctionCacheDir = dir;
+      mFunctionCacheKey = key;
+      mFunctionCacheFastHash = fastHash;
+    }
+#endif
+
 #if USE_OLD_JIT
     CodeMemoryManager *createCodeMemoryManager();
 
@@ -135,14 +220,49 @@ namespace bcc {
 #endif
 
 #if USE_MCJIT
+    // Emit the ELF relocatable object of M into result.  TD is taken by the
+    // pass manager.
+    static bool emitMC(llvm::Module *M,
+                       llvm::TargetData *TD,
+                       llvm::TargetMachine *TM,
+                       PipelineConfig const &config,
+                       llvm::SmallVectorImpl<char> &result,
+                       std::string &error);
+
     void *getSymbolAddress(char const *name);
 
-    const llvm::SmallVector<char, 1024> &getELF() const {
-      return mEmittedELFExecutable;
+    // The object to be written to the cache.  For a script compiled in
+    // tiers, it is the optimized code, which is ready when the callback of
+    // startTierUp() is called.
+    ObjectBuffer *getObject() const;
+
+    // Drop the emitted object once the cache writer has taken its reference
+    // (or there is no cache file to write.)  The loaded code keeps running.
+    void releaseObject();
+
+    // Generate the optimized code of a script compiled in tiers on the
+    // tier-up thread.  Return false if the script is not compiled in tiers.
+    bool startTierUp(bool needCacheObject,
+                     void (*pFn)(void *context), void *pContext);
+
+    void waitForTierUp();
+
+    // The object of a script compiled lazily lacks the functions compiled
+    // on demand, so it is not cached.
+    bool isLazy() const {
+      return mLazy != NULL;
     }
 #endif
 
-    llvm::Module *parseBitcodeFile(llvm::MemoryBuffer *MEM);
+    // The code of a pipeline degraded to fit the compile budget is not
+    // cached, so the next compilation gets the chance to do better.
+    bool isPipelineDegraded() const {
+      return mPipelineDegraded;
+    }
+
+    // With BCC_LAZY_BITCODE, the function bodies are left in MEM, which is
+    // then taken by the module (see materializeReachable().)
+    llvm::Module *parseBitcodeFile(llvm::OwningPtr<llvm::MemoryBuffer> &MEM);
 
     int readModule(llvm::Module *module) {
       mModule = module;
@@ -151,6 +271,20 @@ namespace bcc {
 
     int linkModule(llvm::Module *module);
 
+    // Return a copy of the library with the bitcode of sha1, if it has been
+    // parsed in the context of this compilation before, or NULL.  Only the
+    // part of the library the module read can reach is copied (see
+    // LibraryIndex), unless the whole of it goes into the library object
+    // (see BCC_SHARED_LIBRARY).
+    llvm::Module *cloneLibrary(unsigned char const *sha1);
+
+    // Keep library (parsed from the bitcode of sha1) in the context for the
+    // later compilations, and return a copy of it to be linked, as
+    // cloneLibrary() does.  Return NULL
+    // (with library deleted) on error.
+    llvm::Module *keepLibrary(unsigned char const *sha1,
+                              llvm::Module *library);
+
     int compile(bool compileOnly);
 
     char const *getErrorMessage() {
@@ -164,20 +298,62 @@ namespace bcc {
     ~Compiler();
 
   private:
+    // Read the function bodies reachable from the entry points of mModule,
+    // in mModule and library (if any), and leave the others as
+    // declarations.  Only the bodies of a module read with
+    // BCC_LAZY_BITCODE are left to read.  Each body read is added to stream
+    // (if any.)
+    bool materializeReachable(llvm::Module *library,
+                              CodeGenStream *stream = NULL);
+
+    // Choose mConfig from the flags or "#pragma bcc_pipeline", or else from
+    // the size of the module (numInsts, or 0 if unknown).
+    bool configurePipeline(llvm::NamedMDNode const *PragmaMetadata,
+                           size_t numInsts);
+
+    // Make mConfig cheaper until the estimated time of the rest of the
+    // compilation of numInsts instructions (the LTO if withLTO, and the
+    // code generation) fits before mDeadline.  The estimate is scaled by
+    // speed (in percent) to the device.
+    void fitPipeline(size_t numInsts, bool withLTO, unsigned speed);
 
     int runCodeGen(llvm::TargetData *TD, llvm::TargetMachine *TM,
                    llvm::NamedMDNode const *ExportVarMetadata,
                    llvm::NamedMDNode const *ExportFuncMetadata);
 
-    int runMCCodeGen(llvm::TargetData *TD, llvm::TargetMachine *TM);
+    // With streaming, the bodies of mModule are read as the code is
+    // generated.
+    int runMCCodeGen(llvm::TargetData *TD, llvm::TargetMachine *TM,
+                     bool streaming);
+
+    // The copy of the library kept in the context to be linked, for
+    // cloneLibrary() and keepLibrary().
+    llvm::Module *copyLibrary();
 
 #if USE_MCJIT
+    // Leave only the state of library and its small functions to be
+    // linked, and refer to the library object for the rest.  library is
+    // linked as it is if the library object is not available.
+    void shareLibrary(llvm::Module *library);
+
+    // The address of the external symbol name, or NULL.
+    void *lookupSymbol(char const *name) const;
+
     static void *resolveSymbolAdapter(void *context, char const *name);
 #endif
 
-    int runLTO(llvm::TargetData *TD,
-               llvm::NamedMDNode const *ExportVarMetadata,
-               llvm::NamedMDNode const *ExportFuncMetadata);
+    // The symbols to be kept external by the LTO: the exported variables
+    // and functions, root(), init(), .rs.dtor() and the user-defined ones.
+    void collectExportSymbols(llvm::NamedMDNode const *ExportVarMetadata,
+                              llvm::NamedMDNode const *ExportFuncMetadata,
+                              std::vector<char const *> &ExportSymbols) const;
+
+    // Internalize the symbols of M but ExportSymbols, and run the LTO passes
+    // of config.  TD is taken by the pass manager.
+    static int runLTO(llvm::Module *M,
+                      llvm::TargetData *TD,
+                      PipelineConfig const &config,
+                      std::vector<char const *> const &ExportSymbols);
 
     bool hasError() const {
       return !mError.empty();
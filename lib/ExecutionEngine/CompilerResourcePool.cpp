@@ -0,0 +1,181 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "CompilerResourcePool.h"
+
+#include "Compiler.h"
+#include "Config.h"
+#include "LibraryIndex.h"
+
+#include "llvm/LLVMContext.h"
+#include "llvm/Module.h"
+
+#include "llvm/MC/SubtargetFeature.h"
+
+#include "llvm/Support/TargetRegistry.h"
+
+#include "llvm/Target/TargetMachine.h"
+
+#include <pthread.h>
+
+namespace {
+
+pthread_key_t PoolKey;
+pthread_once_t PoolKeyOnce = PTHREAD_ONCE_INIT;
+
+} // namespace anonymous
+
+namespace bcc {
+
+void CompilerResourcePool::createPoolKey() {
+  pthread_key_create(&PoolKey, CompilerResourcePool::destroy);
+}
+
+
+CompilerResourcePool &CompilerResourcePool::get() {
+  pthread_once(&PoolKeyOnce, createPoolKey);
+
+  CompilerResourcePool *pool =
+    static_cast<CompilerResourcePool *>(pthread_getspecific(PoolKey));
+
+  if (!pool) {
+    pool = new CompilerResourcePool();
+    pthread_setspecific(PoolKey, pool);
+  }
+
+  return *pool;
+}
+
+
+void CompilerResourcePool::destroy(void *pool) {
+  delete static_cast<CompilerResourcePool *>(pool);
+}
+
+
+CompilerResourcePool::~CompilerResourcePool() {
+  for (size_t i = 0; i < mContexts.size(); ++i) {
+    destroyContext(mContexts[i]);
+  }
+
+  delete mTM;
+}
+
+
+void CompilerResourcePool::destroyContext(PooledContext &context) {
+  // The library must go before its context.
+  delete context.mLibraryIndex;
+  delete context.mLibrary;
+  delete context.mContext;
+  context = PooledContext();
+}
+
+
+void CompilerResourcePool::acquireContext(PooledContext &context) {
+  if (mContexts.empty()) {
+    context = PooledContext();
+    context.mContext = new llvm::LLVMContext();
+    return;
+  }
+
+  context = mContexts.back();
+  mContexts.pop_back();
+}
+
+
+void CompilerResourcePool::releaseContext(PooledContext &context) {
+  if (!context.mContext) {
+    return;
+  }
+
+  context.mUses++;
+
+  if (context.mUses >= BCC_POOL_CONTEXT_MAX_USES ||
+      mContexts.size() >= BCC_POOL_CONTEXT_COUNT) {
+    destroyContext(context);
+    return;
+  }
+
+  mContexts.push_back(context);
+  context = PooledContext();
+}
+
+
+llvm::TargetMachine *
+CompilerResourcePool::acquireTargetMachine(std::string &error) {
+  if (mTM) {
+    llvm::TargetMachine *TM = mTM;
+    mTM = NULL;
+    return TM;
+  }
+
+  std::string const &Triple = Compiler::getTargetTriple();
+  std::string const &CPU = Compiler::getTargetCPU();
+
+  if (!mTarget) {
+    mTarget = llvm::TargetRegistry::lookupTarget(Triple, error);
+    if (!mTarget) {
+      return NULL;
+    }
+
+    std::vector<std::string> const &Features = Compiler::getTargetFeatures();
+
+    if (!CPU.empty() || !Features.empty()) {
+      llvm::SubtargetFeatures F;
+
+      for (std::vector<std::string>::const_iterator
+           I = Features.begin(), E = Features.end(); I != E; I++) {
+        F.AddFeature(*I);
+      }
+
+      mFeatures = F.getString();
+    }
+  }
+
+  llvm::TargetMachine *TM;
+
+#if defined(DEFAULT_X86_64_CODEGEN)
+  // Data address in X86_64 architecture may reside in a far-away place
+  TM = mTarget->createTargetMachine(Triple, CPU, mFeatures,
+                                    llvm::Reloc::Static,
+                                    llvm::CodeModel::Medium);
+#else
+  // This is set for the linker (specify how large of the virtual addresses
+  // we can access for all unknown symbols.)
+  TM = mTarget->createTargetMachine(Triple, CPU, mFeatures,
+                                    llvm::Reloc::Static,
+                                    llvm::CodeModel::Small);
+#endif
+
+  if (TM == NULL) {
+    error = "Failed to create target machine implementation for the"
+            " specified triple '" + Triple + "'";
+  }
+
+  return TM;
+}
+
+
+void CompilerResourcePool::releaseTargetMachine(llvm::TargetMachine *TM) {
+  if (mTM) {
+    // Another compilation on this thread has returned one already.
+    delete TM;
+    return;
+  }
+
+  mTM = TM;
+}
+
+} // namespace bcc
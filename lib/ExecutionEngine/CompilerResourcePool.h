@@ -0,0 +1,101 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_COMPILERRESOURCEPOOL_H
+#define BCC_COMPILERRESOURCEPOOL_H
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class LLVMContext;
+  class Module;
+  class Target;
+  class TargetMachine;
+}
+
+namespace bcc {
+  class LibraryIndex;
+
+  // A context of the pool.  Besides the modules of a compilation, it may
+  // hold the library parsed by an earlier one (see Compiler::linkModule()),
+  // which stays with the context until it is discarded.
+  struct PooledContext {
+    llvm::LLVMContext *mContext;
+
+    // The number of compilations it has served
+    unsigned mUses;
+
+    // The library (never linked or modified), its index and the sha1 of
+    // its bitcode
+    llvm::Module *mLibrary;
+    LibraryIndex *mLibraryIndex;
+    unsigned char mLibrarySHA1[20];
+
+    PooledContext()
+      : mContext(NULL), mUses(0), mLibrary(NULL), mLibraryIndex(NULL) {
+    }
+  };
+
+  // The LLVMContexts and the TargetMachine kept by a thread between its
+  // compilations.  A resource is owned by the caller from acquire*() until
+  // the matching release*(), which may happen on another thread.
+  class CompilerResourcePool {
+  private:
+    // Idle contexts
+    std::vector<PooledContext> mContexts;
+
+    llvm::Target const *mTarget;
+    std::string mFeatures;
+
+    // The idle target machine (NULL if it is checked out.)
+    llvm::TargetMachine *mTM;
+
+    CompilerResourcePool() : mTarget(NULL), mTM(NULL) {
+    }
+
+    ~CompilerResourcePool();
+
+  public:
+    // The pool of the calling thread.  It is freed when the thread exits.
+    static CompilerResourcePool &get();
+
+    // The context must be released with the modules in it deleted, but
+    // its library.
+    void acquireContext(PooledContext &context);
+
+    // Count one more compilation served by context, and reset it.
+    void releaseContext(PooledContext &context);
+
+    // Return NULL and set error if the target machine of
+    // Compiler::getTargetTriple() can't be created.
+    llvm::TargetMachine *acquireTargetMachine(std::string &error);
+
+    void releaseTargetMachine(llvm::TargetMachine *TM);
+
+  private:
+    static void destroyContext(PooledContext &context);
+
+    static void createPoolKey();
+
+    static void destroy(void *pool);
+  };
+
+} // namespace bcc
+
+#endif // BCC_COMPILERRESOURCEPOOL_H
@@ -0,0 +1,873 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ELFObjectMerger.h"
+
+#include <elf.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#ifndef SHT_ARM_ATTRIBUTES
+#define SHT_ARM_ATTRIBUTES 0x70000003
+#endif
+
+namespace {
+
+struct ELF32 {
+  typedef Elf32_Ehdr Ehdr;
+  typedef Elf32_Shdr Shdr;
+  typedef Elf32_Sym Sym;
+  typedef Elf32_Rel Rel;
+  typedef Elf32_Rela Rela;
+
+  static unsigned char const Class = ELFCLASS32;
+
+  static uint32_t relSym(Elf32_Word info) { return ELF32_R_SYM(info); }
+  static uint32_t relType(Elf32_Word info) { return ELF32_R_TYPE(info); }
+  static Elf32_Word relInfo(uint32_t sym, uint32_t type) {
+    return ELF32_R_INFO(sym, type);
+  }
+};
+
+struct ELF64 {
+  typedef Elf64_Ehdr Ehdr;
+  typedef Elf64_Shdr Shdr;
+  typedef Elf64_Sym Sym;
+  typedef Elf64_Rel Rel;
+  typedef Elf64_Rela Rela;
+
+  static unsigned char const Class = ELFCLASS64;
+
+  static uint32_t relSym(Elf64_Xword info) { return ELF64_R_SYM(info); }
+  static uint32_t relType(Elf64_Xword info) { return ELF64_R_TYPE(info); }
+  static Elf64_Xword relInfo(uint32_t sym, uint32_t type) {
+    return ELF64_R_INFO(sym, type);
+  }
+};
+
+inline uint64_t alignTo(uint64_t value, uint64_t align) {
+  return (align > 1) ? (value + align - 1) / align * align : value;
+}
+
+// A string table with duplicated strings stored once.
+class StringTable {
+private:
+  std::string mData;
+  std::map<std::string, uint32_t> mIndex;
+
+public:
+  StringTable() : mData(1, '\0') {
+  }
+
+  uint32_t add(std::string const &str) {
+    if (str.empty()) {
+      return 0;
+    }
+
+    std::map<std::string, uint32_t>::const_iterator I = mIndex.find(str);
+    if (I != mIndex.end()) {
+      return I->second;
+    }
+
+    uint32_t offset = mData.size();
+    mData.append(str.c_str(), str.size() + 1);
+    mIndex[str] = offset;
+    return offset;
+  }
+
+  std::string const &data() const {
+    return mData;
+  }
+};
+
+template <typename ELFT>
+class Merger {
+private:
+  typedef typename ELFT::Ehdr Ehdr;
+  typedef typename ELFT::Shdr Shdr;
+  typedef typename ELFT::Sym Sym;
+  typedef typename ELFT::Rel Rel;
+  typedef typename ELFT::Rela Rela;
+
+  struct Input {
+    char const *mImage;
+    size_t mSize;
+
+    Ehdr const *mHeader;
+    Shdr const *mSections;
+    size_t mNumSections;
+
+    Sym const *mSyms;
+    size_t mNumSyms;
+    char const *mStrTab;
+    size_t mStrTabSize;
+
+    // Output section index (or -1 if the section is not copied) and the
+    // offset of the section in it.
+    std::vector<int> mSectionMap;
+    std::vector<uint64_t> mSectionOffset;
+
+    // Output symbol index of each input symbol (0 if it is dropped).
+    std::vector<uint32_t> mSymMap;
+  };
+
+  struct Relocation {
+    uint64_t mOffset;
+    uint32_t mSym;
+    uint32_t mType;
+    int64_t mAddend;
+  };
+
+  struct Section {
+    std::string mName;
+    uint32_t mType;
+    uint64_t mFlags;
+    uint64_t mAlign;
+    uint64_t mEntSize;
+    uint64_t mSize;
+    std::vector<char> mData;    // Empty for SHT_NOBITS
+
+    int mLink;                  // For SHF_LINK_ORDER
+
+    bool mHasRelocations;
+    bool mIsRela;
+    std::vector<Relocation> mRelocations;
+
+    uint64_t mFileOffset;
+  };
+
+  // The definition (or the first reference) chosen for a global symbol.
+  struct Global {
+    size_t mObj;
+    size_t mSym;
+    bool mStrongRef;
+    uint64_t mCommonSize;
+    uint64_t mCommonAlign;
+    uint32_t mOutIndex;
+  };
+
+  std::vector<Input> mInputs;
+  std::vector<Section> mSections;
+  std::map<std::string, size_t> mSectionIndex;
+
+  std::vector<Sym> mSyms;
+  StringTable mStrTab;
+  uint32_t mNumLocals;
+
+  std::string &mError;
+
+public:
+  Merger(std::string &error) : mNumLocals(0), mError(error) {
+  }
+
+  bool addInput(char const *image, size_t size);
+
+  bool merge(std::vector<char> &result);
+
+private:
+  bool fail(std::string const &msg) {
+    mError = msg;
+    return false;
+  }
+
+  static bool isGlobal(Sym const &sym) {
+    return ELF32_ST_BIND(sym.st_info) != STB_LOCAL;
+  }
+
+  static bool isWeak(Sym const &sym) {
+    return ELF32_ST_BIND(sym.st_info) == STB_WEAK;
+  }
+
+  char const *getSectionName(Input const &in, Shdr const &sec) const;
+
+  bool mapSections(size_t obj);
+  bool mapSymbol(Input const &in, Sym const &src, Sym &dst);
+  bool mapSymbols();
+  bool mapRelocations(size_t obj);
+
+  void layout(std::vector<char> &result,
+              StringTable &shStrTab,
+              std::vector<Shdr> &headers);
+};
+
+
+template <typename ELFT>
+bool Merger<ELFT>::addInput(char const *image, size_t size) {
+  Input in;
+
+  if (size < sizeof(Ehdr) || memcmp(image, ELFMAG, SELFMAG) != 0 ||
+      image[EI_CLASS] != ELFT::Class) {
+    return fail("Not an ELF object of the expected class");
+  }
+
+  in.mImage = image;
+  in.mSize = size;
+  in.mHeader = reinterpret_cast<Ehdr const *>(image);
+
+  Ehdr const &hdr = *in.mHeader;
+
+  if (hdr.e_type != ET_REL || hdr.e_shentsize != sizeof(Shdr) ||
+      hdr.e_shoff > size ||
+      (size - hdr.e_shoff) / sizeof(Shdr) < hdr.e_shnum ||
+      hdr.e_shstrndx >= hdr.e_shnum) {
+    return fail("Malformed ELF relocatable object");
+  }
+
+  if (!mInputs.empty()) {
+    Ehdr const &first = *mInputs[0].mHeader;
+    if (hdr.e_machine != first.e_machine ||
+        hdr.e_ident[EI_DATA] != first.e_ident[EI_DATA]) {
+      return fail("ELF objects are for different machines");
+    }
+  }
+
+  in.mSections = reinterpret_cast<Shdr const *>(image + hdr.e_shoff);
+  in.mNumSections = hdr.e_shnum;
+  in.mSyms = NULL;
+  in.mNumSyms = 0;
+  in.mStrTab = NULL;
+  in.mStrTabSize = 0;
+
+  for (size_t i = 0; i < in.mNumSections; ++i) {
+    Shdr const &sec = in.mSections[i];
+
+    if (sec.sh_type != SHT_NOBITS && sec.sh_type != SHT_NULL &&
+        (sec.sh_offset > size || size - sec.sh_offset < sec.sh_size)) {
+      return fail("ELF section is out of the object");
+    }
+
+    if (sec.sh_type == SHT_SYMTAB_SHNDX) {
+      return fail("Extended section indices are not supported");
+    }
+
+    if (sec.sh_type == SHT_SYMTAB) {
+      if (in.mSyms || sec.sh_entsize != sizeof(Sym) ||
+          sec.sh_link >= in.mNumSections) {
+        return fail("Malformed ELF symbol table");
+      }
+
+      Shdr const &strtab = in.mSections[sec.sh_link];
+      if (strtab.sh_type != SHT_STRTAB ||
+          strtab.sh_offset > size || size - strtab.sh_offset < strtab.sh_size) {
+        return fail("Malformed ELF string table");
+      }
+
+      in.mSyms = reinterpret_cast<Sym const *>(image + sec.sh_offset);
+      in.mNumSyms = sec.sh_size / sizeof(Sym);
+      in.mStrTab = image + strtab.sh_offset;
+      in.mStrTabSize = strtab.sh_size;
+    }
+  }
+
+  mInputs.push_back(in);
+  return true;
+}
+
+
+template <typename ELFT>
+char const *Merger<ELFT>::getSectionName(Input const &in,
+                                         Shdr const &sec) const {
+  Shdr const &shstrtab = in.mSections[in.mHeader->e_shstrndx];
+  char const *table = in.mImage + shstrtab.sh_offset;
+
+  if (sec.sh_name >= shstrtab.sh_size ||
+      memchr(table + sec.sh_name, '\0', shstrtab.sh_size - sec.sh_name) == NULL) {
+    return NULL;
+  }
+
+  return table + sec.sh_name;
+}
+
+
+template <typename ELFT>
+bool Merger<ELFT>::mapSections(size_t obj) {
+  Input &in = mInputs[obj];
+
+  in.mSectionMap.assign(in.mNumSections, -1);
+  in.mSectionOffset.assign(in.mNumSections, 0);
+
+  for (size_t i = 1; i < in.mNumSections; ++i) {
+    Shdr const &sec = in.mSections[i];
+
+    switch (sec.sh_type) {
+    case SHT_NULL:
+    case SHT_SYMTAB:
+    case SHT_STRTAB:
+    case SHT_REL:
+    case SHT_RELA:
+    case SHT_GROUP:
+      // Rebuilt (or dropped, as for the section groups) below.
+      continue;
+
+    default:
+      break;
+    }
+
+    char const *name = getSectionName(in, sec);
+    if (!name) {
+      return fail("Malformed ELF section name");
+    }
+
+    // Only the flags which matter to the loader tell sections apart.
+    uint64_t flags = sec.sh_flags & ~(uint64_t)SHF_GROUP;
+
+    std::string key(name);
+    key.push_back('\0');
+    key.append(reinterpret_cast<char const *>(&sec.sh_type),
+               sizeof(sec.sh_type));
+    key.append(reinterpret_cast<char const *>(&flags), sizeof(flags));
+
+    std::map<std::string, size_t>::iterator I = mSectionIndex.find(key);
+    size_t index;
+
+    if (I == mSectionIndex.end()) {
+      Section out;
+      out.mName = name;
+      out.mType = sec.sh_type;
+      out.mFlags = flags;
+      out.mAlign = 1;
+      out.mEntSize = sec.sh_entsize;
+      out.mSize = 0;
+      out.mLink = -1;
+      out.mHasRelocations = false;
+      out.mIsRela = false;
+      out.mFileOffset = 0;
+
+      index = mSections.size();
+      mSections.push_back(out);
+      mSectionIndex.insert(std::make_pair(key, index));
+    } else if (sec.sh_type == SHT_ARM_ATTRIBUTES) {
+      // The build attributes are the same for every partition; keep the
+      // first copy.
+      continue;
+    } else {
+      index = I->second;
+    }
+
+    Section &out = mSections[index];
+    uint64_t align = (sec.sh_addralign > 1) ? sec.sh_addralign : 1;
+    uint64_t offset = alignTo(out.mSize, align);
+
+    if (out.mEntSize != sec.sh_entsize) {
+      out.mEntSize = 0;
+    }
+
+    if (align > out.mAlign) {
+      out.mAlign = align;
+    }
+
+    if (sec.sh_type != SHT_NOBITS) {
+      out.mData.resize(offset, 0);
+      out.mData.insert(out.mData.end(),
+                       in.mImage + sec.sh_offset,
+                       in.mImage + sec.sh_offset + sec.sh_size);
+    }
+
+    out.mSize = offset + sec.sh_size;
+
+    in.mSectionMap[i] = index;
+    in.mSectionOffset[i] = offset;
+  }
+
+  // Pieces of a SHF_LINK_ORDER section (e.g. .ARM.exidx) are in the same
+  // order as the ones of the section they refer to.
+  for (size_t i = 1; i < in.mNumSections; ++i) {
+    Shdr const &sec = in.mSections[i];
+    int index = in.mSectionMap[i];
+
+    if (index >= 0 && (sec.sh_flags & SHF_LINK_ORDER) &&
+        mSections[index].mLink < 0 && sec.sh_link < in.mNumSections) {
+      mSections[index].mLink = in.mSectionMap[sec.sh_link];
+    }
+  }
+
+  return true;
+}
+
+
+template <typename ELFT>
+bool Merger<ELFT>::mapSymbol(Input const &in, Sym const &src, Sym &dst) {
+  dst = src;
+
+  if (src.st_name >= in.mStrTabSize) {
+    return fail("Malformed ELF symbol name");
+  }
+  dst.st_name = mStrTab.add(in.mStrTab + src.st_name);
+
+  if (src.st_shndx == SHN_UNDEF || src.st_shndx >= SHN_LORESERVE) {
+    // Undefined, absolute or common: nothing to relocate.
+    return true;
+  }
+
+  if (src.st_shndx >= in.mNumSections || in.mSectionMap[src.st_shndx] < 0) {
+    return fail("ELF symbol is defined in an unsupported section");
+  }
+
+  dst.st_shndx = in.mSectionMap[src.st_shndx] + 1;
+  dst.st_value = src.st_value + in.mSectionOffset[src.st_shndx];
+  return true;
+}
+
+
+template <typename ELFT>
+bool Merger<ELFT>::mapSymbols() {
+  Sym null;
+  memset(&null, 0, sizeof(null));
+  mSyms.push_back(null);
+
+  // Local symbols, object by object.
+  for (size_t obj = 0; obj < mInputs.size(); ++obj) {
+    Input &in = mInputs[obj];
+    in.mSymMap.assign(in.mNumSyms, 0);
+
+    for (size_t i = 1; i < in.mNumSyms; ++i) {
+      Sym const &src = in.mSyms[i];
+
+      if (isGlobal(src)) {
+        continue;
+      }
+
+      if (src.st_shndx != SHN_UNDEF && src.st_shndx < SHN_LORESERVE &&
+          src.st_shndx < in.mNumSections &&
+          in.mSectionMap[src.st_shndx] < 0) {
+        // In a dropped section (e.g. a duplicated .ARM.attributes.)
+        continue;
+      }
+
+      // A section symbol keeps addressing its own piece of the merged
+      // section through st_value, so the addends (which might be in the
+      // instructions, for SHT_REL) are left untouched.
+      Sym dst;
+      if (!mapSymbol(in, src, dst)) {
+        return false;
+      }
+
+      in.mSymMap[i] = mSyms.size();
+      mSyms.push_back(dst);
+    }
+  }
+
+  mNumLocals = mSyms.size();
+
+  // Global symbols, resolved by name.
+  std::vector<Global> globals;
+  std::map<std::string, size_t> globalIndex;
+
+  for (size_t obj = 0; obj < mInputs.size(); ++obj) {
+    Input const &in = mInputs[obj];
+
+    for (size_t i = 1; i < in.mNumSyms; ++i) {
+      Sym const &sym = in.mSyms[i];
+
+      if (!isGlobal(sym)) {
+        continue;
+      }
+
+      if (sym.st_name >= in.mStrTabSize) {
+        return fail("Malformed ELF symbol name");
+      }
+
+      std::string name(in.mStrTab + sym.st_name);
+      bool undefined = (sym.st_shndx == SHN_UNDEF);
+      bool common = (sym.st_shndx == SHN_COMMON);
+
+      std::map<std::string, size_t>::iterator I = globalIndex.find(name);
+
+      if (I == globalIndex.end()) {
+        Global g = { obj, i, undefined && !isWeak(sym),
+                     common ? sym.st_size : 0,
+                     common ? sym.st_value : 0, 0 };
+        globalIndex.insert(std::make_pair(name, globals.size()));
+        globals.push_back(g);
+        continue;
+      }
+
+      Global &g = globals[I->second];
+      Sym const &cur = mInputs[g.mObj].mSyms[g.mSym];
+      bool curUndefined = (cur.st_shndx == SHN_UNDEF);
+      bool curCommon = (cur.st_shndx == SHN_COMMON);
+
+      if (undefined) {
+        g.mStrongRef = g.mStrongRef || !isWeak(sym);
+      } else if (common) {
+        if (curUndefined) {
+          g.mObj = obj;
+          g.mSym = i;
+        }
+        if (curUndefined || curCommon) {
+          if (sym.st_size > g.mCommonSize) {
+            g.mCommonSize = sym.st_size;
+          }
+          if (sym.st_value > g.mCommonAlign) {
+            g.mCommonAlign = sym.st_value;
+          }
+        }
+      } else if (curUndefined || curCommon || (isWeak(cur) && !isWeak(sym))) {
+        g.mObj = obj;
+        g.mSym = i;
+      } else if (!isWeak(cur) && !isWeak(sym)) {
+        return fail("Duplicated definition of symbol: " + name);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < globals.size(); ++i) {
+    Global &g = globals[i];
+    Sym const &src = mInputs[g.mObj].mSyms[g.mSym];
+
+    Sym dst;
+    if (!mapSymbol(mInputs[g.mObj], src, dst)) {
+      return false;
+    }
+
+    if (src.st_shndx == SHN_COMMON) {
+      dst.st_size = g.mCommonSize;
+      dst.st_value = g.mCommonAlign;
+    } else if (src.st_shndx == SHN_UNDEF) {
+      // Weak only if no object requires the symbol.
+      dst.st_info = ELF32_ST_INFO(g.mStrongRef ? STB_GLOBAL : STB_WEAK,
+                                  ELF32_ST_TYPE(src.st_info));
+    }
+
+    g.mOutIndex = mSyms.size();
+    mSyms.push_back(dst);
+  }
+
+  for (size_t obj = 0; obj < mInputs.size(); ++obj) {
+    Input &in = mInputs[obj];
+
+    for (size_t i = 1; i < in.mNumSyms; ++i) {
+      Sym const &sym = in.mSyms[i];
+      if (isGlobal(sym)) {
+        std::string name(in.mStrTab + sym.st_name);
+        in.mSymMap[i] = globals[globalIndex[name]].mOutIndex;
+      }
+    }
+  }
+
+  return true;
+}
+
+
+template <typename ELFT>
+bool Merger<ELFT>::mapRelocations(size_t obj) {
+  Input const &in = mInputs[obj];
+
+  for (size_t i = 1; i < in.mNumSections; ++i) {
+    Shdr const &sec = in.mSections[i];
+
+    if (sec.sh_type != SHT_REL && sec.sh_type != SHT_RELA) {
+      continue;
+    }
+
+    bool isRela = (sec.sh_type == SHT_RELA);
+    size_t entSize = isRela ? sizeof(Rela) : sizeof(Rel);
+
+    if (sec.sh_entsize != entSize || sec.sh_info >= in.mNumSections) {
+      return fail("Malformed ELF relocation section");
+    }
+
+    int target = in.mSectionMap[sec.sh_info];
+    if (target < 0) {
+      // Relocations of a dropped section
+      continue;
+    }
+
+    Section &out = mSections[target];
+
+    if (out.mHasRelocations && out.mIsRela != isRela) {
+      return fail("Mixed SHT_REL and SHT_RELA relocations in section " +
+                  out.mName);
+    }
+
+    out.mHasRelocations = true;
+    out.mIsRela = isRela;
+
+    uint64_t offset = in.mSectionOffset[sec.sh_info];
+    char const *entry = in.mImage + sec.sh_offset;
+
+    for (size_t n = sec.sh_size / entSize; n > 0; --n, entry += entSize) {
+      Relocation rel;
+      uint32_t sym;
+
+      if (isRela) {
+        Rela const *r = reinterpret_cast<Rela const *>(entry);
+        rel.mOffset = r->r_offset;
+        rel.mType = ELFT::relType(r->r_info);
+        rel.mAddend = r->r_addend;
+        sym = ELFT::relSym(r->r_info);
+      } else {
+        Rel const *r = reinterpret_cast<Rel const *>(entry);
+        rel.mOffset = r->r_offset;
+        rel.mType = ELFT::relType(r->r_info);
+        rel.mAddend = 0;
+        sym = ELFT::relSym(r->r_info);
+      }
+
+      if (sym >= in.mNumSyms || (sym != 0 && in.mSymMap[sym] == 0)) {
+        return fail("ELF relocation refers to an unsupported symbol");
+      }
+
+      rel.mOffset += offset;
+      rel.mSym = in.mSymMap[sym];
+      out.mRelocations.push_back(rel);
+    }
+  }
+
+  return true;
+}
+
+
+template <typename ELFT>
+void Merger<ELFT>::layout(std::vector<char> &result,
+                          StringTable &shStrTab,
+                          std::vector<Shdr> &headers) {
+  uint64_t const wordAlign = (ELFT::Class == ELFCLASS64) ? 8 : 4;
+  uint64_t offset = sizeof(Ehdr);
+
+  Shdr null;
+  memset(&null, 0, sizeof(null));
+  headers.push_back(null);
+
+  // Merged sections
+  for (size_t i = 0; i < mSections.size(); ++i) {
+    Section &sec = mSections[i];
+    Shdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+
+    offset = alignTo(offset, sec.mAlign);
+    sec.mFileOffset = offset;
+
+    hdr.sh_name = shStrTab.add(sec.mName);
+    hdr.sh_type = sec.mType;
+    hdr.sh_flags = sec.mFlags;
+    hdr.sh_offset = offset;
+    hdr.sh_size = sec.mSize;
+    hdr.sh_link = (sec.mLink >= 0) ? sec.mLink + 1 : 0;
+    hdr.sh_addralign = sec.mAlign;
+    hdr.sh_entsize = sec.mEntSize;
+    headers.push_back(hdr);
+
+    if (sec.mType != SHT_NOBITS) {
+      offset += sec.mSize;
+    }
+  }
+
+  // Relocation sections (.symtab comes right after them.)
+  uint32_t symTabIndex = headers.size();
+  for (size_t i = 0; i < mSections.size(); ++i) {
+    if (mSections[i].mHasRelocations) {
+      ++symTabIndex;
+    }
+  }
+
+  std::vector<uint64_t> relOffsets;
+  for (size_t i = 0; i < mSections.size(); ++i) {
+    Section const &sec = mSections[i];
+    if (!sec.mHasRelocations) {
+      continue;
+    }
+
+    size_t entSize = sec.mIsRela ? sizeof(Rela) : sizeof(Rel);
+    Shdr hdr;
+    memset(&hdr, 0, sizeof(hdr));
+
+    offset = alignTo(offset, wordAlign);
+    relOffsets.push_back(offset);
+
+    hdr.sh_name = shStrTab.add((sec.mIsRela ? ".rela" : ".rel") + sec.mName);
+    hdr.sh_type = sec.mIsRela ? SHT_RELA : SHT_REL;
+    hdr.sh_offset = offset;
+    hdr.sh_size = sec.mRelocations.size() * entSize;
+    hdr.sh_link = symTabIndex;
+    hdr.sh_info = i + 1;
+    hdr.sh_addralign = wordAlign;
+    hdr.sh_entsize = entSize;
+    headers.push_back(hdr);
+
+    offset += hdr.sh_size;
+  }
+
+  // .symtab, .strtab and .shstrtab
+  Shdr symtab;
+  memset(&symtab, 0, sizeof(symtab));
+  offset = alignTo(offset, wordAlign);
+  symtab.sh_name = shStrTab.add(".symtab");
+  symtab.sh_type = SHT_SYMTAB;
+  symtab.sh_offset = offset;
+  symtab.sh_size = mSyms.size() * sizeof(Sym);
+  symtab.sh_link = symTabIndex + 1;
+  symtab.sh_info = mNumLocals;
+  symtab.sh_addralign = wordAlign;
+  symtab.sh_entsize = sizeof(Sym);
+  headers.push_back(symtab);
+  offset += symtab.sh_size;
+
+  Shdr strtab;
+  memset(&strtab, 0, sizeof(strtab));
+  strtab.sh_name = shStrTab.add(".strtab");
+  strtab.sh_type = SHT_STRTAB;
+  strtab.sh_offset = offset;
+  strtab.sh_size = mStrTab.data().size();
+  strtab.sh_addralign = 1;
+  headers.push_back(strtab);
+  offset += strtab.sh_size;
+
+  Shdr shstrtab;
+  memset(&shstrtab, 0, sizeof(shstrtab));
+  shstrtab.sh_name = shStrTab.add(".shstrtab");
+  shstrtab.sh_type = SHT_STRTAB;
+  shstrtab.sh_offset = offset;
+  shstrtab.sh_size = shStrTab.data().size();
+  shstrtab.sh_addralign = 1;
+  headers.push_back(shstrtab);
+  offset += shstrtab.sh_size;
+
+  uint64_t shoff = alignTo(offset, wordAlign);
+  result.assign(shoff + headers.size() * sizeof(Shdr), 0);
+
+  // Fill in the image.
+  char *image = &*result.begin();
+
+  Ehdr hdr;
+  memcpy(&hdr, mInputs[0].mHeader, sizeof(hdr));
+  hdr.e_phoff = 0;
+  hdr.e_phnum = 0;
+  hdr.e_phentsize = 0;
+  hdr.e_shoff = shoff;
+  hdr.e_shnum = headers.size();
+  hdr.e_shstrndx = headers.size() - 1;
+  hdr.e_ehsize = sizeof(Ehdr);
+  hdr.e_shentsize = sizeof(Shdr);
+  memcpy(image, &hdr, sizeof(hdr));
+
+  for (size_t i = 0; i < mSections.size(); ++i) {
+    Section const &sec = mSections[i];
+    if (!sec.mData.empty()) {
+      memcpy(image + sec.mFileOffset, &*sec.mData.begin(), sec.mData.size());
+    }
+  }
+
+  for (size_t i = 0, r = 0; i < mSections.size(); ++i) {
+    Section const &sec = mSections[i];
+    if (!sec.mHasRelocations) {
+      continue;
+    }
+
+    char *entry = image + relOffsets[r++];
+    for (size_t n = 0; n < sec.mRelocations.size(); ++n) {
+      Relocation const &rel = sec.mRelocations[n];
+
+      if (sec.mIsRela) {
+        Rela r;
+        r.r_offset = rel.mOffset;
+        r.r_info = ELFT::relInfo(rel.mSym, rel.mType);
+        r.r_addend = rel.mAddend;
+        memcpy(entry, &r, sizeof(r));
+        entry += sizeof(r);
+      } else {
+        Rel r;
+        r.r_offset = rel.mOffset;
+        r.r_info = ELFT::relInfo(rel.mSym, rel.mType);
+        memcpy(entry, &r, sizeof(r));
+        entry += sizeof(r);
+      }
+    }
+  }
+
+  memcpy(image + symtab.sh_offset, &*mSyms.begin(), symtab.sh_size);
+  memcpy(image + strtab.sh_offset, mStrTab.data().data(), strtab.sh_size);
+  memcpy(image + shstrtab.sh_offset, shStrTab.data().data(),
+         shstrtab.sh_size);
+  memcpy(image + shoff, &*headers.begin(), headers.size() * sizeof(Shdr));
+}
+
+
+template <typename ELFT>
+bool Merger<ELFT>::merge(std::vector<char> &result) {
+  for (size_t obj = 0; obj < mInputs.size(); ++obj) {
+    if (!mapSections(obj)) {
+      return false;
+    }
+  }
+
+  // The section indices of the symbols must not collide with the reserved
+  // ones (there are a few sections per object, so this is not expected.)
+  if (mSections.size() + 1 >= SHN_LORESERVE) {
+    return fail("Too many sections in the merged ELF object");
+  }
+
+  if (!mapSymbols()) {
+    return false;
+  }
+
+  for (size_t obj = 0; obj < mInputs.size(); ++obj) {
+    if (!mapRelocations(obj)) {
+      return false;
+    }
+  }
+
+  StringTable shStrTab;
+  std::vector<Shdr> headers;
+  layout(result, shStrTab, headers);
+  return true;
+}
+
+
+template <typename ELFT>
+bool mergeObjects(std::vector<std::pair<char const *, size_t> > const &objs,
+                  std::vector<char> &result,
+                  std::string &error) {
+  Merger<ELFT> merger(error);
+
+  for (size_t i = 0; i < objs.size(); ++i) {
+    if (!merger.addInput(objs[i].first, objs[i].second)) {
+      return false;
+    }
+  }
+
+  return merger.merge(result);
+}
+
+} // namespace anonymous
+
+namespace bcc {
+
+bool ELFObjectMerger::merge(std::vector<char> &result,
+                            std::string &error) const {
+  if (mObjects.empty()) {
+    error = "No ELF object to merge";
+    return false;
+  }
+
+  std::vector<std::pair<char const *, size_t> > objs;
+  for (size_t i = 0; i < mObjects.size(); ++i) {
+    objs.push_back(std::make_pair(mObjects[i].mImage, mObjects[i].mSize));
+  }
+
+  if (mObjects[0].mSize > EI_CLASS &&
+      mObjects[0].mImage[EI_CLASS] == ELFCLASS64) {
+    return mergeObjects<ELF64>(objs, result, error);
+  }
+
+  return mergeObjects<ELF32>(objs, result, error);
+}
+
+} // namespace bcc
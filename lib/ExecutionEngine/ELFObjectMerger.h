@@ -0,0 +1,59 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_ELFOBJECTMERGER_H
+#define BCC_ELFOBJECTMERGER_H
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+namespace bcc {
+
+  // Combines ELF relocatable objects of the same machine into a single
+  // relocatable object (like "ld -r"), so that the objects emitted for the
+  // partitions of a module can be loaded by one rsloaderCreateExec().
+  //
+  // Sections with the same name, type and flags are concatenated.  Global
+  // symbols are resolved across the objects, and the references to the
+  // undefined ones are left to the loader.  Relocations are kept as they are
+  // (only their offsets and symbol indices are rewritten), so no relocation
+  // type has to be understood here.
+  class ELFObjectMerger {
+  private:
+    struct Object {
+      char const *mImage;
+      size_t mSize;
+    };
+
+    std::vector<Object> mObjects;
+
+  public:
+    // The image must outlive the call to merge().
+    void addObject(char const *image, size_t size) {
+      Object obj = { image, size };
+      mObjects.push_back(obj);
+    }
+
+    // Return false and set error if an object is malformed, the objects are
+    // not of the same kind, or a global symbol is defined more than once.
+    bool merge(std::vector<char> &result, std::string &error) const;
+  };
+
+} // namespace bcc
+
+#endif // BCC_ELFOBJECTMERGER_H
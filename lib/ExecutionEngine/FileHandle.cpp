@@ -25,22 +25,45 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 namespace bcc {
 
 int FileHandle::open(char const *filename, OpenMode::ModeType mode) {
-  static int const open_flags[2] = {
+  static int const open_flags[4] = {
+    O_RDONLY,
+    O_RDWR | O_CREAT | O_TRUNC,
     O_RDONLY,
     O_RDWR | O_CREAT | O_TRUNC,
   };
 
-  static int const lock_flags[2] = { LOCK_SH, LOCK_EX };
+  static int const lock_flags[4] = { LOCK_SH, LOCK_EX, 0, LOCK_EX };
 
 #if USE_LOGGER
-  static char const *const open_mode_str[2] = { "read", "write" };
+  static char const *const open_mode_str[4] = {
+    "read", "write", "read", "write"
+  };
 #endif
 
+  if (mode == OpenMode::ReadUnlocked) {
+    // The file is replaced atomically by rename(), so whatever we open is a
+    // complete file which will not change under us.
+    do {
+      mFD = ::open(filename, open_flags[mode]);
+    } while (mFD < 0 && errno == EINTR);
+
+    if (mFD < 0) {
+      LOGV("Unable to open %s in %s mode.  (reason: %s)\n",
+           filename, open_mode_str[mode], strerror(errno));
+      return -1;
+    }
+
+    LOGV("File opened. fd=%d\n", mFD);
+    return mFD;
+  }
+
   static size_t const RETRY_MAX = 4;
 
   static useconds_t const RETRY_USEC = 200000UL;
@@ -63,6 +86,13 @@ int FileHandle::open(char const *filename, OpenMode::ModeType mode) {
 
     // Try to lock the file
     if (flock(mFD, lock_flags[mode] | LOCK_NB) < 0) {
+      if (mode == OpenMode::TryWrite) {
+        LOGV("%s is locked by someone else.\n", filename);
+        ::close(mFD);
+        mFD = -1;
+        return -1;
+      }
+
       LOGW("Unable to acquire the lock immediately, block and wait now ...\n");
 
       if (flock(mFD, lock_flags[mode]) < 0) {
@@ -103,7 +133,76 @@ int FileHandle::open(char const *filename, OpenMode::ModeType mode) {
 }
 
 
+int FileHandle::createTemporary(char const *filename) {
+  std::string tempPath(filename);
+  tempPath.append(".XXXXXX");
+
+  mFD = mkstemp(&*tempPath.begin());
+
+  if (mFD < 0) {
+    LOGW("Unable to create temporary file for %s.  (reason: %s)\n",
+         filename, strerror(errno));
+    return -1;
+  }
+
+  // mkstemp() creates the file with mode 0600, but the published file
+  // should be readable just like the files created by open().
+  fchmod(mFD, 0644);
+
+  mTempPath = tempPath;
+
+  LOGV("Temporary file opened. fd=%d path=%s\n", mFD, mTempPath.c_str());
+  return mFD;
+}
+
+
+bool FileHandle::publish(char const *filename) {
+  if (mFD < 0 || mTempPath.empty()) {
+    return false;
+  }
+
+  // Make sure the content reaches the disk before the new name does, so
+  // that a crash never leaves a truncated file under the final name.
+  if (fsync(mFD) != 0) {
+    LOGE("Unable to sync %s.  (reason: %s)\n",
+         mTempPath.c_str(), strerror(errno));
+    discard();
+    return false;
+  }
+
+  if (rename(mTempPath.c_str(), filename) != 0) {
+    LOGE("Unable to rename %s to %s.  (reason: %s)\n",
+         mTempPath.c_str(), filename, strerror(errno));
+    discard();
+    return false;
+  }
+
+  mTempPath.clear();
+  close();
+  return true;
+}
+
+
+void FileHandle::discard() {
+  if (!mTempPath.empty()) {
+    if (unlink(mTempPath.c_str()) != 0) {
+      LOGE("Unable to remove temporary file %s.  (reason: %s)\n",
+           mTempPath.c_str(), strerror(errno));
+    }
+    mTempPath.clear();
+  }
+
+  close();
+}
+
+
 void FileHandle::close() {
+  if (!mTempPath.empty()) {
+    // The temporary file is not published.  Don't leave it behind.
+    discard();
+    return;
+  }
+
   if (mFD >= 0) {
     flock(mFD, LOCK_UN);
     ::close(mFD);
@@ -137,6 +236,39 @@ ssize_t FileHandle::read(char *buf, size_t count) {
 }
 
 
+ssize_t FileHandle::pread(char *buf, size_t count, off_t offset) {
+  if (mFD < 0) {
+    return -1;
+  }
+
+  ssize_t nread = 0;
+
+  while (count > 0) {
+    ssize_t n = ::pread(mFD, static_cast<void *>(buf), count, offset);
+
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EINTR) {
+        return -1;
+      }
+
+      continue;
+    }
+
+    if (n == 0) {
+      // End of file
+      break;
+    }
+
+    nread += n;
+    count -= (size_t)n;
+    buf += (size_t)n;
+    offset += (off_t)n;
+  }
+
+  return nread;
+}
+
+
 ssize_t FileHandle::write(char const *buf, size_t count) {
   if (mFD < 0) {
     return -1;
@@ -22,11 +22,20 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include <string>
+
 namespace bcc {
   namespace OpenMode {
     enum ModeType {
       Read = 0,
       Write = 1,
+
+      // Read a file that is never modified in place, i.e., a file that is
+      // only replaced by publish().  Neither a lock nor a retry is needed.
+      ReadUnlocked = 2,
+
+      // Write, but fail at once instead of waiting if the file is locked.
+      TryWrite = 3,
     };
   }
 
@@ -34,6 +43,10 @@ namespace bcc {
   private:
     int mFD;
 
+    // Path of the temporary file created by createTemporary(), which has not
+    // been published yet.
+    std::string mTempPath;
+
   public:
     FileHandle() : mFD(-1) {
     }
@@ -46,6 +59,19 @@ namespace bcc {
 
     int open(char const *filename, OpenMode::ModeType mode);
 
+    // Create a uniquely named temporary file next to filename and open it
+    // for writing.  Call publish() to move it into place atomically, so that
+    // the readers never observe a partially written file.
+    int createTemporary(char const *filename);
+
+    // Flush the temporary file to the disk and rename() it to filename.
+    // The temporary file is removed on failure.
+    bool publish(char const *filename);
+
+    // Close and remove the temporary file.  (Called by close() when the
+    // temporary file has not been published.)
+    void discard();
+
     void close();
 
     int getFD() {
@@ -60,6 +86,10 @@ namespace bcc {
 
     ssize_t read(char *buf, size_t count);
 
+    // Read exactly count bytes starting at offset unless the end of file is
+    // reached.  The file position is not changed.
+    ssize_t pread(char *buf, size_t count, off_t offset);
+
     ssize_t write(char const *buf, size_t count);
 
     void truncate();
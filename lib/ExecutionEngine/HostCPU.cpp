@@ -0,0 +1,178 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "HostCPU.h"
+
+#include "DebugHelper.h"
+
+#include "llvm/Support/Host.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <set>
+#include <sstream>
+
+#if defined(__i386__) || defined(__x86_64__)
+#include <cpuid.h>
+#endif
+
+namespace {
+
+#if defined(__arm__)
+struct ARMPart {
+  unsigned long mPart;
+  char const *mCPU;
+};
+
+// The "CPU part" of /proc/cpuinfo
+ARMPart const ARMParts[] = {
+  { 0xc08, "cortex-a8" },
+  { 0xc09, "cortex-a9" },
+};
+
+size_t const NumARMParts = sizeof(ARMParts) / sizeof(ARMPart);
+
+bool detectARM(std::string &CPU, std::vector<std::string> &Features) {
+  FILE *cpuinfo = fopen("/proc/cpuinfo", "r");
+  if (!cpuinfo) {
+    return false;
+  }
+
+  std::set<std::string> hwcaps;
+  unsigned long part = 0;
+  bool hasFeatures = false;
+
+  char line[1024];
+  while (fgets(line, sizeof(line), cpuinfo)) {
+    char *colon = strchr(line, ':');
+    if (!colon) {
+      continue;
+    }
+
+    if (strncmp(line, "Features", 8) == 0) {
+      std::istringstream tokens(colon + 1);
+      std::string token;
+      while (tokens >> token) {
+        hwcaps.insert(token);
+      }
+      hasFeatures = true;
+    } else if (strncmp(line, "CPU part", 8) == 0) {
+      part = strtoul(colon + 1, NULL, 0);
+    }
+  }
+
+  fclose(cpuinfo);
+
+  if (!hasFeatures) {
+    return false;
+  }
+
+  for (size_t i = 0; i < NumARMParts; ++i) {
+    if (ARMParts[i].mPart == part) {
+      CPU = ARMParts[i].mCPU;
+      break;
+    }
+  }
+
+  if (hwcaps.count("vfpv3")) {
+    Features.push_back("+vfp3");
+    // Only 16 double registers, unless the kernel says otherwise
+    if (hwcaps.count("vfpv3d16") && !hwcaps.count("vfpd32")) {
+      Features.push_back("+d16");
+    }
+  } else if (hwcaps.count("vfp")) {
+    Features.push_back("+vfp2");
+  }
+
+  if (hwcaps.count("neon")) {
+    Features.push_back("+neon");
+  } else {
+    Features.push_back("-neon");
+  }
+
+  return true;
+}
+#endif // __arm__
+
+
+#if defined(__i386__) || defined(__x86_64__)
+// Whether the OS saves the AVX registers on a context switch
+bool isAVXEnabledByOS() {
+  unsigned eax, edx;
+  __asm__ (".byte 0x0f, 0x01, 0xd0"  // xgetbv
+           : "=a" (eax), "=d" (edx) : "c" (0));
+  return (eax & 0x6) == 0x6;
+}
+
+bool detectX86(std::string &CPU, std::vector<std::string> &Features) {
+  unsigned eax, ebx, ecx, edx;
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+    return false;
+  }
+
+  CPU = llvm::sys::getHostCPUName();
+  if (CPU == "generic") {
+    CPU.clear();
+  }
+
+  if (ecx & (1 << 0))   Features.push_back("+sse3");
+  if (ecx & (1 << 9))   Features.push_back("+ssse3");
+  if (ecx & (1 << 19))  Features.push_back("+sse41");
+  if (ecx & (1 << 20))  Features.push_back("+sse42");
+  if (ecx & (1 << 23))  Features.push_back("+popcnt");
+
+  // The CPU name may imply AVX, which is only usable if the OS saves the
+  // registers.
+  bool hasAVX = (ecx & (1 << 28)) && (ecx & (1 << 27)) && isAVXEnabledByOS();
+  Features.push_back(hasAVX ? "+avx" : "-avx");
+
+  return true;
+}
+#endif // __i386__ || __x86_64__
+
+} // namespace anonymous
+
+namespace bcc {
+
+bool detectHostCPU(std::string &CPU, std::vector<std::string> &Features) {
+  CPU.clear();
+  Features.clear();
+
+  bool detected = false;
+
+#if defined(__arm__)
+  detected = detectARM(CPU, Features);
+#elif defined(__i386__) || defined(__x86_64__)
+  detected = detectX86(CPU, Features);
+#endif
+
+  if (!detected) {
+    CPU.clear();
+    Features.clear();
+    return false;
+  }
+
+  LOGV("Host CPU: %s\n", CPU.empty() ? "(unknown)" : CPU.c_str());
+  for (size_t i = 0; i < Features.size(); ++i) {
+    LOGV("Host CPU feature: %s\n", Features[i].c_str());
+  }
+
+  return true;
+}
+
+} // namespace bcc
@@ -0,0 +1,33 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_HOSTCPU_H
+#define BCC_HOSTCPU_H
+
+#include <string>
+#include <vector>
+
+namespace bcc {
+
+  // Detect the CPU of the device at run time, and the features the code
+  // generator may use on it, in the terms of LLVM (e.g. "cortex-a9" and
+  // "+neon").  CPU is left empty if it is not known.  Return false if the
+  // features can't be detected on this architecture.
+  bool detectHostCPU(std::string &CPU, std::vector<std::string> &Features);
+
+} // namespace bcc
+
+#endif // BCC_HOSTCPU_H
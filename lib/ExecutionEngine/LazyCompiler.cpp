@@ -0,0 +1,431 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "LazyCompiler.h"
+
+#include "Compiler.h"
+#include "CompilerResourcePool.h"
+#include "Config.h"
+#include "DebugHelper.h"
+#include "ModuleUtils.h"
+
+#include "llvm/ADT/OwningPtr.h"
+
+#include "llvm/Bitcode/ReaderWriter.h"
+
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "llvm/Target/TargetData.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include "llvm/BasicBlock.h"
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/Function.h"
+#include "llvm/GlobalVariable.h"
+#include "llvm/Instructions.h"
+#include "llvm/LLVMContext.h"
+#include "llvm/Module.h"
+
+#include <string.h>
+
+#include <set>
+
+namespace {
+
+char const LazySuffix[] = ".bcc.lazy";
+
+char const CompileLazyName[] = "__bcc_compile_lazy";
+char const ContextName[] = "__bcc_lazy_context";
+
+// Append the global values C refers to.
+void addConstantRefs(llvm::Constant const *C,
+                     std::set<llvm::GlobalValue const *> &refs) {
+  if (llvm::GlobalValue const *GV = llvm::dyn_cast<llvm::GlobalValue>(C)) {
+    refs.insert(GV);
+    return;
+  }
+
+  for (unsigned i = 0, e = C->getNumOperands(); i != e; ++i) {
+    if (llvm::Constant const *Op =
+          llvm::dyn_cast<llvm::Constant>(C->getOperand(i))) {
+      addConstantRefs(Op, refs);
+    }
+  }
+}
+
+
+bool isWorthStub(llvm::Function const &F) {
+  if (F.isDeclaration() || F.isVarArg() ||
+      F.hasAvailableExternallyLinkage()) {
+    return false;
+  }
+
+  size_t size = 0;
+  for (llvm::Function::const_iterator
+       BB = F.begin(), BE = F.end(); BB != BE; ++BB) {
+    // The blocks must stay where their addresses are taken.
+    if (BB->hasAddressTaken()) {
+      return false;
+    }
+    size += BB->size();
+  }
+
+  return size >= BCC_LAZY_COMPILE_MIN_SIZE;
+}
+
+
+// Replace the body of F by a call through the slot "<name>.bcc.slot", which
+// is filled by __bcc_compile_lazy(context, index) on the first call.
+void createStub(llvm::Function *F, unsigned index,
+                llvm::GlobalVariable *Context, llvm::Constant *CompileLazy) {
+  llvm::Module *M = F->getParent();
+  llvm::LLVMContext &C = M->getContext();
+
+  F->deleteBody();
+
+  llvm::GlobalVariable *Slot =
+    bcc::createSlot(M, F->getName(),
+                    llvm::ConstantPointerNull::get(F->getType()));
+
+  llvm::BasicBlock *Entry = llvm::BasicBlock::Create(C, "entry", F);
+  llvm::BasicBlock *Resolve = llvm::BasicBlock::Create(C, "resolve", F);
+  llvm::BasicBlock *Call = llvm::BasicBlock::Create(C, "call", F);
+
+  // The slot is filled by another thread.
+  llvm::Value *Code =
+    new llvm::LoadInst(Slot, "", /* isVolatile= */ true, Entry);
+  llvm::Value *IsEmpty =
+    new llvm::ICmpInst(*Entry, llvm::ICmpInst::ICMP_EQ, Code,
+                       llvm::ConstantPointerNull::get(F->getType()));
+  llvm::BranchInst::Create(Resolve, Call, IsEmpty, Entry);
+
+  llvm::Value *Args[] = {
+    new llvm::LoadInst(Context, "", Resolve),
+    llvm::ConstantInt::get(llvm::Type::getInt32Ty(C), index)
+  };
+  llvm::Value *Compiled =
+    llvm::CallInst::Create(CompileLazy, Args, "", Resolve);
+  Compiled = new llvm::BitCastInst(Compiled, F->getType(), "", Resolve);
+  llvm::BranchInst::Create(Call, Resolve);
+
+  llvm::PHINode *Target = llvm::PHINode::Create(F->getType(), 2, "", Call);
+  Target->addIncoming(Code, Entry);
+  Target->addIncoming(Compiled, Resolve);
+
+  std::vector<llvm::Value *> CallArgs;
+  for (llvm::Function::arg_iterator I = F->arg_begin(), E = F->arg_end();
+       I != E; ++I) {
+    CallArgs.push_back(&*I);
+  }
+
+  llvm::CallInst *Forward = llvm::CallInst::Create(Target, CallArgs, "", Call);
+  Forward->setCallingConv(F->getCallingConv());
+  Forward->setAttributes(F->getAttributes());
+  Forward->setTailCall();
+
+  if (F->getReturnType()->isVoidTy()) {
+    llvm::ReturnInst::Create(C, Call);
+  } else {
+    llvm::ReturnInst::Create(C, Forward, Call);
+  }
+}
+
+} // namespace anonymous
+
+namespace bcc {
+
+LazyCompiler::LazyCompiler(Compiler *compiler, PipelineConfig const &config)
+  : mCompiler(compiler), mConfig(config), mScript(NULL) {
+  pthread_mutex_init(&mLock, NULL);
+}
+
+
+LazyCompiler *LazyCompiler::create(Compiler *compiler) {
+  llvm::Module *M = compiler->mModule;
+
+  if (!canCompileApart(M)) {
+    return NULL;
+  }
+
+  // The entry points are compiled now.
+  std::vector<char const *> entryPoints;
+  compiler->collectExportSymbols(
+    M->getNamedMetadata(Compiler::ExportVarMetadataName),
+    M->getNamedMetadata(Compiler::ExportFuncMetadataName),
+    entryPoints);
+
+  std::set<std::string> entryPointSet(entryPoints.begin(), entryPoints.end());
+
+  // A function whose code could not be loaded on its own is compiled now,
+  // so the script fails to load rather than on the first call.
+  std::map<llvm::GlobalValue const *, bool> resolved;
+
+  std::vector<llvm::Function *> functions;
+  for (llvm::Module::iterator I = M->begin(), E = M->end(); I != E; ++I) {
+    if (!entryPointSet.count(I->getName().str()) && isWorthStub(*I) &&
+        canResolveRefs(compiler, *I, resolved)) {
+      functions.push_back(&*I);
+    }
+  }
+
+  if (functions.empty()) {
+    return NULL;
+  }
+
+  // The code compiled later refers to the rest of the script by symbol.
+  for (llvm::Module::iterator I = M->begin(), E = M->end(); I != E; ++I) {
+    if (I->hasLocalLinkage()) {
+      promoteToHidden(&*I);
+    }
+  }
+
+  promoteLocalVariables(M);
+
+  LazyCompiler *lazy = new LazyCompiler(compiler, compiler->mConfig);
+
+  {
+    llvm::raw_svector_ostream OS(lazy->mBitcode);
+    llvm::WriteBitcodeToFile(M, OS);
+    OS.flush();
+  }
+
+  llvm::LLVMContext &C = M->getContext();
+  llvm::PointerType *VoidPtrTy = llvm::Type::getInt8PtrTy(C);
+
+  llvm::GlobalVariable *Context =
+    new llvm::GlobalVariable(*M, VoidPtrTy, /* isConstant= */ false,
+                             llvm::GlobalValue::ExternalLinkage,
+                             llvm::ConstantPointerNull::get(VoidPtrTy),
+                             ContextName);
+  Context->setVisibility(llvm::GlobalValue::HiddenVisibility);
+
+  llvm::Type *Params[] = { VoidPtrTy, llvm::Type::getInt32Ty(C) };
+  llvm::Constant *CompileLazy =
+    M->getOrInsertFunction(CompileLazyName,
+                           llvm::FunctionType::get(VoidPtrTy, Params,
+                                                   /* isVarArg= */ false));
+
+  for (size_t i = 0; i < functions.size(); ++i) {
+    lazy->mFunctions.push_back(functions[i]->getName());
+    createStub(functions[i], i, Context, CompileLazy);
+  }
+
+  LOGV("Compiling %lu functions on their first call.\n",
+       (unsigned long)functions.size());
+  return lazy;
+}
+
+
+LazyCompiler::~LazyCompiler() {
+  for (size_t i = 0; i < mExecutables.size(); ++i) {
+    rsloaderDisposeExec(mExecutables[i]);
+  }
+
+  pthread_mutex_destroy(&mLock);
+}
+
+
+bool LazyCompiler::start(RSExecRef script) {
+  void **context =
+    static_cast<void **>(rsloaderGetSymbolAddress(script, ContextName));
+
+  if (!context) {
+    return false;
+  }
+
+  mScript = script;
+  *context = this;
+  return true;
+}
+
+
+void *LazyCompiler::lookupRuntime(char const *name) {
+  if (strcmp(name, CompileLazyName) == 0) {
+    return reinterpret_cast<void *>(&compileLazy);
+  }
+  return NULL;
+}
+
+
+bool LazyCompiler::canResolveRefs(Compiler const *compiler,
+                                  llvm::Function const &F,
+                                  std::map<llvm::GlobalValue const *,
+                                           bool> &resolved) {
+  std::set<llvm::GlobalValue const *> refs;
+
+  for (llvm::Function::const_iterator BB = F.begin(), BE = F.end();
+       BB != BE; ++BB) {
+    for (llvm::BasicBlock::const_iterator I = BB->begin(), IE = BB->end();
+         I != IE; ++I) {
+      for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i) {
+        if (llvm::Constant const *C =
+              llvm::dyn_cast<llvm::Constant>(I->getOperand(i))) {
+          addConstantRefs(C, refs);
+        }
+      }
+    }
+  }
+
+  for (std::set<llvm::GlobalValue const *>::const_iterator
+       I = refs.begin(), E = refs.end(); I != E; ++I) {
+    llvm::GlobalValue const *GV = *I;
+
+    if (!GV->isDeclaration() || !GV->hasName()) {
+      continue;
+    }
+
+    if (llvm::Function const *Callee = llvm::dyn_cast<llvm::Function>(GV)) {
+      if (Callee->isIntrinsic()) {
+        continue;
+      }
+    }
+
+    std::map<llvm::GlobalValue const *, bool>::iterator R =
+      resolved.find(GV);
+    if (R == resolved.end()) {
+      R = resolved.insert(std::make_pair(
+            GV, compiler->lookupSymbol(GV->getName().str().c_str()) != NULL))
+          .first;
+    }
+
+    if (!R->second) {
+      LOGW("Compile %s now: %s is not found\n", F.getName().str().c_str(),
+           GV->getName().str().c_str());
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+void *LazyCompiler::compileLazy(void *context, unsigned index) {
+  LazyCompiler *self = static_cast<LazyCompiler *>(context);
+
+  void *code = self->compile(index);
+  if (!code) {
+    // The stub has nowhere to go.  (The functions whose symbols might not
+    // be resolved are not compiled lazily, see canResolveRefs().)
+    llvm::report_fatal_error("Unable to compile " + self->mFunctions[index] +
+                             " on its first call");
+  }
+
+  return code;
+}
+
+
+void *LazyCompiler::resolveSymbol(void *context, char const *name) {
+  LazyCompiler *self = static_cast<LazyCompiler *>(context);
+
+  // The rest of the script
+  if (void *addr = rsloaderGetSymbolAddress(self->mScript, name)) {
+    return addr;
+  }
+
+  return Compiler::resolveSymbolAdapter(self->mCompiler, name);
+}
+
+
+void *LazyCompiler::compile(unsigned index) {
+  std::string const &name = mFunctions[index];
+
+  void * volatile *slot = getSlot(mScript, name);
+
+  if (!slot) {
+    return NULL;
+  }
+
+  pthread_mutex_lock(&mLock);
+
+  // Another thread may have compiled it meanwhile.
+  if (void *code = *slot) {
+    pthread_mutex_unlock(&mLock);
+    return code;
+  }
+
+  CompilerResourcePool &pool = CompilerResourcePool::get();
+
+  PooledContext context;
+  pool.acquireContext(context);
+  llvm::TargetMachine *TM = NULL;
+  llvm::Module *M = NULL;
+  llvm::Function *F = NULL;
+
+  llvm::SmallVector<char, 1024> object;
+  std::string error;
+
+  llvm::OwningPtr<llvm::MemoryBuffer> MEM(
+    llvm::MemoryBuffer::getMemBuffer(
+      llvm::StringRef(mBitcode.begin(), mBitcode.size()), "", false));
+
+  M = llvm::ParseBitcodeFile(MEM.get(), *context.mContext, &error);
+  if (M) {
+    F = M->getFunction(name);
+  }
+
+  if (F) {
+    // Only F is defined here; the script defines the rest.
+    stripFunctions(M, F);
+    stripGlobals(M, /* keepVariables= */ false);
+
+    // The stub keeps the name in the script.
+    F->setName(name + LazySuffix);
+
+    TM = pool.acquireTargetMachine(error);
+    if (TM) {
+      if (!Compiler::emitMC(M, new llvm::TargetData(M), TM, mConfig,
+                            object, error)) {
+        object.clear();
+      }
+      pool.releaseTargetMachine(TM);
+    }
+  } else if (M) {
+    error = "The function is missing from the bitcode";
+  }
+
+  delete M;
+  pool.releaseContext(context);
+
+  void *code = NULL;
+
+  if (!object.empty()) {
+    RSExecRef executable =
+      rsloaderCreateExec((unsigned char *)object.begin(), object.size(),
+                         &resolveSymbol, this);
+
+    if (executable) {
+      mExecutables.push_back(executable);
+      code = rsloaderGetSymbolAddress(executable,
+                                      (name + LazySuffix).c_str());
+    } else {
+      error = "Unable to load the code";
+    }
+  }
+
+  if (code) {
+    setSlot(slot, code);
+  } else {
+    LOGE("Unable to compile %s: %s\n", name.c_str(), error.c_str());
+  }
+
+  pthread_mutex_unlock(&mLock);
+  return code;
+}
+
+} // namespace bcc
@@ -0,0 +1,103 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_LAZYCOMPILER_H
+#define BCC_LAZYCOMPILER_H
+
+#include "PipelineConfig.h"
+
+#include "librsloader.h"
+
+#include "llvm/ADT/SmallVector.h"
+
+#include <pthread.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class Function;
+  class GlobalValue;
+}
+
+namespace bcc {
+  class Compiler;
+
+  // Generates the code of the internal functions of a script compiled with
+  // BCC_LAZY_COMPILE on their first call.
+  //
+  // After the LTO, the body of each large function other than the entry
+  // points is replaced by a stub, which calls through the slot (named
+  // "<function>.bcc.slot").  The slot is empty at first, and the stub asks
+  // __bcc_compile_lazy for the code.  The code is generated from a bitcode
+  // copy of the module taken before the stubs are put in, with every other
+  // function and the global variables turned into declarations, so that it
+  // refers to the rest of the script by symbol.  It is loaded on its own,
+  // and the slot is filled, so the later calls go straight to it.
+  class LazyCompiler {
+  private:
+    Compiler *mCompiler;
+
+    PipelineConfig mConfig;
+
+    llvm::SmallVector<char, 1024> mBitcode;
+
+    // The functions with a stub, by the index the stub passes
+    std::vector<std::string> mFunctions;
+
+    // The loaded script, and the loaded code of each function compiled
+    RSExecRef mScript;
+    std::vector<RSExecRef> mExecutables;
+
+    // Held while a function is compiled
+    pthread_mutex_t mLock;
+
+    LazyCompiler(Compiler *compiler, PipelineConfig const &config);
+
+  public:
+    // Put the stubs in the module of compiler (after its LTO), and keep a
+    // bitcode copy of the bodies.  Return NULL (and leave the module
+    // unchanged) if no function is worth compiling lazily.
+    static LazyCompiler *create(Compiler *compiler);
+
+    ~LazyCompiler();
+
+    // Give the stubs of the loaded script to this object.
+    bool start(RSExecRef script);
+
+    // The functions of the runtime the stubs call
+    static void *lookupRuntime(char const *name);
+
+  private:
+    // Whether every symbol F refers to is defined by the script or
+    // resolved by compiler, so the code of F can be loaded on its own.
+    // resolved memoizes the declarations checked.
+    static bool canResolveRefs(Compiler const *compiler,
+                               llvm::Function const &F,
+                               std::map<llvm::GlobalValue const *,
+                                        bool> &resolved);
+
+    static void *compileLazy(void *context, unsigned index);
+
+    static void *resolveSymbol(void *context, char const *name);
+
+    void *compile(unsigned index);
+  };
+
+} // namespace bcc
+
+#endif // BCC_LAZYCOMPILER_H
@@ -0,0 +1,229 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "LibraryIndex.h"
+
+#include "DebugHelper.h"
+
+#include "llvm/ADT/SmallVector.h"
+
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/Function.h"
+#include "llvm/GlobalVariable.h"
+#include "llvm/Instructions.h"
+#include "llvm/Module.h"
+
+#include <set>
+
+namespace {
+
+typedef std::vector<llvm::GlobalValue const *> ValueList;
+
+// Append the global values C refers to.
+void addConstantRefs(llvm::Constant const *C,
+                     std::set<llvm::Constant const *> &visited,
+                     ValueList &refs) {
+  if (!visited.insert(C).second) {
+    return;
+  }
+
+  if (llvm::GlobalValue const *GV = llvm::dyn_cast<llvm::GlobalValue>(C)) {
+    refs.push_back(GV);
+    return;
+  }
+
+  // (The operands of a blockaddress include a basic block.)
+  for (unsigned i = 0, e = C->getNumOperands(); i != e; ++i) {
+    llvm::Value const *Op = C->getOperand(i);
+    if (llvm::isa<llvm::Constant>(Op)) {
+      addConstantRefs(llvm::cast<llvm::Constant>(Op), visited, refs);
+    }
+  }
+}
+
+
+void addFunctionRefs(llvm::Function const &F, ValueList &refs) {
+  std::set<llvm::Constant const *> visited;
+
+  for (llvm::Function::const_iterator BB = F.begin(), BE = F.end();
+       BB != BE; ++BB) {
+    for (llvm::BasicBlock::const_iterator I = BB->begin(), IE = BB->end();
+         I != IE; ++I) {
+      for (unsigned i = 0, e = I->getNumOperands(); i != e; ++i) {
+        if (llvm::Constant const *C =
+              llvm::dyn_cast<llvm::Constant>(I->getOperand(i))) {
+          addConstantRefs(C, visited, refs);
+        }
+      }
+    }
+  }
+}
+
+
+// Append the global values of library named as the symbols in [I, E).
+template <typename Iterator>
+void addNamedValues(llvm::Module const *library, Iterator I, Iterator E,
+                    ValueList &values) {
+  for (; I != E; ++I) {
+    if (!I->hasLocalLinkage() && I->hasName()) {
+      if (llvm::GlobalValue const *GV = library->getNamedValue(I->getName())) {
+        values.push_back(GV);
+      }
+    }
+  }
+}
+
+} // namespace anonymous
+
+namespace bcc {
+
+LibraryIndex::LibraryIndex(llvm::Module const *library)
+  : mLibrary(library),
+    mSelective(library->alias_empty() && library->named_metadata_empty()) {
+  if (!mSelective) {
+    return;
+  }
+
+  for (llvm::Module::const_iterator
+       I = library->begin(), E = library->end(); I != E; ++I) {
+    if (!I->isDeclaration()) {
+      addFunctionRefs(*I, mRefs[&*I]);
+    }
+  }
+
+  for (llvm::Module::const_global_iterator
+       I = library->global_begin(), E = library->global_end(); I != E; ++I) {
+    if (I->hasInitializer()) {
+      std::set<llvm::Constant const *> visited;
+      addConstantRefs(I->getInitializer(), visited, mRefs[&*I]);
+    }
+
+    if (I->getName().startswith("llvm.")) {
+      mRoots.push_back(&*I);
+    }
+  }
+}
+
+
+llvm::Module *LibraryIndex::extract(llvm::Module const *M) const {
+  if (!mSelective) {
+    return llvm::CloneModule(mLibrary);
+  }
+
+  // The symbols of M found in the library (a definition in M may be
+  // overridden by the library), and what they refer to
+  std::set<llvm::GlobalValue const *> linked;
+  ValueList worklist(mRoots);
+
+  addNamedValues(mLibrary, M->begin(), M->end(), worklist);
+  addNamedValues(mLibrary, M->global_begin(), M->global_end(), worklist);
+
+  while (!worklist.empty()) {
+    llvm::GlobalValue const *GV = worklist.back();
+    worklist.pop_back();
+
+    if (!linked.insert(GV).second) {
+      continue;
+    }
+
+    llvm::DenseMap<llvm::GlobalValue const *, ValueList>::const_iterator
+      refs = mRefs.find(GV);
+    if (refs != mRefs.end()) {
+      worklist.insert(worklist.end(),
+                      refs->second.begin(), refs->second.end());
+    }
+  }
+
+  // Copy them as CloneModule() does, in the order of the library.
+  llvm::Module *New = new llvm::Module(mLibrary->getModuleIdentifier(),
+                                       mLibrary->getContext());
+  New->setDataLayout(mLibrary->getDataLayout());
+  New->setTargetTriple(mLibrary->getTargetTriple());
+  New->setModuleInlineAsm(mLibrary->getModuleInlineAsm());
+
+  for (llvm::Module::lib_iterator
+       I = mLibrary->lib_begin(), E = mLibrary->lib_end(); I != E; ++I) {
+    New->addLibrary(*I);
+  }
+
+  llvm::ValueToValueMapTy VMap;
+
+  for (llvm::Module::const_global_iterator I = mLibrary->global_begin(),
+       E = mLibrary->global_end(); I != E; ++I) {
+    if (linked.count(&*I)) {
+      llvm::GlobalVariable *GV =
+        new llvm::GlobalVariable(*New, I->getType()->getElementType(),
+                                 I->isConstant(), I->getLinkage(),
+                                 NULL, I->getName(), NULL,
+                                 I->isThreadLocal(),
+                                 I->getType()->getAddressSpace());
+      GV->copyAttributesFrom(&*I);
+      VMap[&*I] = GV;
+    }
+  }
+
+  for (llvm::Module::const_iterator
+       I = mLibrary->begin(), E = mLibrary->end(); I != E; ++I) {
+    if (linked.count(&*I)) {
+      llvm::Function *F =
+        llvm::Function::Create(
+          llvm::cast<llvm::FunctionType>(I->getType()->getElementType()),
+          I->getLinkage(), I->getName(), New);
+      F->copyAttributesFrom(&*I);
+      VMap[&*I] = F;
+    }
+  }
+
+  for (llvm::Module::const_global_iterator I = mLibrary->global_begin(),
+       E = mLibrary->global_end(); I != E; ++I) {
+    if (linked.count(&*I) && I->hasInitializer()) {
+      llvm::GlobalVariable *GV = llvm::cast<llvm::GlobalVariable>(VMap[&*I]);
+      GV->setInitializer(llvm::MapValue(I->getInitializer(), VMap));
+    }
+  }
+
+  for (llvm::Module::const_iterator
+       I = mLibrary->begin(), E = mLibrary->end(); I != E; ++I) {
+    if (!linked.count(&*I) || I->isDeclaration()) {
+      continue;
+    }
+
+    llvm::Function *F = llvm::cast<llvm::Function>(VMap[&*I]);
+
+    llvm::Function::arg_iterator DestI = F->arg_begin();
+    for (llvm::Function::const_arg_iterator
+         J = I->arg_begin(), JE = I->arg_end(); J != JE; ++J) {
+      DestI->setName(J->getName());
+      VMap[&*J] = DestI++;
+    }
+
+    llvm::SmallVector<llvm::ReturnInst *, 8> Returns;
+    llvm::CloneFunctionInto(F, &*I, VMap, /* ModuleLevelChanges= */ true,
+                            Returns);
+  }
+
+  LOGV("Linking %lu of the %lu functions and variables of the library\n",
+       (unsigned long)linked.size(),
+       (unsigned long)(mLibrary->size() + mLibrary->getGlobalList().size()));
+
+  return New;
+}
+
+} // namespace bcc
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_LIBRARYINDEX_H
+#define BCC_LIBRARYINDEX_H
+
+#include "llvm/ADT/DenseMap.h"
+
+#include <vector>
+
+namespace llvm {
+  class GlobalValue;
+  class Module;
+}
+
+namespace bcc {
+
+  // The global values each function and variable of a library refers to,
+  // built once for the library kept in a PooledContext.
+  //
+  // The library is much larger than what a script uses, and most of it
+  // would only be linked to be internalized and deleted by the LTO.  With
+  // the index, a script is linked with a copy of the part of the library
+  // it can reach: the definitions of the symbols it names, and everything
+  // they refer to.
+  class LibraryIndex {
+  private:
+    typedef std::vector<llvm::GlobalValue const *> ValueList;
+
+    llvm::Module const *mLibrary;
+
+    llvm::DenseMap<llvm::GlobalValue const *, ValueList> mRefs;
+
+    // Always copied (e.g. llvm.global_ctors)
+    ValueList mRoots;
+
+    // False if the library has an alias or named metadata, which are not
+    // worth splitting; it is then copied as a whole.
+    bool mSelective;
+
+  public:
+    // library must be read completely, and outlive the index.
+    explicit LibraryIndex(llvm::Module const *library);
+
+    // A copy of the library (in its context) to be linked into M.
+    llvm::Module *extract(llvm::Module const *M) const;
+  };
+
+} // namespace bcc
+
+#endif // BCC_LIBRARYINDEX_H
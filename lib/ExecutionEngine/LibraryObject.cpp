@@ -0,0 +1,406 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "LibraryObject.h"
+
+#include "Compiler.h"
+#include "CompilerResourcePool.h"
+#include "Config.h"
+#include "DebugHelper.h"
+#include "FileHandle.h"
+#include "Runtime.h"
+
+#include "llvm/ADT/SmallVector.h"
+
+#include "llvm/Target/TargetData.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include "llvm/Transforms/Utils/Cloning.h"
+
+#include "llvm/Constants.h"
+#include "llvm/Function.h"
+#include "llvm/GlobalVariable.h"
+#include "llvm/Instructions.h"
+#include "llvm/Module.h"
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <map>
+#include <set>
+#include <vector>
+
+#include <pthread.h>
+
+namespace {
+
+// The loaded objects by their keys; more than one for a key if the symbol
+// lookup callbacks of the scripts disagree.  The lock is held while an
+// object is compiled, so each one is compiled only once.
+typedef std::multimap<std::string, bcc::LibraryObject *> ObjectMap;
+ObjectMap Objects;
+pthread_mutex_t ObjectsLock = PTHREAD_MUTEX_INITIALIZER;
+
+struct SymbolLookup {
+  BCCSymbolLookupFn mpFn;
+  void *mpContext;
+
+  // The symbols resolved by mpFn
+  std::vector<std::pair<std::string, void *> > mImports;
+};
+
+void externalize(llvm::GlobalValue *GV) {
+  if (GV->isDeclaration() || GV->hasAppendingLinkage()) {
+    return;
+  }
+
+  if (GV->hasLocalLinkage()) {
+    // The symbol table makes the name unique, in the same way for every
+    // copy of the library.
+    std::string name(GV->hasName() ? GV->getName().str() + ".bcc.lib"
+                                   : std::string("__bcc_lib"));
+    GV->setName(name);
+  }
+
+  GV->setLinkage(llvm::GlobalValue::ExternalLinkage);
+  GV->setVisibility(llvm::GlobalValue::DefaultVisibility);
+}
+
+
+// Append the functions and variables of the library referring to V.
+void addUsers(llvm::Value *V, std::vector<llvm::GlobalValue *> &users) {
+  for (llvm::Value::use_iterator UI = V->use_begin(), UE = V->use_end();
+       UI != UE; ++UI) {
+    llvm::User *U = *UI;
+
+    if (llvm::Instruction *I = llvm::dyn_cast<llvm::Instruction>(U)) {
+      users.push_back(I->getParent()->getParent());
+    } else if (llvm::GlobalValue *GV = llvm::dyn_cast<llvm::GlobalValue>(U)) {
+      if (!GV->getName().startswith("llvm.")) {
+        users.push_back(GV);
+      }
+    } else if (llvm::isa<llvm::Constant>(U)) {
+      addUsers(U, users);
+    }
+  }
+}
+
+
+// The state of library: its variables which are not constant, and the
+// functions and variables referring to them, directly or not.  Each script
+// keeps a copy of its own.
+void collectStateful(llvm::Module *library,
+                     std::set<llvm::GlobalValue *> &stateful) {
+  std::vector<llvm::GlobalValue *> worklist;
+
+  for (llvm::Module::global_iterator
+       I = library->global_begin(), E = library->global_end(); I != E; ++I) {
+    if (!I->isDeclaration() && !I->isConstant() &&
+        !I->getName().startswith("llvm.")) {
+      worklist.push_back(&*I);
+    }
+  }
+
+  while (!worklist.empty()) {
+    llvm::GlobalValue *GV = worklist.back();
+    worklist.pop_back();
+
+    if (stateful.insert(GV).second) {
+      addUsers(GV, worklist);
+    }
+  }
+}
+
+
+size_t getInstructionCount(llvm::Function const &F) {
+  size_t count = 0;
+  for (llvm::Function::const_iterator
+       BB = F.begin(), BE = F.end(); BB != BE; ++BB) {
+    count += BB->size();
+  }
+  return count;
+}
+
+} // namespace anonymous
+
+namespace bcc {
+
+LibraryObject *LibraryObject::get(std::string const &key,
+                                  std::string const &path,
+                                  BCCSymbolLookupFn pFn, void *pContext) {
+  pthread_mutex_lock(&ObjectsLock);
+
+  LibraryObject *object = find(key, pFn, pContext);
+  if (!object && !path.empty()) {
+    object = load(path, pFn, pContext);
+    if (object) {
+      Objects.insert(std::make_pair(key, object));
+    }
+  }
+
+  pthread_mutex_unlock(&ObjectsLock);
+  return object;
+}
+
+
+LibraryObject *LibraryObject::getOrCreate(std::string const &key,
+                                          std::string const &path,
+                                          llvm::Module const *library,
+                                          BCCSymbolLookupFn pFn,
+                                          void *pContext,
+                                          std::string &error) {
+  pthread_mutex_lock(&ObjectsLock);
+
+  LibraryObject *object = find(key, pFn, pContext);
+
+  if (!object && !path.empty()) {
+    object = load(path, pFn, pContext);
+    if (object) {
+      Objects.insert(std::make_pair(key, object));
+    }
+  }
+
+  if (object) {
+    pthread_mutex_unlock(&ObjectsLock);
+    return object;
+  }
+
+  CompilerResourcePool &pool = CompilerResourcePool::get();
+  llvm::TargetMachine *TM = pool.acquireTargetMachine(error);
+  llvm::SmallVector<char, 1024> obj;
+
+  if (TM) {
+    llvm::Module *M = llvm::CloneModule(library);
+
+    // Leave the state of the library to the scripts.
+    std::set<llvm::GlobalValue *> stateful;
+    collectStateful(M, stateful);
+
+    for (llvm::Module::iterator
+         I = M->begin(), E = M->end(); I != E; ++I) {
+      if (stateful.count(&*I)) {
+        I->deleteBody();
+      }
+    }
+
+    for (llvm::Module::global_iterator
+         I = M->global_begin(), E = M->global_end(); I != E; ++I) {
+      if (stateful.count(&*I)) {
+        I->setInitializer(NULL);
+        I->setLinkage(llvm::GlobalValue::ExternalLinkage);
+      }
+    }
+
+    // Keep every other definition for the scripts.
+    std::vector<std::string> names;
+    for (llvm::Module::iterator
+         I = M->begin(), E = M->end(); I != E; ++I) {
+      if (!I->isDeclaration()) {
+        names.push_back(I->getName());
+      }
+    }
+
+    for (llvm::Module::global_iterator
+         I = M->global_begin(), E = M->global_end(); I != E; ++I) {
+      if (!I->isDeclaration()) {
+        names.push_back(I->getName());
+      }
+    }
+
+    std::vector<char const *> ExportSymbols;
+    for (size_t i = 0; i < names.size(); ++i) {
+      ExportSymbols.push_back(names[i].c_str());
+    }
+
+    // The library is compiled with the default pipeline, whatever the
+    // script asks for.
+    PipelineConfig config;
+    Compiler::runLTO(M, new llvm::TargetData(M), config, ExportSymbols);
+
+    if (!Compiler::emitMC(M, new llvm::TargetData(M), TM, config, obj,
+                          error)) {
+      obj.clear();
+    }
+
+    delete M;
+    pool.releaseTargetMachine(TM);
+  }
+
+  if (!obj.empty()) {
+    SymbolLookup lookup;
+    lookup.mpFn = pFn;
+    lookup.mpContext = pContext;
+
+    RSExecRef executable =
+      rsloaderCreateExec((unsigned char *)obj.begin(), obj.size(),
+                         &resolveSymbol, &lookup);
+
+    if (executable) {
+      object = new LibraryObject(executable, lookup.mImports);
+      Objects.insert(std::make_pair(key, object));
+    } else {
+      error = "Unable to load the library object";
+    }
+  }
+
+  if (object && !path.empty()) {
+    FileHandle file;
+    if (file.createTemporary(path.c_str()) < 0 ||
+        file.write(obj.begin(), obj.size()) != (ssize_t)obj.size() ||
+        !file.publish(path.c_str())) {
+      LOGW("Unable to write the library object %s.\n", path.c_str());
+    }
+  }
+
+  pthread_mutex_unlock(&ObjectsLock);
+  return object;
+}
+
+
+bool LibraryObject::matches(BCCSymbolLookupFn pFn, void *pContext) const {
+  for (size_t i = 0; i < mImports.size(); ++i) {
+    void *addr = pFn ? pFn(pContext, mImports[i].first.c_str()) : NULL;
+    if (addr != mImports[i].second) {
+      return false;
+    }
+  }
+  return true;
+}
+
+
+LibraryObject *LibraryObject::find(std::string const &key,
+                                   BCCSymbolLookupFn pFn, void *pContext) {
+  std::pair<ObjectMap::iterator, ObjectMap::iterator> range =
+    Objects.equal_range(key);
+
+  for (ObjectMap::iterator I = range.first; I != range.second; ++I) {
+    if (I->second->matches(pFn, pContext)) {
+      return I->second;
+    }
+  }
+
+  if (range.first != range.second) {
+    LOGV("Load another library object for a different symbol lookup\n");
+  }
+  return NULL;
+}
+
+
+LibraryObject *LibraryObject::load(std::string const &path,
+                                   BCCSymbolLookupFn pFn, void *pContext) {
+  FileHandle file;
+  if (file.open(path.c_str(), OpenMode::ReadUnlocked) < 0) {
+    return NULL;
+  }
+
+  struct stat st;
+  if (fstat(file.getFD(), &st) != 0 || st.st_size <= 0) {
+    return NULL;
+  }
+
+  std::vector<unsigned char> obj(st.st_size);
+  if (file.pread(reinterpret_cast<char *>(&*obj.begin()), obj.size(), 0) !=
+      (ssize_t)obj.size()) {
+    LOGE("Unable to read the library object %s.\n", path.c_str());
+    return NULL;
+  }
+
+  SymbolLookup lookup;
+  lookup.mpFn = pFn;
+  lookup.mpContext = pContext;
+
+  RSExecRef executable =
+    rsloaderCreateExec(&*obj.begin(), obj.size(), &resolveSymbol, &lookup);
+
+  if (!executable) {
+    LOGE("Unable to load the library object %s.\n", path.c_str());
+    return NULL;
+  }
+
+  return new LibraryObject(executable, lookup.mImports);
+}
+
+
+void *LibraryObject::resolveSymbol(void *context, char const *name) {
+  SymbolLookup *lookup = static_cast<SymbolLookup *>(context);
+
+  if (void *addr = FindRuntimeFunction(name)) {
+    return addr;
+  }
+
+  if (lookup->mpFn) {
+    if (void *addr = lookup->mpFn(lookup->mpContext, name)) {
+      lookup->mImports.push_back(std::make_pair(std::string(name), addr));
+      return addr;
+    }
+  }
+
+  LOGE("Unable to resolve symbol: %s\n", name);
+  return NULL;
+}
+
+
+void LibraryObject::externalizeLocals(llvm::Module *library) {
+  for (llvm::Module::iterator
+       I = library->begin(), E = library->end(); I != E; ++I) {
+    externalize(&*I);
+  }
+
+  for (llvm::Module::global_iterator
+       I = library->global_begin(), E = library->global_end(); I != E; ++I) {
+    if (!I->getName().startswith("llvm.")) {
+      externalize(&*I);
+    }
+  }
+}
+
+
+void LibraryObject::strip(llvm::Module *library) {
+  std::set<llvm::GlobalValue *> stateful;
+  collectStateful(library, stateful);
+
+  // The constant variables are defined by the object only.
+  for (llvm::Module::global_iterator
+       I = library->global_begin(), E = library->global_end(); I != E; ++I) {
+    if (!I->isDeclaration() && !I->getName().startswith("llvm.") &&
+        !stateful.count(&*I)) {
+      I->setInitializer(NULL);
+      I->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+
+  size_t kept = 0, dropped = 0;
+
+  for (llvm::Module::iterator
+       I = library->begin(), E = library->end(); I != E; ++I) {
+    if (I->isDeclaration()) {
+      continue;
+    }
+
+    if (stateful.count(&*I) ||
+        getInstructionCount(*I) < BCC_SHARED_LIBRARY_INLINE_SIZE) {
+      ++kept;
+    } else {
+      I->deleteBody();
+      ++dropped;
+    }
+  }
+
+  LOGV("Library functions: %lu in the script, %lu in the library object\n",
+       (unsigned long)kept, (unsigned long)dropped);
+}
+
+} // namespace bcc
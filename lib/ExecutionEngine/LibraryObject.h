@@ -0,0 +1,113 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_LIBRARYOBJECT_H
+#define BCC_LIBRARYOBJECT_H
+
+#include <bcc/bcc.h>
+
+#include "librsloader.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace llvm {
+  class Module;
+}
+
+namespace bcc {
+
+  // The library bitcode compiled once into a loaded object, which is shared
+  // by the scripts compiled with BCC_SHARED_LIBRARY in this process.  The
+  // object is also written to a file, and loaded from there by the later
+  // processes.
+  //
+  // The state of the library is not shared: the variables which are not
+  // constant, and the functions referring to them (see collectStateful()),
+  // are left out of the object.  A script links a copy of the library with
+  // only them and the bodies of the small functions left (to be inlined),
+  // and refers to the rest of the library in the object.  For the symbols
+  // to match, the local symbols of both copies are given the same external
+  // names by externalizeLocals().
+  //
+  // The symbols the object imports from the symbol lookup callback of the
+  // script it is loaded for are bound to the addresses of that callback.
+  // A script whose callback resolves any of them elsewhere gets an object
+  // of its own.
+  //
+  // The objects are never unloaded.
+  class LibraryObject {
+  private:
+    typedef std::vector<std::pair<std::string, void *> > ImportList;
+
+    RSExecRef mExecutable;
+
+    // The symbols resolved by the symbol lookup callback, and their
+    // addresses
+    ImportList mImports;
+
+    LibraryObject(RSExecRef executable, ImportList const &imports)
+      : mExecutable(executable), mImports(imports) {
+    }
+
+  public:
+    // The object of key for pFn, loaded from path if it has not been loaded
+    // yet.  Return NULL if there is neither.  (path may be empty.)  The
+    // external symbols of the object are resolved with pFn as it is loaded.
+    static LibraryObject *get(std::string const &key, std::string const &path,
+                              BCCSymbolLookupFn pFn, void *pContext);
+
+    // Same as get(), but compile library (externalized already) into the
+    // object of key, and write it to path, if there is none.  Return NULL
+    // and set error on failure.
+    static LibraryObject *getOrCreate(std::string const &key,
+                                      std::string const &path,
+                                      llvm::Module const *library,
+                                      BCCSymbolLookupFn pFn, void *pContext,
+                                      std::string &error);
+
+    // Give the local symbols of library external names (the same ones in
+    // every copy of the library bitcode), and make its definitions external.
+    static void externalizeLocals(llvm::Module *library);
+
+    // Turn library (externalized already) into the part a script links:
+    // the state of the library, and the bodies of the functions smaller than
+    // BCC_SHARED_LIBRARY_INLINE_SIZE.
+    static void strip(llvm::Module *library);
+
+    void *lookup(char const *name) const {
+      return rsloaderGetSymbolAddress(mExecutable, name);
+    }
+
+  private:
+    // Whether pFn resolves the imports of the object to the same addresses.
+    bool matches(BCCSymbolLookupFn pFn, void *pContext) const;
+
+    // The loaded object of key matching pFn, or NULL.  ObjectsLock must be
+    // held.
+    static LibraryObject *find(std::string const &key,
+                               BCCSymbolLookupFn pFn, void *pContext);
+
+    static LibraryObject *load(std::string const &path,
+                               BCCSymbolLookupFn pFn, void *pContext);
+
+    static void *resolveSymbol(void *context, char const *name);
+  };
+
+} // namespace bcc
+
+#endif // BCC_LIBRARYOBJECT_H
@@ -18,7 +18,9 @@
 
 #include "DebugHelper.h"
 #include "FileHandle.h"
+#include "LibraryObject.h"
 #include "ScriptCached.h"
+#include "Sha1Helper.h"
 #include "Runtime.h"
 
 #include <bcc/bcc_mccache.h>
@@ -26,8 +28,10 @@
 #include <llvm/ADT/OwningPtr.h>
 
 #include <errno.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <utility>
 #include <vector>
@@ -41,20 +45,25 @@ using namespace std;
 
 
 #if USE_MCJIT
+namespace {
+
+// Return the index-th string of the pool, or NULL if the index is out of
+// range.
+char const *getPoolString(vector<char const *> const &pool, size_t index) {
+  return (index < pool.size()) ? pool[index] : NULL;
+}
+
+} // namespace anonymous
+
 namespace bcc {
 
 MCCacheReader::~MCCacheReader() {
-  if (mpHeader) { free(mpHeader); }
-  if (mpCachedDependTable) { free(mpCachedDependTable); }
-  if (mpPragmaList) { free(mpPragmaList); }
-  if (mpVarNameList) { free(mpVarNameList); }
-  if (mpFuncNameList) { free(mpFuncNameList); }
+  // Note: The sections are not owned by the reader.  They point into the
+  // mapping of the info file, which is released along with mpResult.
 }
 
-ScriptCached *MCCacheReader::readCacheFile(FileHandle *objFile,
-                                           FileHandle *infoFile,
-                                           Script *S) {
-  bool result = checkCacheFile(objFile, infoFile, S)
+ScriptCached *MCCacheReader::readCacheFile(FileHandle *file, Script *S) {
+  bool result = checkCacheFile(file, S)
              && readPragmaList()
              && readObjectSlotList()
              && readObjFile()
@@ -66,16 +75,13 @@ ScriptCached *MCCacheReader::readCacheFile(FileHandle *objFile,
   return result ? mpResult.take() : NULL;
 }
 
-bool MCCacheReader::checkCacheFile(FileHandle *objFile,
-                                            FileHandle *infoFile,
-                                            Script *S) {
+bool MCCacheReader::checkCacheFile(FileHandle *file, Script *S) {
   // Check file handle
-  if (!objFile || objFile->getFD() < 0 || !infoFile || infoFile->getFD() < 0) {
+  if (!file || file->getFD() < 0) {
     return false;
   }
 
-  mObjFile = objFile;
-  mInfoFile = infoFile;
+  mFile = file;
 
   // Allocate ScriptCached object
   mpResult.reset(new (nothrow) ScriptCached(S));
@@ -86,9 +92,11 @@ bool MCCacheReader::checkCacheFile(FileHandle *objFile,
   }
 
   bool result = checkFileSize()
+             && mapFile()
              && readHeader()
              && checkHeader()
              && checkMachineIntType()
+             && checkDependencyDigest()
              && checkSectionOffsetAndSize()
              && readStringPool()
              && checkStringPool()
@@ -100,16 +108,41 @@ bool MCCacheReader::checkCacheFile(FileHandle *objFile,
 }
 
 
+bool MCCacheReader::checkCacheHeader(FileHandle *file) {
+  // Check file handle
+  if (!file || file->getFD() < 0) {
+    return false;
+  }
+
+  MCO_Header header;
+  if (file->pread(reinterpret_cast<char *>(&header), sizeof(header), 0) !=
+      static_cast<ssize_t>(sizeof(header))) {
+    LOGE("Unable to read cache file header.\n");
+    return false;
+  }
+
+  mpHeader = &header;
+
+  bool result = checkHeader()
+             && checkMachineIntType()
+             && checkDependencyDigest()
+             ;
+
+  mpHeader = NULL;
+  return result;
+}
+
+
 bool MCCacheReader::checkFileSize() {
   struct stat stfile;
-  if (fstat(mInfoFile->getFD(), &stfile) < 0) {
+  if (fstat(mFile->getFD(), &stfile) < 0) {
     LOGE("Unable to stat cache file.\n");
     return false;
   }
 
-  mInfoFileSize = stfile.st_size;
+  mFileSize = stfile.st_size;
 
-  if (mInfoFileSize < (off_t)sizeof(MCO_Header)) {
+  if (mFileSize < (off_t)sizeof(MCO_Header)) {
     LOGE("Cache file is too small to be correct.\n");
     return false;
   }
@@ -118,23 +151,29 @@ bool MCCacheReader::checkFileSize() {
 }
 
 
-bool MCCacheReader::readHeader() {
-  if (mInfoFile->seek(0, SEEK_SET) != 0) {
-    LOGE("Unable to seek to 0. (reason: %s)\n", strerror(errno));
-    return false;
-  }
+bool MCCacheReader::mapFile() {
+  // Map the whole cache file once, so that every section and the ELF object
+  // can be used in place instead of being read into its own heap block.
+  void *addr = mmap(NULL, (size_t)mFileSize, PROT_READ, MAP_PRIVATE,
+                    mFile->getFD(), 0);
 
-  mpHeader = (MCO_Header *)malloc(sizeof(MCO_Header));
-  if (!mpHeader) {
-    LOGE("Unable to allocate for cache header.\n");
+  if (addr == MAP_FAILED) {
+    LOGE("Unable to mmap cache file. (reason: %s)\n", strerror(errno));
     return false;
   }
 
-  if (mInfoFile->read(reinterpret_cast<char *>(mpHeader), sizeof(MCO_Header)) !=
-      (ssize_t)sizeof(MCO_Header)) {
-    LOGE("Unable to read cache header.\n");
-    return false;
-  }
+  // The mapping is handed over to the ScriptCached object, so the sections
+  // stay valid as long as the script.
+  mpFileMap = static_cast<char const *>(addr);
+  mpResult->mpCacheMap = static_cast<char *>(addr);
+  mpResult->mCacheMapSize = (size_t)mFileSize;
+
+  return true;
+}
+
+
+bool MCCacheReader::readHeader() {
+  mpHeader = reinterpret_cast<MCO_Header const *>(mpFileMap);
 
   // Dirty hack for libRS.
   // TODO(all): This should be removed in the future.
@@ -147,15 +186,18 @@ bool MCCacheReader::readHeader() {
 
 
 bool MCCacheReader::checkHeader() {
-  if (memcmp(mpHeader->magic, OBCC_MAGIC, 4) != 0) {
+  if (memcmp(mpHeader->magic, MCO_MAGIC, 4) != 0) {
     LOGE("Bad magic word\n");
     return false;
   }
 
-  if (memcmp(mpHeader->version, OBCC_VERSION, 4) != 0) {
-    mpHeader->version[4 - 1] = '\0'; // ensure c-style string terminated
+  if (memcmp(mpHeader->version, MCO_VERSION, 4) != 0) {
+    // The mapping is read-only, so terminate a copy of the version string.
+    char version[4];
+    memcpy(version, mpHeader->version, 4 - 1);
+    version[4 - 1] = '\0';
     LOGI("Cache file format version mismatch: now %s cached %s\n",
-         OBCC_VERSION, mpHeader->version);
+         MCO_VERSION, version);
     return false;
   }
   return true;
@@ -189,7 +231,7 @@ bool MCCacheReader::checkSectionOffsetAndSize() {
     off_t offset = mpHeader-> NAME##_offset;                                \
     off_t size = (off_t)mpHeader-> NAME##_size;                             \
                                                                             \
-    if (mInfoFileSize < offset || mInfoFileSize < offset + size) {          \
+    if (mFileSize < offset || mFileSize < offset + size) {                  \
       LOGE(#NAME " section overflow.\n");                                   \
       return false;                                                         \
     }                                                                       \
@@ -212,30 +254,43 @@ bool MCCacheReader::checkSectionOffsetAndSize() {
 
 #undef CHECK_SECTION_OFFSET
 
+  // The ELF object is placed after the metadata, aligned to a page size.
+  if (mpHeader->obj_size == 0 ||
+      mFileSize < mpHeader->obj_offset ||
+      mFileSize - mpHeader->obj_offset < (off_t)mpHeader->obj_size) {
+    LOGE("ELF object section overflow.\n");
+    return false;
+  }
+
+  if (mpHeader->obj_offset % sysconf(_SC_PAGESIZE) != 0) {
+    LOGE("ELF object offset must be aligned to a page size.\n");
+    return false;
+  }
+
   return true;
 }
 
 
-#define CACHE_READER_READ_SECTION(TYPE, AUTO_MANAGED_HOLDER, NAME)          \
-  TYPE *NAME##_raw = (TYPE *)malloc(mpHeader->NAME##_size);                 \
-                                                                            \
-  if (!NAME##_raw) {                                                        \
-    LOGE("Unable to allocate for " #NAME "\n");                             \
-    return false;                                                           \
-  }                                                                         \
-                                                                            \
-  /* We have to ensure that some one will deallocate NAME##_raw */          \
-  AUTO_MANAGED_HOLDER = NAME##_raw;                                         \
-                                                                            \
-  if (mInfoFile->seek(mpHeader->NAME##_offset, SEEK_SET) == -1) {           \
-    LOGE("Unable to seek to " #NAME " section\n");                          \
+#define CACHE_READER_READ_SECTION(TYPE, HOLDER, NAME)                       \
+  /* Sections are used in place, so they must lie within the mapping. */   \
+  if (mFileSize < mpHeader->NAME##_offset ||                                \
+      mFileSize - mpHeader->NAME##_offset <                                 \
+        (off_t)mpHeader->NAME##_size) {                                     \
+    LOGE(#NAME " section overflow.\n");                                     \
     return false;                                                           \
   }                                                                         \
                                                                             \
-  if (mInfoFile->read(reinterpret_cast<char *>(NAME##_raw),                 \
-                  mpHeader->NAME##_size) != (ssize_t)mpHeader->NAME##_size) \
-  {                                                                         \
-    LOGE("Unable to read " #NAME ".\n");                                    \
+  TYPE *NAME##_raw = (TYPE *)(mpFileMap + mpHeader->NAME##_offset);         \
+  HOLDER = NAME##_raw;
+
+
+#define CACHE_READER_CHECK_LIST_COUNT(TYPE, ENTRY, NAME)                    \
+  /* The count is read from the file, so the entries must fit in the */    \
+  /* section. */                                                            \
+  if (mpHeader->NAME##_size < sizeof(TYPE) ||                               \
+      (mpHeader->NAME##_size - sizeof(TYPE)) / sizeof(ENTRY) <              \
+        NAME##_raw->count) {                                                \
+    LOGE(#NAME " entries overflow the section.\n");                         \
     return false;                                                           \
   }
 
@@ -244,12 +299,30 @@ bool MCCacheReader::readStringPool() {
   CACHE_READER_READ_SECTION(OBCC_StringPool,
                             mpResult->mpStringPoolRaw, str_pool);
 
-  char *str_base = reinterpret_cast<char *>(str_pool_raw);
+  char const *str_base = reinterpret_cast<char const *>(str_pool_raw);
+  size_t str_pool_size = mpHeader->str_pool_size;
+
+  if (str_pool_size < sizeof(OBCC_StringPool) ||
+      (str_pool_size - sizeof(OBCC_StringPool)) / sizeof(OBCC_String) <
+      str_pool_raw->count) {
+    LOGE("String pool entries overflow the section.\n");
+    return false;
+  }
 
   vector<char const *> &pool = mpResult->mStringPool;
+  pool.reserve(str_pool_raw->count);
   for (size_t i = 0; i < str_pool_raw->count; ++i) {
-    char *str = str_base + str_pool_raw->list[i].offset;
-    pool.push_back(str);
+    OBCC_String const &entry = str_pool_raw->list[i];
+
+    // The strings are used in place, so they must stay in the section.
+    if (entry.offset < 0 || (size_t)entry.offset >= str_pool_size ||
+        entry.length >= str_pool_size - (size_t)entry.offset) {
+      LOGE("The %lu-th string overflows the string pool.\n",
+           (unsigned long)i);
+      return false;
+    }
+
+    pool.push_back(str_base + entry.offset);
   }
 
   return true;
@@ -273,8 +346,23 @@ bool MCCacheReader::checkStringPool() {
 
 
 bool MCCacheReader::readDependencyTable() {
-  CACHE_READER_READ_SECTION(OBCC_DependencyTable, mpCachedDependTable,
+  CACHE_READER_READ_SECTION(OBCC_DependencyTable const, mpCachedDependTable,
                             depend_tab);
+  CACHE_READER_CHECK_LIST_COUNT(OBCC_DependencyTable, OBCC_Dependency,
+                                depend_tab);
+  return true;
+}
+
+
+bool MCCacheReader::checkDependencyDigest() {
+  unsigned char digest[20];
+  calcDependencyDigest(digest, mDependencies);
+
+  if (memcmp(digest, mpHeader->depend_digest, sizeof(digest)) != 0) {
+    LOGI("Cache file dependency digest mismatch.\n");
+    return false;
+  }
+
   return true;
 }
 
@@ -296,8 +384,13 @@ bool MCCacheReader::checkDependency() {
     uint32_t depType = dep->second.first;
     unsigned char const *depSHA1 = dep->second.second;
 
-    OBCC_Dependency *depCached =&mpCachedDependTable->table[i];
-    char const *depCachedName = strPool[depCached->res_name_strp_index];
+    OBCC_Dependency const *depCached = &mpCachedDependTable->table[i];
+    char const *depCachedName =
+      getPoolString(strPool, depCached->res_name_strp_index);
+    if (!depCachedName) {
+      LOGE("Cache dependency name is out of the string pool.\n");
+      return false;
+    }
     uint32_t depCachedType = depCached->res_type;
     unsigned char const *depCachedSHA1 = depCached->sha1;
 
@@ -336,7 +429,10 @@ bool MCCacheReader::checkDependency() {
 }
 
 bool MCCacheReader::readVarNameList() {
-  CACHE_READER_READ_SECTION(OBCC_String_Ptr, mpVarNameList, export_var_name_list);
+  CACHE_READER_READ_SECTION(OBCC_String_Ptr const, mpVarNameList,
+                            export_var_name_list);
+  CACHE_READER_CHECK_LIST_COUNT(OBCC_String_Ptr, size_t,
+                                export_var_name_list);
   vector<char const *> const &strPool = mpResult->mStringPool;
 
   mpResult->mpExportVars = (OBCC_ExportVarList*)
@@ -349,18 +445,29 @@ bool MCCacheReader::readVarNameList() {
   mpResult->mpExportVars->count = export_var_name_list_raw->count;
 
   for (size_t i = 0; i < export_var_name_list_raw->count; ++i) {
+    char const *name =
+      getPoolString(strPool, export_var_name_list_raw->strp_indexs[i]);
+    if (!name) {
+      LOGE("The %lu-th exported variable name is out of the string pool.\n",
+           (unsigned long)i);
+      return false;
+    }
+
     mpResult->mpExportVars->cached_addr_list[i] =
-      rsloaderGetSymbolAddress(mpResult->mRSExecutable, strPool[export_var_name_list_raw->strp_indexs[i]]);
+      rsloaderGetSymbolAddress(mpResult->mRSExecutable, name);
 #if DEBUG_MCJIT_REFLECT
     LOGD("Get symbol address: %s -> %p",
-      strPool[export_var_name_list_raw->strp_indexs[i]], mpResult->mpExportVars->cached_addr_list[i]);
+      name, mpResult->mpExportVars->cached_addr_list[i]);
 #endif
   }
   return true;
 }
 
 bool MCCacheReader::readFuncNameList() {
-  CACHE_READER_READ_SECTION(OBCC_String_Ptr, mpFuncNameList, export_func_name_list);
+  CACHE_READER_READ_SECTION(OBCC_String_Ptr const, mpFuncNameList,
+                            export_func_name_list);
+  CACHE_READER_CHECK_LIST_COUNT(OBCC_String_Ptr, size_t,
+                                export_func_name_list);
   vector<char const *> const &strPool = mpResult->mStringPool;
 
   mpResult->mpExportFuncs = (OBCC_ExportFuncList*)
@@ -373,26 +480,42 @@ bool MCCacheReader::readFuncNameList() {
   mpResult->mpExportFuncs->count = export_func_name_list_raw->count;
 
   for (size_t i = 0; i < export_func_name_list_raw->count; ++i) {
+    char const *name =
+      getPoolString(strPool, export_func_name_list_raw->strp_indexs[i]);
+    if (!name) {
+      LOGE("The %lu-th exported function name is out of the string pool.\n",
+           (unsigned long)i);
+      return false;
+    }
+
     mpResult->mpExportFuncs->cached_addr_list[i] =
-      rsloaderGetSymbolAddress(mpResult->mRSExecutable, strPool[export_func_name_list_raw->strp_indexs[i]]);
+      rsloaderGetSymbolAddress(mpResult->mRSExecutable, name);
 #if DEBUG_MCJIT_REFLECT
     LOGD("Get function address: %s -> %p",
-      strPool[export_func_name_list_raw->strp_indexs[i]], mpResult->mpExportFuncs->cached_addr_list[i]);
+      name, mpResult->mpExportFuncs->cached_addr_list[i]);
 #endif
   }
   return true;
 }
 
 bool MCCacheReader::readPragmaList() {
-  CACHE_READER_READ_SECTION(OBCC_PragmaList, mpPragmaList, pragma_list);
+  CACHE_READER_READ_SECTION(OBCC_PragmaList const, mpPragmaList, pragma_list);
+  CACHE_READER_CHECK_LIST_COUNT(OBCC_PragmaList, OBCC_Pragma, pragma_list);
 
   vector<char const *> const &strPool = mpResult->mStringPool;
   ScriptCached::PragmaList &pragmas = mpResult->mPragmas;
 
   for (size_t i = 0; i < pragma_list_raw->count; ++i) {
-    OBCC_Pragma *pragma = &pragma_list_raw->list[i];
-    pragmas.push_back(make_pair(strPool[pragma->key_strp_index],
-                                strPool[pragma->value_strp_index]));
+    OBCC_Pragma const *pragma = &pragma_list_raw->list[i];
+    char const *key = getPoolString(strPool, pragma->key_strp_index);
+    char const *value = getPoolString(strPool, pragma->value_strp_index);
+    if (!key || !value) {
+      LOGE("The %lu-th pragma is out of the string pool.\n",
+           (unsigned long)i);
+      return false;
+    }
+
+    pragmas.push_back(make_pair(key, value));
   }
 
   return true;
@@ -402,6 +525,8 @@ bool MCCacheReader::readPragmaList() {
 bool MCCacheReader::readObjectSlotList() {
   CACHE_READER_READ_SECTION(OBCC_ObjectSlotList,
                             mpResult->mpObjectSlotList, object_slot_list);
+  CACHE_READER_CHECK_LIST_COUNT(OBCC_ObjectSlotList, uint32_t,
+                                object_slot_list);
   return true;
 }
 
@@ -412,6 +537,12 @@ void *MCCacheReader::resolveSymbolAdapter(void *context, char const *name) {
     return Addr;
   }
 
+  if (self->mpLibraryObject) {
+    if (void *Addr = self->mpLibraryObject->lookup(name)) {
+      return Addr;
+    }
+  }
+
   if (self->mpSymbolLookupFn) {
     if (void *Addr =
         self->mpSymbolLookupFn(self->mpSymbolLookupContext, name)) {
@@ -424,25 +555,27 @@ void *MCCacheReader::resolveSymbolAdapter(void *context, char const *name) {
 }
 
 bool MCCacheReader::readObjFile() {
-  llvm::SmallVector<char, 1024> mEmittedELFExecutable;
-  char readBuffer[1024];
-  int readSize;
-  while ((readSize = mObjFile->read(readBuffer, 1024)) > 0) {
-    mEmittedELFExecutable.append(readBuffer, readBuffer + readSize);
-  }
-  if (readSize != 0) {
-    LOGE("Read file Error");
+  // The ELF object is used in place from the mapping of the cache file.  The
+  // loader copies the sections into its own executable memory.
+  unsigned char const *obj =
+    reinterpret_cast<unsigned char const *>(mpFileMap + mpHeader->obj_offset);
+
+  LOGD("Read object file size %d", (int)mpHeader->obj_size);
+
+  mpResult->mRSExecutable =
+    rsloaderCreateExec(const_cast<unsigned char *>(obj), mpHeader->obj_size,
+                       &resolveSymbolAdapter, this);
+
+  if (!mpResult->mRSExecutable) {
+    LOGE("Unable to load the cached object file.\n");
     return false;
   }
-  LOGD("Read object file size %d", (int)mEmittedELFExecutable.size());
-  mpResult->mRSExecutable =
-  rsloaderCreateExec((unsigned char *)&*mEmittedELFExecutable.begin(),
-                     mEmittedELFExecutable.size(),
-                     &resolveSymbolAdapter, this);
+
   return true;
 }
 
 #undef CACHE_READER_READ_SECTION
+#undef CACHE_READER_CHECK_LIST_COUNT
 
 bool MCCacheReader::readRelocationTable() {
   // TODO(logan): Not finished.
@@ -32,20 +32,25 @@ struct MCO_Header;
 
 namespace bcc {
   class FileHandle;
+  class LibraryObject;
   class Script;
 
   class MCCacheReader {
   private:
-    FileHandle *mObjFile, *mInfoFile;
-    off_t mInfoFileSize;
+    FileHandle *mFile;
+    off_t mFileSize;
 
-    MCO_Header *mpHeader;
-    OBCC_DependencyTable *mpCachedDependTable;
-    OBCC_PragmaList *mpPragmaList;
-    OBCC_FuncTable *mpFuncTable;
+    // Note: The sections below point into the read-only mapping of the cache
+    // file, which is owned by mpResult (see ScriptCached::mpCacheMap).
+    char const *mpFileMap;
 
-    OBCC_String_Ptr *mpVarNameList;
-    OBCC_String_Ptr *mpFuncNameList;
+    MCO_Header const *mpHeader;
+    OBCC_DependencyTable const *mpCachedDependTable;
+    OBCC_PragmaList const *mpPragmaList;
+    OBCC_FuncTable const *mpFuncTable;
+
+    OBCC_String_Ptr const *mpVarNameList;
+    OBCC_String_Ptr const *mpFuncNameList;
 
     llvm::OwningPtr<ScriptCached> mpResult;
 
@@ -57,12 +62,16 @@ namespace bcc {
     BCCSymbolLookupFn mpSymbolLookupFn;
     void *mpSymbolLookupContext;
 
+    // The library object the cached code refers to (see BCC_SHARED_LIBRARY)
+    LibraryObject const *mpLibraryObject;
+
   public:
     MCCacheReader()
-      : mObjFile(NULL), mInfoFile(NULL), mInfoFileSize(0), mpHeader(NULL),
-        mpCachedDependTable(NULL), mpPragmaList(NULL),
+      : mFile(NULL), mFileSize(0), mpFileMap(NULL),
+        mpHeader(NULL), mpCachedDependTable(NULL), mpPragmaList(NULL),
         mpVarNameList(NULL), mpFuncNameList(NULL),
-        mIsContextSlotNotAvail(false) {
+        mIsContextSlotNotAvail(false), mpSymbolLookupFn(NULL),
+        mpSymbolLookupContext(NULL), mpLibraryObject(NULL) {
     }
 
     ~MCCacheReader();
@@ -74,8 +83,12 @@ namespace bcc {
                            std::make_pair((uint32_t)resType, sha1)));
     }
 
-    ScriptCached *readCacheFile(FileHandle *objFile, FileHandle *infoFile, Script *s);
-    bool checkCacheFile(FileHandle *objFile, FileHandle *infoFile, Script *S);
+    ScriptCached *readCacheFile(FileHandle *file, Script *s);
+    bool checkCacheFile(FileHandle *file, Script *S);
+
+    // Validate the cache file with its header alone (one pread() of
+    // MCO_Header), without mapping the file or allocating ScriptCached.
+    bool checkCacheHeader(FileHandle *file);
 
     bool isContextSlotNotAvail() const {
       return mIsContextSlotNotAvail;
@@ -86,7 +99,12 @@ namespace bcc {
       mpSymbolLookupContext = pContext;
     }
 
+    void setLibraryObject(LibraryObject const *object) {
+      mpLibraryObject = object;
+    }
+
   private:
+    bool mapFile();
     bool readHeader();
     bool readStringPool();
     bool readDependencyTable();
@@ -103,6 +121,7 @@ namespace bcc {
     bool checkMachineIntType();
     bool checkSectionOffsetAndSize();
     bool checkStringPool();
+    bool checkDependencyDigest();
     bool checkDependency();
     bool checkContext();
 
@@ -18,7 +18,9 @@
 
 #include "DebugHelper.h"
 #include "FileHandle.h"
+#include "ObjectBuffer.h"
 #include "Script.h"
+#include "Sha1Helper.h"
 
 #include <map>
 #include <string>
@@ -28,6 +30,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 using namespace std;
 
@@ -46,17 +49,22 @@ MCCacheWriter::~MCCacheWriter() {
   CHECK_AND_FREE(mpExportFuncNameListSection);
 
 #undef CHECK_AND_FREE
+
+  if (mpObject) {
+    mpObject->release();
+  }
 }
 
-bool MCCacheWriter::writeCacheFile(FileHandle *objFile, FileHandle *infoFile,
-                                 Script *S, uint32_t libRS_threadable) {
-  if (!objFile || objFile->getFD() < 0 || !infoFile || infoFile->getFD() < 0) {
+bool MCCacheWriter::prepareCacheFile(Script *S, uint32_t libRS_threadable) {
+  mpOwner = S;
+  mpObject = S->getObject();
+
+  if (!mpObject) {
+    LOGE("No object to write to the cache file.\n");
     return false;
   }
 
-  mObjFile = objFile;
-  mInfoFile = infoFile;
-  mpOwner = S;
+  mpObject->retain();
 
   bool result = prepareHeader(libRS_threadable)
              && prepareDependencyTable()
@@ -66,13 +74,29 @@ bool MCCacheWriter::writeCacheFile(FileHandle *objFile, FileHandle *infoFile,
              && prepareStringPool()
              && prepareObjectSlotList()
              && calcSectionOffset()
-             && writeAll()
              ;
 
   return result;
 }
 
 
+void MCCacheWriter::detach() {
+  // The object is retained already.
+  mpOwner = NULL;
+}
+
+
+bool MCCacheWriter::writeCacheFile(FileHandle *file) {
+  if (!file || file->getFD() < 0 || !mpHeaderSection) {
+    return false;
+  }
+
+  mFile = file;
+
+  return writeAll();
+}
+
+
 bool MCCacheWriter::prepareHeader(uint32_t libRS_threadable) {
   MCO_Header *header = (MCO_Header *)malloc(sizeof(MCO_Header));
 
@@ -87,8 +111,8 @@ bool MCCacheWriter::prepareHeader(uint32_t libRS_threadable) {
   memset(header, '\0', sizeof(MCO_Header));
 
   // Magic word and version
-  memcpy(header->magic, OBCC_MAGIC, 4);
-  memcpy(header->version, OBCC_VERSION, 4);
+  memcpy(header->magic, MCO_MAGIC, 4);
+  memcpy(header->version, MCO_VERSION, 4);
 
   // Machine Integer Type
   uint32_t number = 0x00000001;
@@ -119,6 +143,8 @@ bool MCCacheWriter::prepareDependencyTable() {
   mpDependencyTableSection = tab;
   mpHeaderSection->depend_tab_size = tableSize;
 
+  calcDependencyDigest(mpHeaderSection->depend_digest, mDependencies);
+
   tab->count = mDependencies.size();
 
   size_t i = 0;
@@ -311,6 +337,17 @@ bool MCCacheWriter::calcSectionOffset() {
 
 #undef OFFSET_INCREASE
 
+  // Place the ELF object after the metadata.  Align it to a page size, so
+  // that it can be mapped on its own as well.
+  size_t pagesize = (size_t)sysconf(_SC_PAGESIZE);
+  size_t rem = offset % pagesize;
+  if (rem > 0) {
+    offset += pagesize - rem;
+  }
+
+  mpHeaderSection->obj_offset = offset;
+  mpHeaderSection->obj_size = mpObject->size();
+
   return true;
 }
 
@@ -318,12 +355,12 @@ bool MCCacheWriter::calcSectionOffset() {
 bool MCCacheWriter::writeAll() {
 #define WRITE_SECTION(NAME, OFFSET, SIZE, SECTION)                          \
   do {                                                                      \
-    if (mInfoFile->seek(OFFSET, SEEK_SET) == -1) {                          \
+    if (mFile->seek(OFFSET, SEEK_SET) == -1) {                              \
       LOGE("Unable to seek to " #NAME " section for writing.\n");           \
       return false;                                                         \
     }                                                                       \
                                                                             \
-    if (mInfoFile->write(reinterpret_cast<char *>(SECTION), (SIZE)) !=      \
+    if (mFile->write(reinterpret_cast<char const *>(SECTION), (SIZE)) !=    \
         static_cast<ssize_t>(SIZE)) {                                       \
       LOGE("Unable to write " #NAME " section to cache file.\n");           \
       return false;                                                         \
@@ -346,16 +383,12 @@ bool MCCacheWriter::writeAll() {
   WRITE_SECTION_SIMPLE(export_var_name_list, mpExportVarNameListSection);
   WRITE_SECTION_SIMPLE(export_func_name_list, mpExportFuncNameListSection);
 
+  WRITE_SECTION(obj, mpHeaderSection->obj_offset, mpHeaderSection->obj_size,
+                mpObject->begin());
+
 #undef WRITE_SECTION_SIMPLE
 #undef WRITE_SECTION
 
-  if (static_cast<size_t>(mObjFile->write(mpOwner->getELF(),
-                                          mpOwner->getELFSize()))
-      != mpOwner->getELFSize()) {
-      LOGE("Unable to write ELF to cache file.\n");
-      return false;
-  }
-
   return true;
 }
 
@@ -27,13 +27,14 @@
 #include <vector>
 
 namespace bcc {
+  class ObjectBuffer;
   class Script;
 
   class MCCacheWriter {
   private:
     Script *mpOwner;
 
-    FileHandle *mObjFile, *mInfoFile;
+    FileHandle *mFile;
 
     std::vector<std::pair<char const *, size_t> > mStringPool;
 
@@ -52,17 +53,34 @@ namespace bcc {
     std::vector<std::string> varNameList;
     std::vector<std::string> funcNameList;
 
+    // The ELF object to write, retained from the script, so that it is
+    // shared rather than copied.
+    ObjectBuffer *mpObject;
+
   public:
     MCCacheWriter()
-      : mpHeaderSection(NULL), mpStringPoolSection(NULL),
+      : mpOwner(NULL), mFile(NULL), mpHeaderSection(NULL), mpStringPoolSection(NULL),
         mpDependencyTableSection(NULL), mpPragmaListSection(NULL),
-        mpObjectSlotSection(NULL) {
+        mpObjectSlotSection(NULL), mpExportVarNameListSection(NULL),
+        mpExportFuncNameListSection(NULL), mpObject(NULL) {
     }
 
     ~MCCacheWriter();
 
-    bool writeCacheFile(FileHandle *objFile, FileHandle *infoFile,
-                        Script *S, uint32_t libRS_threadable);
+    bool writeCacheFile(FileHandle *file, Script *S,
+                        uint32_t libRS_threadable) {
+      return prepareCacheFile(S, libRS_threadable) && writeCacheFile(file);
+    }
+
+    // Build all sections of the cache file in memory.
+    bool prepareCacheFile(Script *S, uint32_t libRS_threadable);
+
+    // Drop the script, so that the prepared cache file can be written after
+    // the script is gone.  (The ELF object is retained, not copied.)
+    void detach();
+
+    // Write the prepared cache file.
+    bool writeCacheFile(FileHandle *file);
 
     void addDependency(OBCC_ResourceType resType,
                        std::string const &resName,
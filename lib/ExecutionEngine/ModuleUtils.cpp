@@ -0,0 +1,120 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ModuleUtils.h"
+
+#include "llvm/Constants.h"
+#include "llvm/Function.h"
+#include "llvm/GlobalVariable.h"
+#include "llvm/Module.h"
+
+#include <vector>
+
+namespace bcc {
+
+char const SlotSuffix[] = ".bcc.slot";
+
+
+bool canCompileApart(llvm::Module const *M) {
+  if (!M->alias_empty()) {
+    return false;
+  }
+
+  for (llvm::Module::const_global_iterator
+       I = M->global_begin(), E = M->global_end(); I != E; ++I) {
+    if (I->isThreadLocal()) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+void promoteToHidden(llvm::GlobalValue *GV) {
+  if (!GV->hasName()) {
+    // The symbol table makes the name unique.
+    GV->setName("__bcc_local");
+  }
+
+  GV->setLinkage(llvm::GlobalValue::ExternalLinkage);
+  GV->setVisibility(llvm::GlobalValue::HiddenVisibility);
+}
+
+
+void promoteLocalVariables(llvm::Module *M) {
+  for (llvm::Module::global_iterator
+       I = M->global_begin(), E = M->global_end(); I != E; ++I) {
+    if (I->hasLocalLinkage() && !I->getName().startswith("llvm.")) {
+      promoteToHidden(&*I);
+    }
+  }
+}
+
+
+void stripFunctions(llvm::Module *M, llvm::Function const *keep) {
+  for (llvm::Module::iterator I = M->begin(), E = M->end(); I != E; ++I) {
+    if (&*I != keep && !I->isDeclaration()) {
+      I->deleteBody();
+    }
+  }
+}
+
+
+void stripGlobals(llvm::Module *M, bool keepVariables) {
+  std::vector<llvm::GlobalVariable *> intrinsicGlobals;
+
+  for (llvm::Module::global_iterator
+       I = M->global_begin(), E = M->global_end(); I != E; ++I) {
+    if (I->getName().startswith("llvm.")) {
+      intrinsicGlobals.push_back(&*I);
+    } else if (!keepVariables && I->hasInitializer()) {
+      I->setInitializer(NULL);
+      I->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+
+  for (size_t i = 0; i < intrinsicGlobals.size(); ++i) {
+    intrinsicGlobals[i]->eraseFromParent();
+  }
+
+  M->setModuleInlineAsm("");
+}
+
+
+llvm::GlobalVariable *createSlot(llvm::Module *M, std::string const &name,
+                                 llvm::Constant *init) {
+  llvm::GlobalVariable *Slot =
+    new llvm::GlobalVariable(*M, init->getType(), /* isConstant= */ false,
+                             llvm::GlobalValue::ExternalLinkage, init,
+                             name + SlotSuffix);
+  Slot->setVisibility(llvm::GlobalValue::HiddenVisibility);
+  return Slot;
+}
+
+
+void * volatile *getSlot(RSExecRef script, std::string const &name) {
+  return static_cast<void * volatile *>(
+    rsloaderGetSymbolAddress(script, (name + SlotSuffix).c_str()));
+}
+
+
+void setSlot(void * volatile *slot, void *code) {
+  __sync_synchronize();
+  *slot = code;
+}
+
+} // namespace bcc
@@ -0,0 +1,72 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_MODULEUTILS_H
+#define BCC_MODULEUTILS_H
+
+#include "librsloader.h"
+
+#include <string>
+
+namespace llvm {
+  class Constant;
+  class Function;
+  class GlobalValue;
+  class GlobalVariable;
+  class Module;
+}
+
+// Helpers for the code of a script compiled apart from the rest of it: the
+// functions compiled on their first call (LazyCompiler), the optimized code
+// (TierUpCompiler), and the partitions (ParallelCodeGen).
+namespace bcc {
+  // The suffix of the slot "<name>.bcc.slot" (see createSlot())
+  extern char const SlotSuffix[];
+
+  // Return false if the functions of M can't be compiled apart: an alias
+  // can't be turned into a declaration, and each thread has its own
+  // thread-local variables.
+  bool canCompileApart(llvm::Module const *M);
+
+  // Give GV a hidden external symbol, so that the code compiled apart can
+  // refer to it.
+  void promoteToHidden(llvm::GlobalValue *GV);
+
+  // Promote the local variables of M, except the llvm.* ones.
+  void promoteLocalVariables(llvm::Module *M);
+
+  // Delete the bodies of the functions of M, except keep (if any).
+  void stripFunctions(llvm::Module *M, llvm::Function const *keep);
+
+  // Remove the llvm.* variables (e.g. llvm.used and llvm.global_ctors) and
+  // the inline asm of M, which belong to the module with the rest of the
+  // script.  The other variables become declarations unless keepVariables.
+  void stripGlobals(llvm::Module *M, bool keepVariables);
+
+  // Add the slot "<name>.bcc.slot", which holds the code the function name
+  // calls through.  The slot is filled by another thread (see setSlot()).
+  llvm::GlobalVariable *createSlot(llvm::Module *M, std::string const &name,
+                                   llvm::Constant *init);
+
+  // Return the address of the slot of the function name in script, or NULL.
+  void * volatile *getSlot(RSExecRef script, std::string const &name);
+
+  // Make the other threads call code through slot, once they see code (and
+  // the data it refers to.)
+  void setSlot(void * volatile *slot, void *code);
+}
+
+#endif // BCC_MODULEUTILS_H
@@ -0,0 +1,112 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ObjectBuffer.h"
+
+#include "Config.h"
+
+#include <vector>
+
+#include <pthread.h>
+
+namespace {
+
+// The idle buffers, and their total capacity
+std::vector<bcc::ObjectBuffer *> IdleBuffers;
+size_t IdleSize = 0;
+
+pthread_mutex_t PoolLock = PTHREAD_MUTEX_INITIALIZER;
+
+} // namespace anonymous
+
+namespace bcc {
+
+ObjectBuffer *ObjectBuffer::acquire(size_t sizeHint) {
+  ObjectBuffer *buffer = NULL;
+
+  pthread_mutex_lock(&PoolLock);
+
+  // The smallest buffer large enough, or else the largest one
+  size_t best = IdleBuffers.size();
+  for (size_t i = 0; i < IdleBuffers.size(); ++i) {
+    size_t capacity = IdleBuffers[i]->mData.capacity();
+
+    if (best == IdleBuffers.size()) {
+      best = i;
+      continue;
+    }
+
+    size_t bestCapacity = IdleBuffers[best]->mData.capacity();
+    if (bestCapacity >= sizeHint) {
+      if (capacity >= sizeHint && capacity < bestCapacity) {
+        best = i;
+      }
+    } else if (capacity > bestCapacity) {
+      best = i;
+    }
+  }
+
+  if (best < IdleBuffers.size()) {
+    buffer = IdleBuffers[best];
+    IdleBuffers.erase(IdleBuffers.begin() + best);
+    IdleSize -= buffer->mData.capacity();
+    buffer->mRefs = 1;
+  }
+
+  pthread_mutex_unlock(&PoolLock);
+
+  if (!buffer) {
+    buffer = new ObjectBuffer();
+  }
+
+  buffer->mData.reserve(sizeHint);
+  return buffer;
+}
+
+
+void ObjectBuffer::retain() {
+  pthread_mutex_lock(&PoolLock);
+  ++mRefs;
+  pthread_mutex_unlock(&PoolLock);
+}
+
+
+void ObjectBuffer::release() {
+  pthread_mutex_lock(&PoolLock);
+
+  if (--mRefs > 0) {
+    pthread_mutex_unlock(&PoolLock);
+    return;
+  }
+
+  mData.clear();
+
+  size_t capacity = mData.capacity();
+  bool keep = (IdleSize + capacity <= BCC_OBJECT_BUFFER_POOL_SIZE);
+
+  if (keep) {
+    IdleBuffers.push_back(this);
+    IdleSize += capacity;
+  }
+
+  pthread_mutex_unlock(&PoolLock);
+
+  if (!keep) {
+    delete this;
+  }
+}
+
+} // namespace bcc
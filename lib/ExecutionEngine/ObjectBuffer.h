@@ -0,0 +1,66 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_OBJECTBUFFER_H
+#define BCC_OBJECTBUFFER_H
+
+#include "llvm/ADT/SmallVector.h"
+
+#include <stddef.h>
+
+namespace bcc {
+
+  // The ELF object of a script, emitted once and shared (without a copy) by
+  // the loader and the cache writer, which may still be writing it after the
+  // script is gone.  The buffer is reference counted; once the last user
+  // releases it, it goes back to a pool with its capacity, so the object of
+  // the next compilation is emitted without growing the buffer.
+  class ObjectBuffer {
+  private:
+    llvm::SmallVector<char, 1024> mData;
+
+    // Guarded by the lock of the pool
+    unsigned mRefs;
+
+    ObjectBuffer() : mRefs(1) {
+    }
+
+  public:
+    // An empty buffer with room for sizeHint bytes, referenced once.
+    static ObjectBuffer *acquire(size_t sizeHint);
+
+    void retain();
+
+    // Drop a reference; the buffer must not be used afterwards.
+    void release();
+
+    // To be filled before the buffer is shared
+    llvm::SmallVectorImpl<char> &getData() {
+      return mData;
+    }
+
+    char const *begin() const {
+      return mData.begin();
+    }
+
+    size_t size() const {
+      return mData.size();
+    }
+  };
+
+} // namespace bcc
+
+#endif // BCC_OBJECTBUFFER_H
@@ -0,0 +1,870 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ParallelCodeGen.h"
+
+#include "Compiler.h"
+#include "CompilerResourcePool.h"
+#include "Config.h"
+#include "DebugHelper.h"
+#include "ELFObjectMerger.h"
+#include "FileHandle.h"
+#include "ModuleUtils.h"
+#include "PipelineConfig.h"
+#include "Sha1Helper.h"
+
+#include "llvm/ADT/OwningPtr.h"
+
+#include "llvm/Bitcode/ReaderWriter.h"
+
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "llvm/Target/TargetData.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include "llvm/Function.h"
+#include "llvm/GlobalVariable.h"
+#include "llvm/LLVMContext.h"
+#include "llvm/Module.h"
+
+#include <dirent.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <set>
+#include <vector>
+
+#include <cutils/properties.h>
+
+namespace bcc {
+
+// The functions [mBegin, mEnd) (counting the defined functions only) of the
+// module in mBitcode.
+struct CodeGenPartition {
+  llvm::StringRef mBitcode;
+
+  // The bitcode of a partition of a CodeGenStream
+  llvm::SmallVector<char, 1024> mStreamedBitcode;
+  size_t mIndex;
+  size_t mBegin;
+  size_t mEnd;
+  size_t mNumFunctions;
+
+  bcc::PipelineConfig const *mConfig;
+
+  llvm::SmallVector<char, 1024> mObject;
+  std::string mError;
+
+  // The object file cache of ParallelCodeGen::emitIncremental(), or NULL.
+  // The partition is then a single unit: the global variables for the
+  // partition 0, or else the function mBegin.
+  std::string const *mCacheDir;
+  std::string const *mCacheKey;
+  bool mCacheFastHash;
+  std::string mCacheFile;
+  bool mCacheHit;
+
+  bool mDone;
+
+  CodeGenPartition()
+    : mCacheDir(NULL), mCacheKey(NULL), mCacheFastHash(false),
+      mCacheHit(false), mDone(false) {
+  }
+
+  void run();
+
+private:
+  bool strip(llvm::Module *M);
+
+#if USE_CACHE
+  bool extractUnit(llvm::Module *M);
+
+  void runCached();
+
+  bool readObject(std::string const &path);
+
+  void writeObject(std::string const &path);
+#endif
+};
+
+
+bool CodeGenPartition::strip(llvm::Module *M) {
+  size_t ordinal = 0;
+
+  for (llvm::Module::iterator I = M->begin(), E = M->end(); I != E; ++I) {
+    if (I->isDeclaration()) {
+      continue;
+    }
+
+    if (ordinal < mBegin || ordinal >= mEnd) {
+      I->deleteBody();
+    }
+    ++ordinal;
+  }
+
+  if (ordinal != mNumFunctions) {
+    mError = "Unexpected function list in the partitioned module";
+    return false;
+  }
+
+  // The first partition defines the global variables.
+  if (mIndex != 0) {
+    stripGlobals(M, /* keepVariables= */ false);
+  }
+
+  return true;
+}
+
+
+void CodeGenPartition::run() {
+#if USE_CACHE
+  if (mCacheDir) {
+    runCached();
+    return;
+  }
+#endif
+
+  bcc::CompilerResourcePool &pool = bcc::CompilerResourcePool::get();
+
+  bcc::PooledContext context;
+  pool.acquireContext(context);
+  llvm::TargetMachine *TM = NULL;
+  llvm::Module *M = NULL;
+
+  llvm::OwningPtr<llvm::MemoryBuffer> MEM(
+    llvm::MemoryBuffer::getMemBuffer(mBitcode, "", false));
+
+  M = llvm::ParseBitcodeFile(MEM.get(), *context.mContext, &mError);
+
+  if (M && strip(M)) {
+    TM = pool.acquireTargetMachine(mError);
+    if (TM) {
+      bcc::Compiler::emitMC(M, new llvm::TargetData(M), TM, *mConfig,
+                            mObject, mError);
+      pool.releaseTargetMachine(TM);
+    }
+  }
+
+  delete M;
+  pool.releaseContext(context);
+}
+
+
+#if USE_CACHE
+bool CodeGenPartition::extractUnit(llvm::Module *M) {
+  llvm::Function *unit = NULL;
+  size_t ordinal = 0;
+
+  // The bodies are not read, except the one of the unit.
+  for (llvm::Module::iterator I = M->begin(), E = M->end(); I != E; ++I) {
+    if (!I->isMaterializable()) {
+      continue;
+    }
+
+    if (mIndex != 0 && ordinal == mBegin) {
+      if (I->Materialize(&mError)) {
+        return false;
+      }
+      unit = &*I;
+    } else {
+      I->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+    ++ordinal;
+  }
+
+  if (ordinal != mNumFunctions || (mIndex != 0 && !unit)) {
+    mError = "Unexpected function list in the partitioned module";
+    return false;
+  }
+
+  if (mIndex != 0) {
+    stripGlobals(M, /* keepVariables= */ false);
+  }
+
+  // Drop what the unit doesn't refer to, so that its bitcode only changes
+  // with the unit and the signatures of what it uses.
+  for (llvm::Module::iterator I = M->begin(), E = M->end(); I != E; ) {
+    llvm::Function *F = &*I++;
+    F->removeDeadConstantUsers();
+    if (F != unit && F->use_empty()) {
+      F->eraseFromParent();
+    }
+  }
+
+  for (llvm::Module::global_iterator
+       I = M->global_begin(), E = M->global_end(); I != E; ) {
+    llvm::GlobalVariable *GV = &*I++;
+    GV->removeDeadConstantUsers();
+    if (GV->isDeclaration() && GV->use_empty()) {
+      GV->eraseFromParent();
+    }
+  }
+
+  // e.g. the export lists of the script, which the code doesn't depend on
+  while (!M->named_metadata_empty()) {
+    M->eraseNamedMetadata(&*M->named_metadata_begin());
+  }
+
+  return true;
+}
+
+
+void CodeGenPartition::runCached() {
+  bcc::CompilerResourcePool &pool = bcc::CompilerResourcePool::get();
+
+  bcc::PooledContext context;
+  pool.acquireContext(context);
+
+  llvm::SmallVector<char, 1024> bitcode;
+
+  llvm::OwningPtr<llvm::MemoryBuffer> MEM(
+    llvm::MemoryBuffer::getMemBuffer(mBitcode, "", false));
+
+  llvm::Module *M =
+    llvm::getLazyBitcodeModule(MEM.get(), *context.mContext, &mError);
+
+  if (M) {
+    MEM.take();  // Owned by the materializer of the module
+
+    if (extractUnit(M)) {
+      llvm::raw_svector_ostream OS(bitcode);
+      llvm::WriteBitcodeToFile(M, OS);
+      OS.flush();
+    }
+
+    delete M;
+    M = NULL;
+  }
+
+  if (!bitcode.empty()) {
+    std::string data(*mCacheKey);
+    data.append(bitcode.begin(), bitcode.end());
+
+    unsigned char hash[20];
+    size_t hashSize = 20;
+    if (mCacheFastHash) {
+      bcc::calcFastHash(hash, data.data(), data.size());
+      hashSize = 16;
+    } else {
+      bcc::calcSHA1(hash, data.data(), data.size());
+    }
+
+    static char const hexDigits[] = "0123456789abcdef";
+    for (size_t i = 0; i < hashSize; ++i) {
+      mCacheFile.push_back(hexDigits[hash[i] >> 4]);
+      mCacheFile.push_back(hexDigits[hash[i] & 0xf]);
+    }
+    mCacheFile.append(".o");
+
+    mCacheHit = readObject(*mCacheDir + mCacheFile);
+  }
+
+  if (!bitcode.empty() && !mCacheHit) {
+    // The unit is compiled from its own bitcode, in which the bodies of
+    // the other functions are declarations.
+    llvm::OwningPtr<llvm::MemoryBuffer> UnitMEM(
+      llvm::MemoryBuffer::getMemBuffer(
+        llvm::StringRef(bitcode.begin(), bitcode.size()), "", false));
+
+    M = llvm::ParseBitcodeFile(UnitMEM.get(), *context.mContext, &mError);
+
+    if (M) {
+      llvm::TargetMachine *TM = pool.acquireTargetMachine(mError);
+      if (TM) {
+        if (bcc::Compiler::emitMC(M, new llvm::TargetData(M), TM, *mConfig,
+                                  mObject, mError)) {
+          writeObject(*mCacheDir + mCacheFile);
+        }
+        pool.releaseTargetMachine(TM);
+      }
+    }
+
+    delete M;
+  }
+
+  pool.releaseContext(context);
+}
+
+
+bool CodeGenPartition::readObject(std::string const &path) {
+  bcc::FileHandle file;
+  if (file.open(path.c_str(), bcc::OpenMode::ReadUnlocked) < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(file.getFD(), &st) < 0 || st.st_size <= 0) {
+    return false;
+  }
+
+  mObject.resize(st.st_size);
+  if (file.read(mObject.begin(), st.st_size) != (ssize_t)st.st_size) {
+    LOGW("Unable to read the cached object %s\n", path.c_str());
+    mObject.clear();
+    return false;
+  }
+
+  return true;
+}
+
+
+void CodeGenPartition::writeObject(std::string const &path) {
+  // The cache is only an optimization: the failures are not errors.
+  bcc::FileHandle file;
+  if (file.createTemporary(path.c_str()) < 0) {
+    return;
+  }
+
+  if (file.write(mObject.begin(), mObject.size()) !=
+        (ssize_t)mObject.size() ||
+      !file.publish(path.c_str())) {
+    LOGW("Unable to write the cached object %s\n", path.c_str());
+  }
+}
+#endif // USE_CACHE
+
+} // namespace bcc
+
+namespace {
+
+using bcc::CodeGenPartition;
+
+// The threads running the partitions.  They are started on demand and kept
+// for the later compilations, together with their CompilerResourcePools.
+class CodeGenWorkerPool {
+private:
+  static CodeGenWorkerPool TheCodeGenWorkerPool;
+
+  pthread_mutex_t mLock;
+  pthread_cond_t mJobAvailable;
+  pthread_cond_t mJobDone;
+
+  std::deque<CodeGenPartition *> mQueue;
+  size_t mNumThreads;
+
+  CodeGenWorkerPool() : mNumThreads(0) {
+    pthread_mutex_init(&mLock, NULL);
+    pthread_cond_init(&mJobAvailable, NULL);
+    pthread_cond_init(&mJobDone, NULL);
+  }
+
+public:
+  static CodeGenWorkerPool &get() {
+    return TheCodeGenWorkerPool;
+  }
+
+  // Run the jobs on the worker threads and the calling thread, and return
+  // when all of them are done.
+  void run(std::vector<CodeGenPartition *> const &jobs);
+
+  // Queue the job for the worker threads, of which numThreads are started
+  // if they are not running yet.
+  void submit(CodeGenPartition *job, size_t numThreads);
+
+  // Run the queued jobs on the calling thread as well, and return when all
+  // of jobs are done.
+  void wait(std::vector<CodeGenPartition *> const &jobs);
+
+private:
+  static void *threadMain(void *arg);
+
+  // Start the worker threads up to numThreads.  Called with mLock held.
+  void startThreads(size_t numThreads);
+
+  // Run one job from the queue.  Called with mLock held.
+  void runJob();
+};
+
+
+CodeGenWorkerPool CodeGenWorkerPool::TheCodeGenWorkerPool;
+
+
+void CodeGenWorkerPool::run(std::vector<CodeGenPartition *> const &jobs) {
+  pthread_mutex_lock(&mLock);
+
+  // The calling thread takes a job as well.
+  startThreads(jobs.size() - 1);
+
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    jobs[i]->mDone = false;
+    mQueue.push_back(jobs[i]);
+  }
+  pthread_cond_broadcast(&mJobAvailable);
+
+  pthread_mutex_unlock(&mLock);
+
+  wait(jobs);
+}
+
+
+void CodeGenWorkerPool::submit(CodeGenPartition *job, size_t numThreads) {
+  pthread_mutex_lock(&mLock);
+
+  startThreads(numThreads);
+
+  job->mDone = false;
+  mQueue.push_back(job);
+  pthread_cond_signal(&mJobAvailable);
+
+  pthread_mutex_unlock(&mLock);
+}
+
+
+void CodeGenWorkerPool::wait(std::vector<CodeGenPartition *> const &jobs) {
+  pthread_mutex_lock(&mLock);
+
+  while (!mQueue.empty()) {
+    runJob();
+  }
+
+  for (size_t i = 0; i < jobs.size(); ++i) {
+    while (!jobs[i]->mDone) {
+      pthread_cond_wait(&mJobDone, &mLock);
+    }
+  }
+
+  pthread_mutex_unlock(&mLock);
+}
+
+
+void CodeGenWorkerPool::startThreads(size_t numThreads) {
+  while (mNumThreads < numThreads) {
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    bool started = (pthread_create(&thread, &attr, threadMain, this) == 0);
+    pthread_attr_destroy(&attr);
+
+    if (!started) {
+      LOGW("Unable to start a codegen worker thread (%lu running).\n",
+           (unsigned long)mNumThreads);
+      break;
+    }
+
+    ++mNumThreads;
+  }
+}
+
+
+void CodeGenWorkerPool::runJob() {
+  CodeGenPartition *job = mQueue.front();
+  mQueue.pop_front();
+
+  pthread_mutex_unlock(&mLock);
+  job->run();
+  pthread_mutex_lock(&mLock);
+
+  job->mDone = true;
+  pthread_cond_broadcast(&mJobDone);
+}
+
+
+void *CodeGenWorkerPool::threadMain(void *arg) {
+  CodeGenWorkerPool *pool = static_cast<CodeGenWorkerPool *>(arg);
+
+  pthread_mutex_lock(&pool->mLock);
+  while (true) {
+    while (pool->mQueue.empty()) {
+      pthread_cond_wait(&pool->mJobAvailable, &pool->mLock);
+    }
+    pool->runJob();
+  }
+
+  // Never reached
+  return NULL;
+}
+
+
+unsigned getThreadCount() {
+  char buf[PROPERTY_VALUE_MAX];
+  property_get("debug.bcc.codegenthreads", buf, "");
+
+  if (buf[0] != '\0') {
+    char *end;
+    unsigned long count = strtoul(buf, &end, 10);
+    if (*end == '\0') {
+      return (count > 0) ? count : 1;
+    }
+  }
+
+  long numCPUs = sysconf(_SC_NPROCESSORS_ONLN);
+  if (numCPUs < 1) {
+    return 1;
+  }
+
+  return std::min<unsigned long>(numCPUs, BCC_CODEGEN_MAX_THREADS);
+}
+
+
+size_t getFunctionSize(llvm::Function const &F) {
+  size_t size = 0;
+  for (llvm::Function::const_iterator I = F.begin(), E = F.end();
+       I != E; ++I) {
+    size += I->size();
+  }
+  return size;
+}
+
+
+// Promote the local symbols of M, which may be referred to from the other
+// partitions, and return the total size of the defined functions (whose
+// sizes are appended to sizes.)
+size_t promoteLocals(llvm::Module *M, std::vector<size_t> &sizes) {
+  size_t totalSize = 0;
+
+  for (llvm::Module::iterator I = M->begin(), E = M->end(); I != E; ++I) {
+    if (!I->isDeclaration()) {
+      if (I->hasLocalLinkage()) {
+        bcc::promoteToHidden(&*I);
+      }
+      sizes.push_back(getFunctionSize(*I));
+      totalSize += sizes.back();
+    }
+  }
+
+  bcc::promoteLocalVariables(M);
+
+  return totalSize;
+}
+
+
+void writeBitcode(llvm::Module *M, llvm::SmallVectorImpl<char> &bitcode) {
+  llvm::raw_svector_ostream OS(bitcode);
+  llvm::WriteBitcodeToFile(M, OS);
+  OS.flush();
+}
+
+
+bool mergePartitions(std::vector<CodeGenPartition *> const &partitions,
+                     llvm::SmallVectorImpl<char> &result,
+                     std::string &error) {
+  bcc::ELFObjectMerger merger;
+
+  for (size_t i = 0; i < partitions.size(); ++i) {
+    CodeGenPartition const &P = *partitions[i];
+
+    if (!P.mError.empty()) {
+      error = P.mError;
+      return false;
+    }
+
+    merger.addObject(P.mObject.begin(), P.mObject.size());
+  }
+
+  std::vector<char> object;
+  if (!merger.merge(object, error)) {
+    return false;
+  }
+
+  result.clear();
+  result.append(object.begin(), object.end());
+
+  LOGV("Generated code in %lu partitions (%lu bytes)\n",
+       (unsigned long)partitions.size(), (unsigned long)object.size());
+  return true;
+}
+
+
+#if USE_CACHE
+// Remove the objects in dir (the files named <hash>.o, by the fast hash or
+// the SHA-1) not in used.
+void pruneObjectCache(std::string const &dir,
+                      std::set<std::string> const &used) {
+  DIR *entries = opendir(dir.c_str());
+  if (!entries) {
+    return;
+  }
+
+  while (struct dirent *entry = readdir(entries)) {
+    std::string name(entry->d_name);
+    size_t hexSize = name.size() - 2;
+
+    if ((name.size() != 34 && name.size() != 42) ||
+        name.compare(hexSize, 2, ".o") != 0 ||
+        name.find_first_not_of("0123456789abcdef") != hexSize ||
+        used.count(name)) {
+      continue;
+    }
+
+    if (unlink((dir + name).c_str()) != 0) {
+      LOGW("Unable to remove the stale object %s%s\n",
+           dir.c_str(), name.c_str());
+    }
+  }
+
+  closedir(entries);
+}
+#endif
+
+} // namespace anonymous
+
+namespace bcc {
+
+bool ParallelCodeGen::canPartition(llvm::Module const *M) {
+  // An alias must be defined with its aliasee, and the debug information
+  // can't be split.  Don't bother with them.
+  return M->alias_empty() &&
+         !M->getNamedMetadata("llvm.dbg.cu") &&
+         !M->getNamedMetadata("llvm.dbg.sp");
+}
+
+
+unsigned ParallelCodeGen::getPartitionCount(llvm::Module const *M) {
+  if (!canPartition(M)) {
+    return 1;
+  }
+
+  size_t numFunctions = 0;
+  size_t size = 0;
+
+  for (llvm::Module::const_iterator I = M->begin(), E = M->end();
+       I != E; ++I) {
+    if (!I->isDeclaration()) {
+      ++numFunctions;
+      size += getFunctionSize(*I);
+    }
+  }
+
+  size_t count = std::min<size_t>(getThreadCount(), numFunctions);
+  count = std::min<size_t>(count, size / BCC_CODEGEN_MIN_PARTITION_SIZE);
+
+  return (count > 1) ? count : 1;
+}
+
+
+bool ParallelCodeGen::emit(llvm::Module *M,
+                           unsigned numPartitions,
+                           PipelineConfig const &config,
+                           llvm::SmallVectorImpl<char> &result,
+                           std::string &error) {
+  // Partition the functions by size, keeping the module order (the
+  // functions of a script are usually grouped by their callers.)
+  std::vector<size_t> sizes;
+  size_t totalSize = promoteLocals(M, sizes);
+
+  if (numPartitions > sizes.size()) {
+    numPartitions = sizes.size();
+  }
+
+  if (numPartitions == 0) {
+    error = "No function to generate code for";
+    return false;
+  }
+
+  llvm::SmallVector<char, 1024> bitcode;
+  writeBitcode(M, bitcode);
+
+  std::vector<CodeGenPartition> partitions(numPartitions);
+  std::vector<CodeGenPartition *> jobs;
+
+  size_t begin = 0;
+  size_t accumulated = 0;
+
+  for (unsigned i = 0; i < numPartitions; ++i) {
+    size_t end = begin;
+    size_t limit = totalSize * (i + 1) / numPartitions;
+
+    // Leave at least a function for each of the remaining partitions.
+    size_t maxEnd = sizes.size() - (numPartitions - i - 1);
+
+    while (end < maxEnd && (end == begin || accumulated < limit ||
+                            i + 1 == numPartitions)) {
+      accumulated += sizes[end++];
+    }
+
+    CodeGenPartition &P = partitions[i];
+    P.mBitcode = llvm::StringRef(bitcode.begin(), bitcode.size());
+    P.mIndex = i;
+    P.mBegin = begin;
+    P.mEnd = end;
+    P.mNumFunctions = sizes.size();
+    P.mConfig = &config;
+    jobs.push_back(&P);
+
+    begin = end;
+  }
+
+  CodeGenWorkerPool::get().run(jobs);
+
+  return mergePartitions(jobs, result, error);
+}
+
+
+#if USE_CACHE
+bool ParallelCodeGen::emitIncremental(llvm::Module *M,
+                                      std::string const &cacheDir,
+                                      std::string const &key,
+                                      bool fastHash,
+                                      PipelineConfig const &config,
+                                      llvm::SmallVectorImpl<char> &result,
+                                      std::string &error) {
+  std::vector<size_t> sizes;
+  promoteLocals(M, sizes);
+
+  llvm::SmallVector<char, 1024> bitcode;
+  writeBitcode(M, bitcode);
+
+  // The global variables, and then a unit for each function
+  std::vector<CodeGenPartition> units(sizes.size() + 1);
+  std::vector<CodeGenPartition *> jobs;
+
+  // The calling thread takes the jobs as well.
+  size_t numThreads = getThreadCount() - 1;
+  CodeGenWorkerPool &pool = CodeGenWorkerPool::get();
+
+  for (size_t i = 0; i < units.size(); ++i) {
+    CodeGenPartition &P = units[i];
+    P.mBitcode = llvm::StringRef(bitcode.begin(), bitcode.size());
+    P.mIndex = i;
+    P.mBegin = (i > 0) ? i - 1 : 0;
+    P.mEnd = i;
+    P.mNumFunctions = sizes.size();
+    P.mConfig = &config;
+    P.mCacheDir = &cacheDir;
+    P.mCacheKey = &key;
+    P.mCacheFastHash = fastHash;
+    jobs.push_back(&P);
+
+    pool.submit(&P, numThreads);
+  }
+
+  pool.wait(jobs);
+
+  if (!mergePartitions(jobs, result, error)) {
+    return false;
+  }
+
+  std::set<std::string> used;
+  size_t numHits = 0;
+
+  for (size_t i = 0; i < units.size(); ++i) {
+    used.insert(units[i].mCacheFile);
+    if (units[i].mCacheHit) {
+      ++numHits;
+    }
+  }
+
+  LOGV("Reused the code of %lu of %lu units in %s\n",
+       (unsigned long)numHits, (unsigned long)units.size(),
+       cacheDir.c_str());
+
+  pruneObjectCache(cacheDir, used);
+  return true;
+}
+#endif
+
+
+bool ParallelCodeGen::canStream(llvm::Module const *M) {
+  // The bodies are generated on the workers while this thread reads the
+  // next ones.
+  return M->getMaterializer() != NULL &&
+         canPartition(M) &&
+         getThreadCount() > 1;
+}
+
+
+CodeGenStream::CodeGenStream(llvm::Module *M, PipelineConfig const &config)
+  : mModule(M), mConfig(config), mPendingSize(0),
+    mNumThreads(getThreadCount() - 1) {
+  for (llvm::Module::iterator I = M->begin(), E = M->end(); I != E; ++I) {
+    if (I->isDeclaration() && !I->isMaterializable()) {
+      continue;
+    }
+
+    // The body not read yet is a declaration in the bitcode of the
+    // partitions, which must have an external linkage.
+    if (I->hasLocalLinkage()) {
+      promoteToHidden(&*I);
+    } else {
+      I->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+
+  promoteLocalVariables(M);
+}
+
+
+CodeGenStream::~CodeGenStream() {
+  // The workers may still refer to the partitions after an error.
+  CodeGenWorkerPool::get().wait(mPartitions);
+
+  for (size_t i = 0; i < mPartitions.size(); ++i) {
+    delete mPartitions[i];
+  }
+}
+
+
+void CodeGenStream::add(llvm::Function *F) {
+  mPending.push_back(F);
+  mPendingSize += getFunctionSize(*F);
+
+  if (mPendingSize >= BCC_CODEGEN_STREAM_PARTITION_SIZE) {
+    submit();
+  }
+}
+
+
+void CodeGenStream::submit() {
+  CodeGenPartition *P = new CodeGenPartition();
+  writeBitcode(mModule, P->mStreamedBitcode);
+
+  P->mBitcode = llvm::StringRef(P->mStreamedBitcode.begin(),
+                                P->mStreamedBitcode.size());
+  P->mIndex = mPartitions.size();
+  P->mBegin = 0;
+  P->mEnd = mPending.size();
+  P->mNumFunctions = mPending.size();
+  P->mConfig = &mConfig;
+
+  // The partition has the bodies now.  (Those which can't be read again
+  // won't be needed again.)
+  for (size_t i = 0; i < mPending.size(); ++i) {
+    llvm::Function *F = mPending[i];
+    F->Dematerialize();
+    if (!F->isDeclaration()) {
+      F->deleteBody();
+    }
+  }
+
+  mPending.clear();
+  mPendingSize = 0;
+
+  mPartitions.push_back(P);
+  CodeGenWorkerPool::get().submit(P, mNumThreads);
+}
+
+
+bool CodeGenStream::finish(llvm::SmallVectorImpl<char> &result,
+                           std::string &error) {
+  // The first partition defines the global variables, even if there is no
+  // function.
+  if (!mPending.empty() || mPartitions.empty()) {
+    submit();
+  }
+
+  CodeGenWorkerPool::get().wait(mPartitions);
+
+  return mergePartitions(mPartitions, result, error);
+}
+
+} // namespace bcc
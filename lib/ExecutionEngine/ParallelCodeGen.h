@@ -0,0 +1,121 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_PARALLELCODEGEN_H
+#define BCC_PARALLELCODEGEN_H
+
+#include "Config.h"
+
+#include "llvm/ADT/SmallVector.h"
+
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class Function;
+  class Module;
+}
+
+namespace bcc {
+  class PipelineConfig;
+  struct CodeGenPartition;
+
+  // Generates the machine code of a module on the codegen worker threads
+  // (see BCC_PARALLEL_CODEGEN).
+  //
+  // The module is split into partitions of consecutive functions.  Each
+  // partition is compiled from a bitcode copy of the module, in its own
+  // LLVMContext, with the functions of the other partitions turned into
+  // declarations (the global variables are defined by the first partition
+  // only).  The objects are then merged by ELFObjectMerger.
+  class ParallelCodeGen {
+  public:
+    // Whether M can be split at all.
+    static bool canPartition(llvm::Module const *M);
+
+    // The number of partitions worth compiling M in, or 1 if the module
+    // should be compiled as a whole.
+    static unsigned getPartitionCount(llvm::Module const *M);
+
+    // Compile M into the ELF relocatable object result.  The symbols of
+    // local linkage in M are given hidden external linkage, since they may
+    // be referred to from other partitions.
+    static bool emit(llvm::Module *M,
+                     unsigned numPartitions,
+                     PipelineConfig const &config,
+                     llvm::SmallVectorImpl<char> &result,
+                     std::string &error);
+
+#if USE_CACHE
+    // Like emit(), but compile each function, and the global variables, on
+    // their own (see BCC_INCREMENTAL_COMPILE).  The bitcode of each of them,
+    // with the declarations it refers to, is hashed with key (by
+    // calcFastHash() if fastHash, or else calcSHA1()), and its object is
+    // read from the file <cacheDir><hash>.o if it exists, or else generated
+    // and written there.  The files not used by M are removed.
+    static bool emitIncremental(llvm::Module *M,
+                                std::string const &cacheDir,
+                                std::string const &key,
+                                bool fastHash,
+                                PipelineConfig const &config,
+                                llvm::SmallVectorImpl<char> &result,
+                                std::string &error);
+#endif
+
+    // Whether the lazily read M can be compiled by a CodeGenStream.
+    static bool canStream(llvm::Module const *M);
+  };
+
+  // Generates the machine code of a lazily read module as its function
+  // bodies are read (see BCC_STREAMING_COMPILE).
+  //
+  // The functions are added once they are read.  When they add up to
+  // BCC_CODEGEN_STREAM_PARTITION_SIZE, the module is written to bitcode (the
+  // functions not read yet are declarations there), and their bodies are
+  // thrown away, so a codegen worker compiles the partition while the next
+  // bodies are read.  The local symbols of the module are given hidden
+  // external linkage up front, as in ParallelCodeGen::emit().
+  class CodeGenStream {
+  private:
+    llvm::Module *mModule;
+    PipelineConfig const &mConfig;
+
+    // The functions read since the last partition
+    std::vector<llvm::Function *> mPending;
+    size_t mPendingSize;
+
+    std::vector<CodeGenPartition *> mPartitions;
+    size_t mNumThreads;
+
+  public:
+    CodeGenStream(llvm::Module *M, PipelineConfig const &config);
+
+    ~CodeGenStream();
+
+    // Add F, whose body has just been read.
+    void add(llvm::Function *F);
+
+    // Compile the rest of the functions, and merge the objects of all the
+    // partitions into result.
+    bool finish(llvm::SmallVectorImpl<char> &result, std::string &error);
+
+  private:
+    void submit();
+  };
+
+} // namespace bcc
+
+#endif // BCC_PARALLELCODEGEN_H
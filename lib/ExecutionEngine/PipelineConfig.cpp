@@ -0,0 +1,471 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "PipelineConfig.h"
+
+#include <bcc/bcc.h>
+
+#include "llvm/CodeGen/Passes.h"
+
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/Scalar.h"
+
+#include "llvm/Analysis/Passes.h"
+
+#include "llvm/InitializePasses.h"
+#include "llvm/Pass.h"
+#include "llvm/PassManager.h"
+#include "llvm/PassRegistry.h"
+#include "llvm/PassSupport.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <sstream>
+
+namespace {
+
+pthread_once_t PassRegistryOnce = PTHREAD_ONCE_INIT;
+
+// The passes are registered as they are created.  Register all of them
+// before looking one up by name.
+void initializePassRegistry() {
+  llvm::PassRegistry &Registry = *llvm::PassRegistry::getPassRegistry();
+  llvm::initializeCore(Registry);
+  llvm::initializeTransformUtils(Registry);
+  llvm::initializeScalarOpts(Registry);
+  llvm::initializeInstCombine(Registry);
+  llvm::initializeIPO(Registry);
+  llvm::initializeAnalysis(Registry);
+  llvm::initializeIPA(Registry);
+}
+
+
+llvm::PassInfo const *lookupPass(std::string const &name) {
+  pthread_once(&PassRegistryOnce, initializePassRegistry);
+
+  llvm::PassInfo const *PI =
+    llvm::PassRegistry::getPassRegistry()->getPassInfo(name);
+
+  return (PI && PI->getNormalCtor()) ? PI : NULL;
+}
+
+
+struct RegAllocName {
+  char const *mName;
+  bcc::PipelineConfig::RegAllocKind mKind;
+};
+
+RegAllocName const RegAllocNames[] = {
+  { "fast", bcc::PipelineConfig::RegAllocFast },
+  { "basic", bcc::PipelineConfig::RegAllocBasic },
+  { "linearscan", bcc::PipelineConfig::RegAllocLinearScan },
+  { "greedy", bcc::PipelineConfig::RegAllocGreedy },
+};
+
+size_t const NumRegAllocNames = sizeof(RegAllocNames) / sizeof(RegAllocName);
+
+
+// Adds the passes to a pass manager, except the ones skipped.
+class PassAdder {
+private:
+  llvm::PassManagerBase &mPM;
+  std::vector<std::string> const &mSkipList;
+
+public:
+  PassAdder(llvm::PassManagerBase &PM,
+            std::vector<std::string> const &skipList)
+    : mPM(PM), mSkipList(skipList) {
+  }
+
+  void add(llvm::Pass *P) {
+    if (!mSkipList.empty()) {
+      llvm::PassInfo const *PI =
+        llvm::PassRegistry::getPassRegistry()->getPassInfo(P->getPassID());
+
+      if (PI && std::find(mSkipList.begin(), mSkipList.end(),
+                          PI->getPassArgument()) != mSkipList.end()) {
+        delete P;
+        return;
+      }
+    }
+
+    mPM.add(P);
+  }
+};
+
+} // namespace anonymous
+
+namespace bcc {
+
+bool PipelineConfig::getOptLevelFromFlags(unsigned long flags,
+                                          unsigned &optLevel) {
+  if ((flags & BCC_OPT_LEVEL_MASK) == 0) {
+    return false;
+  }
+
+  optLevel = BCC_OPT_LEVEL_GET(flags);
+  return true;
+}
+
+
+std::string PipelineConfig::getFlagsKey(unsigned long flags) {
+  std::string key;
+
+  unsigned optLevel;
+  if (!getOptLevelFromFlags(flags, optLevel)) {
+    key = "default";
+  } else {
+    key = PipelineConfig(optLevel).getDescription();
+  }
+
+  // The code compiled against the library object needs it to be loaded.
+  if (flags & BCC_SHARED_LIBRARY) {
+    key.append(" shared-library");
+  }
+
+  return key;
+}
+
+
+void PipelineConfig::reset(unsigned optLevel) {
+  mOptLevel = (optLevel > 3) ? 3 : optLevel;
+  mHasPassList = false;
+  mPassList.clear();
+  mSkipList.clear();
+
+  switch (mOptLevel) {
+  case 0:
+    mRegAlloc = RegAllocFast;
+    mInlineThreshold = 0;
+    break;
+
+  case 1:
+    mRegAlloc = RegAllocLinearScan;
+    mInlineThreshold = 75;
+    break;
+
+  default:
+    mRegAlloc = RegAllocLinearScan;
+    mInlineThreshold = 225;
+    break;
+  }
+}
+
+
+bool PipelineConfig::parse(std::string const &desc, std::string &error) {
+  // The value of a pragma may be quoted.
+  std::string::size_type n = desc.size();
+  bool quoted = (n >= 2 && desc[0] == '"' && desc[n - 1] == '"');
+
+  std::istringstream tokens(quoted ? desc.substr(1, n - 2) : desc);
+  std::string token;
+
+  while (tokens >> token) {
+    if (token.size() == 2 && token[0] == 'O' &&
+        token[1] >= '0' && token[1] <= '3') {
+      reset(token[1] - '0');
+      continue;
+    }
+
+    std::string::size_type eq = token.find('=');
+    std::string key(token, 0, eq);
+    std::string value((eq == std::string::npos) ? "" : token.substr(eq + 1));
+
+    if (key == "regalloc") {
+      size_t i;
+      for (i = 0; i < NumRegAllocNames; ++i) {
+        if (value == RegAllocNames[i].mName) {
+          mRegAlloc = RegAllocNames[i].mKind;
+          break;
+        }
+      }
+      if (i == NumRegAllocNames) {
+        error = "Unknown register allocator: " + value;
+        return false;
+      }
+    } else if (key == "inline") {
+      char *end;
+      unsigned long threshold = strtoul(value.c_str(), &end, 10);
+      if (value.empty() || *end != '\0') {
+        error = "Invalid inliner threshold: " + value;
+        return false;
+      }
+      mInlineThreshold = threshold;
+    } else if (key == "passes") {
+      mHasPassList = true;
+      mPassList.clear();
+
+      std::istringstream passes(value);
+      std::string pass;
+      while (std::getline(passes, pass, ',')) {
+        if (pass.empty()) {
+          continue;
+        }
+        if (pass != "inline" && !lookupPass(pass)) {
+          error = "Unknown pass: " + pass;
+          return false;
+        }
+        mPassList.push_back(pass);
+      }
+    } else if (key == "skip") {
+      mSkipList.clear();
+
+      std::istringstream passes(value);
+      std::string pass;
+      while (std::getline(passes, pass, ',')) {
+        if (pass.empty()) {
+          continue;
+        }
+        if (!lookupPass(pass)) {
+          error = "Unknown pass: " + pass;
+          return false;
+        }
+        mSkipList.push_back(pass);
+      }
+    } else {
+      error = "Unknown pipeline option: " + token;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+
+std::string PipelineConfig::getDescription() const {
+  std::ostringstream desc;
+
+  desc << 'O' << mOptLevel
+       << " regalloc=" << RegAllocNames[mRegAlloc].mName
+       << " inline=" << mInlineThreshold;
+
+  if (mHasPassList) {
+    desc << " passes=";
+    for (size_t i = 0; i < mPassList.size(); ++i) {
+      desc << ((i == 0) ? "" : ",") << mPassList[i];
+    }
+  }
+
+  if (!mSkipList.empty()) {
+    desc << " skip=";
+    for (size_t i = 0; i < mSkipList.size(); ++i) {
+      desc << ((i == 0) ? "" : ",") << mSkipList[i];
+    }
+  }
+
+  return desc.str();
+}
+
+
+llvm::CodeGenOpt::Level PipelineConfig::getCodeGenOptLevel() const {
+  // -O0: llvm::CodeGenOpt::None
+  // -O1: llvm::CodeGenOpt::Less
+  // -O2: llvm::CodeGenOpt::Default
+  // -O3: llvm::CodeGenOpt::Aggressive
+  switch (mOptLevel) {
+  case 0:   return llvm::CodeGenOpt::None;
+  case 1:   return llvm::CodeGenOpt::Less;
+  case 2:   return llvm::CodeGenOpt::Default;
+  default:  return llvm::CodeGenOpt::Aggressive;
+  }
+}
+
+
+llvm::RegisterRegAlloc::FunctionPassCtor
+PipelineConfig::getRegAllocCtor() const {
+  // Register allocation policy:
+  //  createFastRegisterAllocator: fast but bad quality
+  //  createLinearScanRegisterAllocator: not so fast but good quality
+  switch (mRegAlloc) {
+  case RegAllocFast:    return llvm::createFastRegisterAllocator;
+  case RegAllocBasic:   return llvm::createBasicRegisterAllocator;
+  case RegAllocGreedy:  return llvm::createGreedyRegisterAllocator;
+  default:              return llvm::createLinearScanRegisterAllocator;
+  }
+}
+
+
+void PipelineConfig::addLTOPasses(llvm::PassManagerBase &Passes) const {
+  PassAdder PM(Passes, mSkipList);
+
+  if (mHasPassList) {
+    for (size_t i = 0; i < mPassList.size(); ++i) {
+      if (mPassList[i] == "inline") {
+        if (mInlineThreshold > 0) {
+          PM.add(llvm::createFunctionInliningPass(mInlineThreshold));
+        }
+      } else {
+        PM.add(lookupPass(mPassList[i])->createPass());
+      }
+    }
+    return;
+  }
+
+  if (mOptLevel == 0) {
+    // Only drop what is not used by the script (most of the library.)
+    PM.add(llvm::createGlobalDCEPass());
+    return;
+  }
+
+  if (mOptLevel == 1) {
+    PM.add(llvm::createIPSCCPPass());
+    PM.add(llvm::createGlobalOptimizerPass());
+    PM.add(llvm::createConstantMergePass());
+    PM.add(llvm::createInstructionCombiningPass());
+    if (mInlineThreshold > 0) {
+      PM.add(llvm::createFunctionInliningPass(mInlineThreshold));
+    }
+    PM.add(llvm::createGlobalDCEPass());
+    PM.add(llvm::createCFGSimplificationPass());
+    return;
+  }
+
+  // These are copied from (including comments)
+  // llvm::createStandardLTOPasses().
+
+  // Propagate constants at call sites into the functions they call. This
+  // opens opportunities for globalopt (and inlining) by substituting
+  // function pointers passed as arguments to direct uses of functions.
+  PM.add(llvm::createIPSCCPPass());
+
+  // Now that we internalized some globals, see if we can hack on them!
+  PM.add(llvm::createGlobalOptimizerPass());
+
+  // Linking modules together can lead to duplicated global constants, only
+  // keep one copy of each constant...
+  PM.add(llvm::createConstantMergePass());
+
+  // Remove unused arguments from functions...
+  PM.add(llvm::createDeadArgEliminationPass());
+
+  // Reduce the code after globalopt and ipsccp. Both can open up
+  // significant simplification opportunities, and both can propagate
+  // functions through function pointers. When this happens, we often have
+  // to resolve varargs calls, etc, so let instcombine do this.
+  PM.add(llvm::createInstructionCombiningPass());
+
+  // Inline small functions
+  if (mInlineThreshold > 0) {
+    PM.add(llvm::createFunctionInliningPass(mInlineThreshold));
+  }
+
+  // Remove dead EH info.
+  PM.add(llvm::createPruneEHPass());
+
+  // Internalize the globals again after inlining
+  PM.add(llvm::createGlobalOptimizerPass());
+
+  // Remove dead functions.
+  PM.add(llvm::createGlobalDCEPass());
+
+  // If we didn't decide to inline a function, check to see if we can
+  // transform it to pass arguments by value instead of by reference.
+  PM.add(llvm::createArgumentPromotionPass());
+
+  // The IPO passes may leave cruft around.  Clean up after them.
+  PM.add(llvm::createInstructionCombiningPass());
+  PM.add(llvm::createJumpThreadingPass());
+
+  // Break up allocas
+  PM.add(llvm::createScalarReplAggregatesPass());
+
+  // Run a few AA driven optimizations here and now, to cleanup the code.
+  PM.add(llvm::createFunctionAttrsPass());  // Add nocapture.
+  PM.add(llvm::createGlobalsModRefPass());  // IP alias analysis.
+
+  // Hoist loop invariants.
+  PM.add(llvm::createLICMPass());
+
+  // Remove redundancies.
+  PM.add(llvm::createGVNPass());
+
+  // Remove dead memcpys.
+  PM.add(llvm::createMemCpyOptPass());
+
+  // Nuke dead stores.
+  PM.add(llvm::createDeadStoreEliminationPass());
+
+  // Cleanup and simplify the code after the scalar optimizations.
+  PM.add(llvm::createInstructionCombiningPass());
+
+  PM.add(llvm::createJumpThreadingPass());
+
+  // Delete basic blocks, which optimization passes may have killed.
+  PM.add(llvm::createCFGSimplificationPass());
+
+  // Now that we have optimized the program, discard unreachable functions.
+  PM.add(llvm::createGlobalDCEPass());
+}
+
+
+unsigned PipelineConfig::getLTOCost() const {
+  if (mHasPassList) {
+    return 100;
+  }
+
+  switch (mOptLevel) {
+  case 0:   return 5;
+  case 1:   return 30;
+  default:
+    // GVN takes about a third of the full list.
+    return isSkipped("gvn") ? 70 : 100;
+  }
+}
+
+
+unsigned PipelineConfig::getCodeGenCost() const {
+  unsigned cost;
+  switch (mOptLevel) {
+  case 0:   cost = 50;  break;
+  case 1:   cost = 80;  break;
+  case 2:   cost = 95;  break;
+  default:  cost = 100; break;
+  }
+
+  // Most of the rest is the register allocation.
+  return (mRegAlloc == RegAllocFast) ? cost * 6 / 10 : cost;
+}
+
+
+bool PipelineConfig::degrade() {
+  if (mOptLevel >= 2 && !mHasPassList && !isSkipped("gvn")) {
+    mSkipList.push_back("gvn");
+    return true;
+  }
+
+  if (mOptLevel >= 2 || mHasPassList) {
+    RegAllocKind regAlloc = mRegAlloc;
+    reset(1);
+    mRegAlloc = regAlloc;
+    return true;
+  }
+
+  if (mRegAlloc != RegAllocFast) {
+    mRegAlloc = RegAllocFast;
+    return true;
+  }
+
+  if (mOptLevel > 0) {
+    reset(0);
+    return true;
+  }
+
+  return false;
+}
+
+} // namespace bcc
@@ -0,0 +1,118 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_PIPELINECONFIG_H
+#define BCC_PIPELINECONFIG_H
+
+#include "llvm/CodeGen/RegAllocRegistry.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class PassManagerBase;
+}
+
+namespace bcc {
+
+  // The optimizations applied to a script: the LTO passes, the inliner
+  // threshold, the code generation opt level and the register allocator.
+  //
+  // It starts from the preset of an opt level (BCC_OPT_LEVEL(n) in the
+  // flags of bccPrepareExecutable, or O3) and can be described in text, as
+  // in "#pragma bcc_pipeline("O1 regalloc=fast")".  The tokens of a
+  // description are applied in order:
+  //
+  //   O0 ... O3             Reset to the preset of the opt level
+  //   regalloc=<name>       fast, basic, linearscan or greedy
+  //   inline=<threshold>    The inliner threshold (0 disables the inliner)
+  //   passes=<p1>,<p2>,...  The LTO passes by their opt names, run after
+  //                         "internalize" ("inline" uses the threshold)
+  //   skip=<p1>,<p2>,...    Leave out these LTO passes (e.g. skip=gvn)
+  class PipelineConfig {
+  public:
+    enum RegAllocKind {
+      RegAllocFast,
+      RegAllocBasic,
+      RegAllocLinearScan,
+      RegAllocGreedy
+    };
+
+  private:
+    unsigned mOptLevel;
+    RegAllocKind mRegAlloc;
+    unsigned mInlineThreshold;
+
+    // The LTO passes; empty with !mHasPassList for the ones of mOptLevel.
+    bool mHasPassList;
+    std::vector<std::string> mPassList;
+
+    std::vector<std::string> mSkipList;
+
+  public:
+    explicit PipelineConfig(unsigned optLevel = 3) {
+      reset(optLevel);
+    }
+
+    // The opt level given by BCC_OPT_LEVEL() in the flags, if any.
+    static bool getOptLevelFromFlags(unsigned long flags, unsigned &optLevel);
+
+    // The part of the cache key decided by the flags (including
+    // BCC_SHARED_LIBRARY).  (The pragmas are in the source, which is a part
+    // of the key already.)
+    static std::string getFlagsKey(unsigned long flags);
+
+    void reset(unsigned optLevel);
+
+    // Return false and set error for an unknown token or pass.
+    bool parse(std::string const &desc, std::string &error);
+
+    // The canonical description of this configuration
+    std::string getDescription() const;
+
+    unsigned getOptLevel() const {
+      return mOptLevel;
+    }
+
+    llvm::CodeGenOpt::Level getCodeGenOptLevel() const;
+
+    llvm::RegisterRegAlloc::FunctionPassCtor getRegAllocCtor() const;
+
+    // Add the LTO passes after the internalize pass.
+    void addLTOPasses(llvm::PassManagerBase &Passes) const;
+
+    // The rough cost of the LTO passes and of the code generation, in
+    // percent of the ones of O3 (see Compiler::fitPipeline()).
+    unsigned getLTOCost() const;
+    unsigned getCodeGenCost() const;
+
+    // Make the configuration a step cheaper to compile: skip GVN, then O1,
+    // then the fast register allocator, then O0.  Return false if it can't
+    // be any cheaper.
+    bool degrade();
+
+  private:
+    bool isSkipped(std::string const &pass) const {
+      return std::find(mSkipList.begin(), mSkipList.end(), pass) !=
+             mSkipList.end();
+    }
+  };
+
+} // namespace bcc
+
+#endif // BCC_PIPELINECONFIG_H
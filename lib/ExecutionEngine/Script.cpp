@@ -23,6 +23,9 @@
 #include "OldJIT/CacheWriter.h"
 #endif
 
+#include "AsyncCacheWriter.h"
+#include "CacheManager.h"
+#include "LibraryObject.h"
 #include "MCCacheReader.h"
 #include "MCCacheWriter.h"
 
@@ -32,16 +35,20 @@
 
 #include "DebugHelper.h"
 #include "FileHandle.h"
+#include "PipelineConfig.h"
 #include "ScriptCompiled.h"
 #include "ScriptCached.h"
 #include "Sha1Helper.h"
 #include "SourceInfo.h"
 
 #include <errno.h>
+#include <stdio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <unistd.h>
 
 #include <new>
+#include <pthread.h>
 #include <string.h>
 #include <cutils/properties.h>
 
@@ -54,11 +61,138 @@ bool getBooleanProp(const char *str) {
   return strcmp(buf, "0") != 0;
 }
 
+#if USE_CACHE
+// Writes the checksums computed by a prepare*() call to the memo file once
+// it returns.
+struct SHA1MemoFlusher {
+  ~SHA1MemoFlusher() {
+    bcc::flushSHA1Memo();
+  }
+};
+#endif
+
+#if USE_CACHE && USE_MCJIT
+// The uid of the system server (AID_SYSTEM).
+uid_t const SystemUID = 1000;
+
+// Only the applications of our uid (or the system) can write to our
+// directory of the shared cache (see isTrustedSharedCacheDir()).  Check the
+// file as well, in case the directory was writable once.
+bool isTrustedSharedCacheFile(bcc::FileHandle &file) {
+  struct stat sfile;
+  if (fstat(file.getFD(), &sfile) != 0) {
+    return false;
+  }
+
+  if (sfile.st_uid != getuid() &&
+      sfile.st_uid != 0 &&
+      sfile.st_uid != SystemUID) {
+    return false;
+  }
+
+  return S_ISREG(sfile.st_mode) && (sfile.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// Any application can create the directory of another uid in the shared
+// cache directory before it does, so check that ours is really ours.
+bool isTrustedSharedCacheDir(std::string const &dir) {
+  struct stat sdir;
+  if (lstat(dir.c_str(), &sdir) != 0) {
+    return false;
+  }
+
+  return S_ISDIR(sdir.st_mode) && sdir.st_uid == getuid() &&
+         (sdir.st_mode & (S_IWGRP | S_IWOTH)) == 0;
+}
+
+// Identify the libbcc and libRS which the cache files depend on.
+void calcLibDigest(unsigned char *result) {
+  unsigned char buf[40];
+  memcpy(buf, bcc::sha1LibBCC_SHA1, 20);
+  memcpy(buf + 20, bcc::sha1LibRS, 20);
+  bcc::calcSHA1(result, reinterpret_cast<char const *>(buf), sizeof(buf));
+}
+#endif
+
+#if USE_CACHE
+pthread_once_t LibRSSHA1Once = PTHREAD_ONCE_INIT;
+
+void calcLibRSSHA1() {
+  bcc::calcFileSHA1(bcc::sha1LibRS, bcc::pathLibRS);
+}
+
+// sha1LibRS is shared by the scripts (and by the cache files being written
+// on the writer thread), so it is calculated once.
+void initLibRSSHA1() {
+  pthread_once(&LibRSSHA1Once, calcLibRSSHA1);
+}
+
+// The optimization pipeline chosen by the flags is recorded as a dependency
+// of the cache file, so the code of another opt level is not loaded.  (The
+// pipeline chosen by "#pragma bcc_pipeline" is in the source already.)
+char const PipelineDependencyName[] = "<bcc_pipeline>";
+
+void calcPipelineSHA1(unsigned char *result, unsigned long flags) {
+  std::string key(bcc::PipelineConfig::getFlagsKey(flags));
+  bcc::calcSHA1(result, key.data(), key.size());
+}
+
+// The code is generated for the CPU detected at run time (see
+// Compiler::GlobalInitialization()), so a cache file copied from another
+// device, or written before an update of the detection, is not loaded.
+char const TargetDependencyName[] = "<bcc_target>";
+
+std::string getTargetKey() {
+  std::string key(bcc::Compiler::getTargetTriple());
+  key.push_back('\0');
+  key.append(bcc::Compiler::getTargetCPU());
+  key.push_back('\0');
+
+  std::vector<std::string> const &features =
+    bcc::Compiler::getTargetFeatures();
+  for (size_t i = 0; i < features.size(); ++i) {
+    key.append(features[i]);
+    key.push_back(',');
+  }
+  key.push_back('\0');
+  return key;
+}
+
+void calcTargetSHA1(unsigned char *result) {
+  std::string key(getTargetKey());
+  bcc::calcSHA1(result, key.data(), key.size());
+}
+
+std::string getHexString(unsigned char const *sha1) {
+  static char const hexDigits[] = "0123456789abcdef";
+
+  std::string result;
+  for (size_t i = 0; i < 20; ++i) {
+    result.push_back(hexDigits[sha1[i] >> 4]);
+    result.push_back(hexDigits[sha1[i] & 0xf]);
+  }
+  return result;
+}
+#endif
+
 } // namespace anonymous
 
 namespace bcc {
 
 Script::~Script() {
+#if USE_MCJIT
+  // The tier-up thread writes the cache file, which refers to the sources.
+  if (mStatus == ScriptStatus::Compiled) {
+    mCompiled->waitForTierUp();
+  }
+#endif
+
+  // The source modules (if they are not taken by the compiler) live in the
+  // context of mCompiled, so they must go first.
+  for (size_t i = 0; i < 2; ++i) {
+    delete mSourceList[i];
+  }
+
   switch (mStatus) {
   case ScriptStatus::Compiled:
     delete mCompiled;
@@ -73,10 +207,6 @@ Script::~Script() {
   default:
     break;
   }
-
-  for (size_t i = 0; i < 2; ++i) {
-    delete mSourceList[i];
-  }
 }
 
 
@@ -181,15 +311,13 @@ int Script::addSourceFile(size_t idx,
 int Script::prepareSharedObject(char const *cacheDir,
                                 char const *cacheName,
                                 unsigned long flags) {
+  mCompileFlags = flags;
+
 #if USE_CACHE
-  if (cacheDir && cacheName) {
-    // Set Cache Directory and File Name
-    mCacheDir = cacheDir;
-    mCacheName = cacheName;
+  SHA1MemoFlusher flusher;
 
-    if (!mCacheDir.empty() && *mCacheDir.rbegin() != '/') {
-      mCacheDir.push_back('/'); // Ensure mCacheDir is end with '/'
-    }
+  if (cacheDir && cacheName) {
+    setCachePath(cacheDir, cacheName, flags);
 
     // Check Cache File
     if (internalLoadCache(true) == 0) {
@@ -214,15 +342,13 @@ int Script::prepareExecutable(char const *cacheDir,
     return 1;
   }
 
+  mCompileFlags = flags;
+
 #if USE_CACHE
-  if (cacheDir && cacheName) {
-    // Set Cache Directory and File Name
-    mCacheDir = cacheDir;
-    mCacheName = cacheName;
+  SHA1MemoFlusher flusher;
 
-    if (!mCacheDir.empty() && *mCacheDir.rbegin() != '/') {
-      mCacheDir.push_back('/'); // Ensure mCacheDir is end with '/'
-    }
+  if (cacheDir && cacheName) {
+    setCachePath(cacheDir, cacheName, flags);
 
     // Load Cache File
     if (internalLoadCache(false) == 0) {
@@ -240,6 +366,166 @@ int Script::prepareExecutable(char const *cacheDir,
 
 
 #if USE_CACHE
+void Script::setCachePath(char const *cacheDir,
+                          char const *cacheName,
+                          unsigned long flags) {
+  // Set Cache Directory and File Name
+  mCacheDir = cacheDir;
+  mCacheName = cacheName;
+  mIsSharedCache = false;
+  mIsAsyncCacheWrite = ((flags & BCC_ASYNC_CACHE_WRITE) != 0);
+
+  if (!mCacheDir.empty() && *mCacheDir.rbegin() != '/') {
+    mCacheDir.push_back('/'); // Ensure mCacheDir is end with '/'
+  }
+
+  // The checksums are memoized in the private cache directory, even if the
+  // shared cache is used.
+  setSHA1MemoFile((mCacheDir + "bcc.sha1memo").c_str());
+
+#if USE_MCJIT
+  if (flags & BCC_UID_SHARED_CACHE) {
+    std::string sharedCacheDir;
+    std::string sharedCacheName;
+
+    if (getSharedCachePath(sharedCacheDir, sharedCacheName)) {
+      mCacheDir = sharedCacheDir;
+      mCacheName = sharedCacheName;
+      mIsSharedCache = true;
+    }
+  }
+#endif
+}
+
+
+#if USE_MCJIT
+bool Script::getSharedCachePath(std::string &cacheDir,
+                                std::string &cacheName) {
+  char buf[PROPERTY_VALUE_MAX];
+  property_get("debug.bcc.sharedcachedir", buf, BCC_SHARED_CACHE_DIR);
+
+  cacheDir = buf;
+  if (cacheDir.empty()) {
+    return false;
+  }
+
+  if (*cacheDir.rbegin() != '/') {
+    cacheDir.push_back('/');
+  }
+
+  // The code written by another uid can't be trusted, so each uid has its
+  // own directory.
+  char uidDir[32];
+  snprintf(uidDir, sizeof(uidDir), "%lu/", (unsigned long)getuid());
+  cacheDir.append(uidDir);
+
+  if (mkdir(cacheDir.c_str(), 0700) != 0 && errno != EEXIST) {
+    LOGW("Unable to create %s.  (reason: %s)\n", cacheDir.c_str(),
+         strerror(errno));
+    return false;
+  }
+
+  if (!isTrustedSharedCacheDir(cacheDir)) {
+    LOGW("Ignore untrusted shared cache directory: %s\n", cacheDir.c_str());
+    return false;
+  }
+
+  // The key covers everything the compiled code depends on except libbcc and
+  // libRS, which are still recorded as the dependencies of the cache file.
+  std::string key("bcc-shared-cache");
+  key.push_back('\0');
+
+  for (size_t i = 0; i < 2; ++i) {
+    unsigned char sha1[20];
+
+    if (!mSourceList[i]) {
+      key.append("none");
+    } else if (mSourceList[i]->calcContentSHA1(sha1)) {
+      key.append(reinterpret_cast<char const *>(sha1), sizeof(sha1));
+    } else {
+      // The content of the source is unknown.
+      return false;
+    }
+    key.push_back('\0');
+  }
+
+  key.append(getTargetKey());
+
+  key.append(PipelineConfig::getFlagsKey(mCompileFlags));
+  key.push_back('\0');
+
+  for (size_t i = 0; i < mUserDefinedExternalSymbols.size(); ++i) {
+    key.append(mUserDefinedExternalSymbols[i]);
+    key.push_back(',');
+  }
+
+  unsigned char keySHA1[20];
+  calcSHA1(keySHA1, key.data(), key.size());
+  cacheName = getHexString(keySHA1);
+
+  return true;
+}
+
+
+bool Script::getLibraryObjectPath(std::string &key, std::string &path) {
+  unsigned char sha1[20];
+
+  if ((mCompileFlags & BCC_SHARED_LIBRARY) == 0 || !mSourceList[1] ||
+      !mSourceList[1]->calcContentSHA1(sha1)) {
+    return false;
+  }
+
+  // The object depends on the library, libbcc and the target.
+  std::string data("bcc-library-object");
+  data.push_back('\0');
+  data.append(reinterpret_cast<char const *>(sha1), sizeof(sha1));
+  data.append(reinterpret_cast<char const *>(sha1LibBCC_SHA1), 20);
+  data.append(getTargetKey());
+
+  calcSHA1(sha1, data.data(), data.size());
+  key = getHexString(sha1);
+
+  path.clear();
+  if (!mCacheDir.empty()) {
+    path = mCacheDir + key + ".libo";
+  }
+
+  return true;
+}
+
+
+bool Script::getFunctionCachePath(std::string &dir, std::string &key,
+                                  bool &fastHash) {
+  if ((mCompileFlags & BCC_INCREMENTAL_COMPILE) == 0 ||
+      mCacheDir.empty() || mCacheName.empty()) {
+    return false;
+  }
+
+  dir = mCacheDir + mCacheName + ".fncache/";
+
+  if (mkdir(dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    LOGW("Unable to create %s.  (reason: %s)\n", dir.c_str(),
+         strerror(errno));
+    return false;
+  }
+
+  // The objects depend on libbcc and the target, besides the bitcode of
+  // the functions and the pipeline.
+  key = "bcc-function-object";
+  key.push_back('\0');
+  key.append(reinterpret_cast<char const *>(sha1LibBCC_SHA1), 20);
+  key.append(getTargetKey());
+
+  // Only this application writes its private cache directory, so the names
+  // of the objects need no collision resistance against crafted bitcode
+  // there.  "debug.bcc.sha1fncache" keeps the SHA-1 anyway.
+  fastHash = !mIsSharedCache && !getBooleanProp("debug.bcc.sha1fncache");
+
+  return true;
+}
+#endif
+
+
 int Script::internalLoadCache(bool checkOnly) {
   if (getBooleanProp("debug.bcc.nocache")) {
     // Android system environment property disable the cache mechanism by
@@ -257,10 +543,6 @@ int Script::internalLoadCache(bool checkOnly) {
 #if USE_OLD_JIT
   std::string objPath(mCacheDir + mCacheName + ".jit-image");
   std::string infoPath(mCacheDir + mCacheName + ".oBCC"); // TODO: .info instead
-#elif USE_MCJIT
-  std::string objPath(mCacheDir + mCacheName + ".o");
-  std::string infoPath(mCacheDir + mCacheName + ".info");
-#endif
 
   FileHandle objFile;
   if (objFile.open(objPath.c_str(), OpenMode::Read) < 0) {
@@ -274,9 +556,24 @@ int Script::internalLoadCache(bool checkOnly) {
     return 1;
   }
 
-#if USE_OLD_JIT
   CacheReader reader;
 #elif USE_MCJIT
+  // The metadata and the ELF object are kept in one file.
+  std::string cachePath(mCacheDir + mCacheName + ".mco");
+
+  // The cache file is only replaced by rename(), so it can be read without
+  // taking the lock.
+  FileHandle cacheFile;
+  if (cacheFile.open(cachePath.c_str(), OpenMode::ReadUnlocked) < 0) {
+    // Unable to open the cache file in read mode.
+    return 1;
+  }
+
+  if (mIsSharedCache && !isTrustedSharedCacheFile(cacheFile)) {
+    LOGW("Ignore untrusted shared cache file: %s\n", cachePath.c_str());
+    return 1;
+  }
+
   MCCacheReader reader;
 
   // Register symbol lookup function
@@ -284,23 +581,57 @@ int Script::internalLoadCache(bool checkOnly) {
     reader.registerSymbolCallback(mpExtSymbolLookupFn,
                                       mpExtSymbolLookupFnContext);
   }
+
+  // The cached code refers to the library object, which may have been
+  // loaded or cached by the other scripts.  (Without it, the cache file is
+  // not loaded, and the script is compiled along with the library object.)
+  std::string libKey, libPath;
+  if (!checkOnly && getLibraryObjectPath(libKey, libPath)) {
+    reader.setLibraryObject(
+      LibraryObject::get(libKey, libPath, mpExtSymbolLookupFn,
+                         mpExtSymbolLookupFnContext));
+  }
 #endif
 
   // Dependencies
+  initLibRSSHA1();
   reader.addDependency(BCC_FILE_RESOURCE, pathLibBCC_SHA1, sha1LibBCC_SHA1);
   reader.addDependency(BCC_FILE_RESOURCE, pathLibRS, sha1LibRS);
 
-  for (size_t i = 0; i < 2; ++i) {
-    if (mSourceList[i]) {
-      mSourceList[i]->introDependency(reader);
+  unsigned char sha1Pipeline[20];
+  calcPipelineSHA1(sha1Pipeline, mCompileFlags);
+  reader.addDependency(BCC_FILE_RESOURCE, PipelineDependencyName,
+                       sha1Pipeline);
+
+  unsigned char sha1Target[20];
+  calcTargetSHA1(sha1Target);
+  reader.addDependency(BCC_FILE_RESOURCE, TargetDependencyName, sha1Target);
+
+  // The content of the sources is a part of the name of a shared cache
+  // file, and their names differ between the applications.
+  if (!mIsSharedCache) {
+    for (size_t i = 0; i < 2; ++i) {
+      if (mSourceList[i]) {
+        mSourceList[i]->introDependency(reader);
+      }
     }
   }
 
+#if USE_OLD_JIT
   if (checkOnly)
     return !reader.checkCacheFile(&objFile, &infoFile, this);
 
   // Read cache file
   ScriptCached *cached = reader.readCacheFile(&objFile, &infoFile, this);
+#elif USE_MCJIT
+  // The header carries the digest of all the dependencies, which is all
+  // prepareSharedObject() has to know.
+  if (checkOnly)
+    return !reader.checkCacheHeader(&cacheFile);
+
+  // Read cache file
+  ScriptCached *cached = reader.readCacheFile(&cacheFile, this);
+#endif
 
   if (!cached) {
     mIsContextSlotNotAvail = reader.isContextSlotNotAvail();
@@ -310,6 +641,18 @@ int Script::internalLoadCache(bool checkOnly) {
   mCached = cached;
   mStatus = ScriptStatus::Cached;
 
+#if USE_MCJIT
+  if (!mIsSharedCache) {
+    unsigned char libDigest[20];
+    calcLibDigest(libDigest);
+    CacheManager manager(mCacheDir, libDigest);
+    manager.touch(mCacheName + ".mco");
+    if (!libPath.empty()) {
+      manager.touch(libKey + ".libo");
+    }
+  }
+#endif
+
   // Dirty hack for libRS.
   // TODO(all):  This dirty hack should be removed in the future.
   if (!cached->isLibRSThreadable() && mpExtSymbolLookupFn) {
@@ -332,6 +675,11 @@ int Script::internalCompile(bool compileOnly) {
 
   mStatus = ScriptStatus::Compiled;
 
+  mCompiled->setCompileFlags(mCompileFlags);
+
+  // The budget covers the parsing and the linking as well.
+  mCompiled->setCompileBudget(mCompileBudget);
+
   // Register symbol lookup function
   if (mpExtSymbolLookupFn) {
     mCompiled->registerSymbolCallback(mpExtSymbolLookupFn,
@@ -339,11 +687,9 @@ int Script::internalCompile(bool compileOnly) {
   }
 
   // Parse Bitcode File (if necessary)
-  for (size_t i = 0; i < 2; ++i) {
-    if (mSourceList[i] && mSourceList[i]->prepareModule(mCompiled) != 0) {
-      LOGE("Unable to parse bitcode for source[%lu]\n", (unsigned long)i);
-      return 1;
-    }
+  if (mSourceList[0] && mSourceList[0]->prepareModule(mCompiled) != 0) {
+    LOGE("Unable to parse bitcode for source[0]\n");
+    return 1;
   }
 
   // Set the main source module
@@ -357,9 +703,57 @@ int Script::internalCompile(bool compileOnly) {
     return 1;
   }
 
+#if USE_CACHE && USE_MCJIT
+  std::string functionCacheDir, functionCacheKey;
+  bool functionCacheFastHash = false;
+  if (getFunctionCachePath(functionCacheDir, functionCacheKey,
+                           functionCacheFastHash)) {
+    mCompiled->setFunctionCache(functionCacheDir, functionCacheKey,
+                                functionCacheFastHash);
+  }
+#endif
+
   // Link the source module with the library module
   if (mSourceList[1]) {
-    if (mCompiled->linkModule(mSourceList[1]->takeModule()) != 0) {
+    llvm::Module *library = NULL;
+
+#if USE_CACHE && USE_MCJIT
+    std::string libKey, libPath;
+    if (getLibraryObjectPath(libKey, libPath)) {
+      mCompiled->setLibraryObject(libKey, libPath);
+    }
+#endif
+
+#if USE_CACHE
+    // The library is parsed once per pooled context, and copied for each
+    // script compiled in it.
+    unsigned char libSHA1[20];
+    bool hasLibSHA1 = mSourceList[1]->calcContentSHA1(libSHA1);
+
+    if (hasLibSHA1) {
+      library = mCompiled->cloneLibrary(libSHA1);
+    }
+#endif
+
+    if (!library) {
+      if (mSourceList[1]->prepareModule(mCompiled) != 0) {
+        LOGE("Unable to parse bitcode for source[1]\n");
+        return 1;
+      }
+
+      library = mSourceList[1]->takeModule();
+
+#if USE_CACHE
+      if (hasLibSHA1) {
+        library = mCompiled->keepLibrary(libSHA1, library);
+        if (!library) {
+          return 1;
+        }
+      }
+#endif
+    }
+
+    if (mCompiled->linkModule(library) != 0) {
       LOGE("Unable to link library module\n");
       return 1;
     }
@@ -371,7 +765,48 @@ int Script::internalCompile(bool compileOnly) {
     return 1;
   }
 
+#if USE_MCJIT
+  // The cache file of a script compiled in tiers is written with the
+  // optimized code (see tierUpCallback()).
+  bool needCacheObject = false;
+#if USE_CACHE
+  needCacheObject = !mCacheDir.empty() && !mCacheName.empty() &&
+                    !getBooleanProp("debug.bcc.nocache");
+#endif
+
+  if (!compileOnly &&
+      mCompiled->startTierUp(needCacheObject, tierUpCallback, this)) {
+    // The baseline is not cached.
+    mCompiled->releaseObject();
+    return 0;
+  }
+#endif
+
 #if USE_CACHE
+  writeCache();
+#endif
+
+#if USE_MCJIT
+  // The object is loaded, and retained by the cache writer if it is still
+  // to be written.
+  mCompiled->releaseObject();
+#endif
+
+  return 0;
+}
+
+
+#if USE_MCJIT
+void Script::tierUpCallback(void *context) {
+#if USE_CACHE
+  static_cast<Script *>(context)->writeCache();
+#endif
+}
+#endif
+
+
+#if USE_CACHE
+void Script::writeCache() {
   // Note: If we re-compile the script because the cached context slot not
   // available, then we don't have to write the cache.
 
@@ -384,47 +819,71 @@ int Script::internalCompile(bool compileOnly) {
       !mIsContextSlotNotAvail &&
       ContextManager::get().isManagingContext(getContext()) &&
 #endif
+#if USE_MCJIT
+      !mCompiled->isLazy() &&
+#endif
+      !mCompiled->isPipelineDegraded() &&
       !getBooleanProp("debug.bcc.nocache")) {
 
 #if USE_OLD_JIT
     std::string objPath(mCacheDir + mCacheName + ".jit-image");
     std::string infoPath(mCacheDir + mCacheName + ".oBCC");
-#elif USE_MCJIT
-    std::string objPath(mCacheDir + mCacheName + ".o");
-    std::string infoPath(mCacheDir + mCacheName + ".info");
-#endif
-
 
     // Remove the file if it already exists before writing the new file.
     // The old file may still be mapped elsewhere in memory and we do not want
     // to modify its contents.  (The same script may be running concurrently in
     // the same process or a different process!)
     ::unlink(objPath.c_str());
-#if !USE_OLD_JIT && USE_MCJIT
-    ::unlink(infoPath.c_str());
-#endif
 
     FileHandle objFile;
     FileHandle infoFile;
 
     if (objFile.open(objPath.c_str(), OpenMode::Write) >= 0 &&
         infoFile.open(infoPath.c_str(), OpenMode::Write) >= 0) {
-
-#if USE_OLD_JIT
       CacheWriter writer;
 #elif USE_MCJIT
-      MCCacheWriter writer;
+    // Remove the cache files left by the older versions, which kept the ELF
+    // object and the metadata in separate files.
+    ::unlink((mCacheDir + mCacheName + ".o").c_str());
+    ::unlink((mCacheDir + mCacheName + ".info").c_str());
+
+    CacheWriteJob *job = new CacheWriteJob();
+    job->mWriter = new MCCacheWriter();
+    job->mCacheDir = mCacheDir;
+    job->mFileName = mCacheName + ".mco";
+    job->mManaged = !mIsSharedCache;
+
+    std::string libKey, libPath;
+    if (getLibraryObjectPath(libKey, libPath)) {
+      job->mLibraryFileName = libKey + ".libo";
+    }
+
+    {
+      MCCacheWriter &writer = *job->mWriter;
 #endif
 
 #ifdef TARGET_BUILD
       // Dependencies
+      initLibRSSHA1();
       writer.addDependency(BCC_FILE_RESOURCE, pathLibBCC_SHA1, sha1LibBCC_SHA1);
       writer.addDependency(BCC_FILE_RESOURCE, pathLibRS, sha1LibRS);
 #endif
 
-      for (size_t i = 0; i < 2; ++i) {
-        if (mSourceList[i]) {
-          mSourceList[i]->introDependency(writer);
+      unsigned char sha1Pipeline[20];
+      calcPipelineSHA1(sha1Pipeline, mCompileFlags);
+      writer.addDependency(BCC_FILE_RESOURCE, PipelineDependencyName,
+                           sha1Pipeline);
+
+      unsigned char sha1Target[20];
+      calcTargetSHA1(sha1Target);
+      writer.addDependency(BCC_FILE_RESOURCE, TargetDependencyName,
+                           sha1Target);
+
+      if (!mIsSharedCache) {
+        for (size_t i = 0; i < 2; ++i) {
+          if (mSourceList[i]) {
+            mSourceList[i]->introDependency(writer);
+          }
         }
       }
 
@@ -437,6 +896,7 @@ int Script::internalCompile(bool compileOnly) {
                                         "__isThreadable");
       }
 
+#if USE_OLD_JIT
       if (!writer.writeCacheFile(&objFile, &infoFile, this, libRS_threadable)) {
         objFile.truncate();
         objFile.close();
@@ -454,12 +914,27 @@ int Script::internalCompile(bool compileOnly) {
                infoPath.c_str(), strerror(errno));
         }
       }
+#elif USE_MCJIT
+      calcLibDigest(job->mLibDigest);
+
+      if (!writer.prepareCacheFile(this, libRS_threadable)) {
+        AsyncCacheWriter::get().report((mCacheDir + job->mFileName).c_str(),
+                                       BCC_CACHE_WRITE_ERROR);
+        delete job;
+      } else if (mIsAsyncCacheWrite) {
+        // The script is usable now.  Write the cache file on the writer
+        // thread, which shares the object with the script.
+        writer.detach();
+        AsyncCacheWriter::get().enqueue(job);
+      } else {
+        job->run();
+        delete job;
+      }
+#endif
     }
   }
-#endif // USE_CACHE
-
-  return 0;
 }
+#endif // USE_CACHE
 
 
 char const *Script::getCompilerErrorMessage() {
@@ -756,22 +1231,10 @@ int Script::registerSymbolCallback(BCCSymbolLookupFn pFn, void *pContext) {
 }
 
 #if USE_MCJIT
-size_t Script::getELFSize() const {
-  switch (mStatus) {
-    case ScriptStatus::Compiled: {
-      return mCompiled->getELFSize();
-    }
-
-    default: {
-      return 0;
-    }
-  }
-}
-
-const char *Script::getELF() const {
+ObjectBuffer *Script::getObject() const {
   switch (mStatus) {
     case ScriptStatus::Compiled: {
-      return mCompiled->getELF();
+      return mCompiled->getObject();
     }
 
     default: {
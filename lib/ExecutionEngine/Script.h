@@ -32,6 +32,7 @@ namespace llvm {
 }
 
 namespace bcc {
+  class ObjectBuffer;
   class ScriptCompiled;
   class ScriptCached;
   class SourceInfo;
@@ -62,10 +63,23 @@ namespace bcc {
 #if USE_CACHE
     std::string mCacheDir;
     std::string mCacheName;
+
+    // True if mCacheDir/mCacheName refer to the cache shared by the uid
+    // (see BCC_UID_SHARED_CACHE).
+    bool mIsSharedCache;
+
+    // Write the cache file on the writer thread (see BCC_ASYNC_CACHE_WRITE).
+    bool mIsAsyncCacheWrite;
 #endif
 
     bool mIsContextSlotNotAvail;
 
+    // The flags of prepareExecutable() or prepareSharedObject()
+    unsigned long mCompileFlags;
+
+    // The compile time budget in milliseconds (0 for none)
+    unsigned long mCompileBudget;
+
     // Source List
     SourceInfo *mSourceList[2];
     // Note: mSourceList[0] (main source)
@@ -81,7 +95,11 @@ namespace bcc {
 
   public:
     Script() : mErrorCode(BCC_NO_ERROR), mStatus(ScriptStatus::Unknown),
-               mIsContextSlotNotAvail(false),
+#if USE_CACHE
+               mIsSharedCache(false), mIsAsyncCacheWrite(false),
+#endif
+               mIsContextSlotNotAvail(false), mCompileFlags(0),
+               mCompileBudget(0),
                mpExtSymbolLookupFn(NULL), mpExtSymbolLookupFnContext(NULL) {
       Compiler::GlobalInitialization();
 
@@ -113,6 +131,10 @@ namespace bcc {
       return mUserDefinedExternalSymbols;
     }
 
+    void setCompileBudget(unsigned long milliseconds) {
+      mCompileBudget = milliseconds;
+    }
+
     int prepareExecutable(char const *cacheDir,
                           char const *cacheName,
                           unsigned long flags);
@@ -152,9 +174,8 @@ namespace bcc {
 
     void getObjectSlotList(size_t size, uint32_t *list);
 
-    size_t getELFSize() const;
-
-    const char *getELF() const;
+    // The compiled object, for the cache writer to retain
+    ObjectBuffer *getObject() const;
 
     int registerSymbolCallback(BCCSymbolLookupFn pFn, void *pContext);
 
@@ -177,10 +198,35 @@ namespace bcc {
 
   private:
 #if USE_CACHE
+    void setCachePath(char const *cacheDir,
+                      char const *cacheName,
+                      unsigned long flags);
+
+#if USE_MCJIT
+    bool getSharedCachePath(std::string &cacheDir, std::string &cacheName);
+
+    // The key and the file of the library object (see BCC_SHARED_LIBRARY).
+    // Return false if it is not used.
+    bool getLibraryObjectPath(std::string &key, std::string &path);
+
+    // The directory of the function objects, created if necessary, their
+    // key, and whether they may be named by the fast hash instead of the
+    // SHA-1 (see BCC_INCREMENTAL_COMPILE).  Return false if it is not used.
+    bool getFunctionCachePath(std::string &dir, std::string &key,
+                              bool &fastHash);
+#endif
+
     int internalLoadCache(bool checkOnly);
+
+    void writeCache();
 #endif
     int internalCompile(bool compileOnly);
 
+#if USE_MCJIT
+    // Called on the tier-up thread (see BCC_TIERED_COMPILE).
+    static void tierUpCallback(void *context);
+#endif
+
   };
 
 } // namespace bcc
@@ -26,6 +26,8 @@
 
 #include "DebugHelper.h"
 
+#include <sys/mman.h>
+
 #include <stdlib.h>
 
 namespace bcc {
@@ -38,11 +40,18 @@ ScriptCached::~ScriptCached() {
   }
 #endif
 
-  // Deallocate string pool, exported var list, exported func list
-  if (mpStringPoolRaw) { free(mpStringPoolRaw); }
+  // Deallocate string pool and object slot list.  When the cache file is
+  // mapped, they point into the mapping and are released by munmap().
+  if (mpCacheMap) {
+    munmap(mpCacheMap, mCacheMapSize);
+  } else {
+    if (mpStringPoolRaw) { free(mpStringPoolRaw); }
+    if (mpObjectSlotList) { free(mpObjectSlotList); }
+  }
+
+  // Deallocate exported var list, exported func list
   if (mpExportVars) { free(mpExportVars); }
   if (mpExportFuncs) { free(mpExportFuncs); }
-  if (mpObjectSlotList) { free(mpObjectSlotList); }
 }
 
 void ScriptCached::getExportVarList(size_t varListSize, void **varList) {
@@ -77,6 +77,12 @@ namespace bcc {
     OBCC_StringPool *mpStringPoolRaw;
     std::vector<char const *> mStringPool;
 
+    // Read-only mapping of the cache file.  The string pool, the object slot
+    // list, and the other sections loaded by MCCacheReader point directly
+    // into this mapping, so it must live as long as this object.
+    char *mpCacheMap;
+    size_t mCacheMapSize;
+
     bool mLibRSThreadable;
 
   public:
@@ -89,6 +95,8 @@ namespace bcc {
         mContext(NULL),
 #endif
         mpStringPoolRaw(NULL),
+        mpCacheMap(NULL),
+        mCacheMapSize(0),
         mLibRSThreadable(false) {
     }
 
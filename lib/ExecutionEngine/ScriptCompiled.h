@@ -75,7 +75,7 @@ namespace bcc {
 
     ~ScriptCompiled();
 
-    llvm::Module *parseBitcodeFile(llvm::MemoryBuffer *MEM) {
+    llvm::Module *parseBitcodeFile(llvm::OwningPtr<llvm::MemoryBuffer> &MEM) {
       return mCompiler.parseBitcodeFile(MEM);
     }
 
@@ -87,6 +87,15 @@ namespace bcc {
       return mCompiler.linkModule(module);
     }
 
+    llvm::Module *cloneLibrary(unsigned char const *sha1) {
+      return mCompiler.cloneLibrary(sha1);
+    }
+
+    llvm::Module *keepLibrary(unsigned char const *sha1,
+                              llvm::Module *library) {
+      return mCompiler.keepLibrary(sha1, library);
+    }
+
     int compile(bool compileOnly) {
       return mCompiler.compile(compileOnly);
     }
@@ -147,18 +156,56 @@ namespace bcc {
 #endif
 
 #if USE_MCJIT
-    const char *getELF() const {
-      return &*mCompiler.getELF().begin();
+    ObjectBuffer *getObject() const {
+      return mCompiler.getObject();
+    }
+
+    void releaseObject() {
+      mCompiler.releaseObject();
+    }
+
+    bool isLazy() const {
+      return mCompiler.isLazy();
+    }
+#endif
+
+    bool isPipelineDegraded() const {
+      return mCompiler.isPipelineDegraded();
+    }
+
+#if USE_MCJIT
+    bool startTierUp(bool needCacheObject,
+                     void (*pFn)(void *context), void *pContext) {
+      return mCompiler.startTierUp(needCacheObject, pFn, pContext);
     }
 
-    size_t getELFSize() const {
-      return mCompiler.getELF().size();
+    void waitForTierUp() {
+      mCompiler.waitForTierUp();
     }
 #endif
 
     void registerSymbolCallback(BCCSymbolLookupFn pFn, void *pContext) {
       mCompiler.registerSymbolCallback(pFn, pContext);
     }
+
+    void setCompileFlags(unsigned long flags) {
+      mCompiler.setCompileFlags(flags);
+    }
+
+    void setCompileBudget(unsigned long milliseconds) {
+      mCompiler.setCompileBudget(milliseconds);
+    }
+
+#if USE_MCJIT
+    void setLibraryObject(std::string const &key, std::string const &path) {
+      mCompiler.setLibraryObject(key, path);
+    }
+
+    void setFunctionCache(std::string const &dir, std::string const &key,
+                          bool fastHash) {
+      mCompiler.setFunctionCache(dir, key, fastHash);
+    }
+#endif
   };
 
 } // namespace bcc
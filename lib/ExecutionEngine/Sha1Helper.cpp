@@ -21,12 +21,224 @@
 #include "DebugHelper.h"
 #include "FileHandle.h"
 
+#include <llvm/Support/Mutex.h>
+#include <llvm/Support/MutexGuard.h>
+
+#include <errno.h>
+#include <stdint.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include <map>
+#include <string>
+#include <vector>
 
 #include <utils/StopWatch.h>
 
+#include <fasthash.h>
 #include <sha1.h>
 
+namespace {
+
+struct SHA1MemoKey {
+  uint64_t dev;
+  uint64_t ino;
+  uint64_t size;
+  int64_t mtime_ns;
+
+  bool operator<(SHA1MemoKey const &rhs) const {
+    if (dev != rhs.dev) return dev < rhs.dev;
+    if (ino != rhs.ino) return ino < rhs.ino;
+    if (size != rhs.size) return size < rhs.size;
+    return mtime_ns < rhs.mtime_ns;
+  }
+};
+
+struct SHA1MemoValue {
+  unsigned char sha1[20];
+};
+
+// On-disk layout of the memo file: SHA1MemoHeader followed by
+// SHA1MemoHeader::count records of SHA1MemoRecord.
+struct SHA1MemoHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+};
+
+struct SHA1MemoRecord {
+  SHA1MemoKey key;
+  unsigned char sha1[20];
+  unsigned char padding[4];
+};
+
+char const SHA1MemoMagic[8] = { 'b', 'c', 'c', 's', 'h', 'a', '1', 'm' };
+uint32_t const SHA1MemoVersion = 1;
+
+// Upper bound of the memoized entries.  Only a few files (libRS.so and the
+// bitcode files) are hashed by a process, so this is rarely reached.
+size_t const SHA1MemoMaxEntries = 64;
+
+llvm::sys::Mutex SHA1MemoLock;
+std::map<SHA1MemoKey, SHA1MemoValue> SHA1Memo;
+std::string SHA1MemoPath;
+
+// Whether SHA1Memo has entries not in the memo file yet
+bool SHA1MemoDirty = false;
+
+int64_t getMTimeNS(struct stat const &sfile) {
+#if defined(__APPLE__)
+  int64_t nsec = sfile.st_mtimespec.tv_nsec;
+#elif defined(__BIONIC__)
+  int64_t nsec = sfile.st_mtime_nsec;
+#else
+  int64_t nsec = sfile.st_mtim.tv_nsec;
+#endif
+  return (int64_t)sfile.st_mtime * 1000000000LL + nsec;
+}
+
+// A file modified within the last few seconds may be modified again
+// without changing the timestamp (on a file system with coarse timestamps),
+// so don't memoize its checksum yet.
+bool isSHA1Memoizable(struct stat const &sfile) {
+  time_t now = time(NULL);
+  return S_ISREG(sfile.st_mode) && (now - sfile.st_mtime) > 2;
+}
+
+SHA1MemoKey makeSHA1MemoKey(struct stat const &sfile) {
+  SHA1MemoKey key;
+  memset(&key, '\0', sizeof(key));
+  key.dev = sfile.st_dev;
+  key.ino = sfile.st_ino;
+  key.size = sfile.st_size;
+  key.mtime_ns = getMTimeNS(sfile);
+  return key;
+}
+
+// Load the entries in the memo file.  Must be called with SHA1MemoLock held.
+void loadSHA1Memo() {
+  bcc::FileHandle file;
+
+  if (file.open(SHA1MemoPath.c_str(), bcc::OpenMode::ReadUnlocked) < 0) {
+    // No memo file yet.
+    return;
+  }
+
+  SHA1MemoHeader header;
+  if (file.pread(reinterpret_cast<char *>(&header), sizeof(header), 0) !=
+        (ssize_t)sizeof(header) ||
+      memcmp(header.magic, SHA1MemoMagic, sizeof(SHA1MemoMagic)) != 0 ||
+      header.version != SHA1MemoVersion ||
+      header.count > SHA1MemoMaxEntries) {
+    LOGW("Ignore the invalid sha1 memo file: %s\n", SHA1MemoPath.c_str());
+    return;
+  }
+
+  std::vector<SHA1MemoRecord> records(header.count);
+  size_t recordsSize = sizeof(SHA1MemoRecord) * header.count;
+
+  if (header.count == 0 ||
+      file.pread(reinterpret_cast<char *>(&*records.begin()), recordsSize,
+                 sizeof(header)) != (ssize_t)recordsSize) {
+    return;
+  }
+
+  for (size_t i = 0; i < records.size(); ++i) {
+    SHA1MemoValue value;
+    memcpy(value.sha1, records[i].sha1, sizeof(value.sha1));
+    SHA1Memo.insert(std::make_pair(records[i].key, value));
+  }
+}
+
+// Write all memoized entries to the memo file.  The file is replaced
+// atomically, so the concurrent readers never see a partial table.  Must be
+// called with SHA1MemoLock held.
+void saveSHA1Memo() {
+  if (SHA1MemoPath.empty() || !SHA1MemoDirty) {
+    return;
+  }
+
+  // Whether it is written or not, don't try again until the next entry.
+  SHA1MemoDirty = false;
+
+  std::vector<SHA1MemoRecord> records;
+  records.reserve(SHA1Memo.size());
+
+  std::map<SHA1MemoKey, SHA1MemoValue>::const_iterator I, E;
+  for (I = SHA1Memo.begin(), E = SHA1Memo.end(); I != E; ++I) {
+    SHA1MemoRecord record;
+    memset(&record, '\0', sizeof(record));
+    record.key = I->first;
+    memcpy(record.sha1, I->second.sha1, sizeof(record.sha1));
+    records.push_back(record);
+  }
+
+  SHA1MemoHeader header;
+  memcpy(header.magic, SHA1MemoMagic, sizeof(SHA1MemoMagic));
+  header.version = SHA1MemoVersion;
+  header.count = records.size();
+
+  bcc::FileHandle file;
+  if (file.createTemporary(SHA1MemoPath.c_str()) < 0) {
+    return;
+  }
+
+  size_t recordsSize = sizeof(SHA1MemoRecord) * records.size();
+
+  if (file.write(reinterpret_cast<char const *>(&header), sizeof(header)) !=
+        (ssize_t)sizeof(header) ||
+      (recordsSize > 0 &&
+       file.write(reinterpret_cast<char const *>(&*records.begin()),
+                  recordsSize) != (ssize_t)recordsSize)) {
+    LOGE("Unable to write the sha1 memo file: %s\n", SHA1MemoPath.c_str());
+    file.discard();
+    return;
+  }
+
+  file.publish(SHA1MemoPath.c_str());
+}
+
+// Feed the whole content of the file to the hash context.  The file is
+// mapped when its size is known; otherwise it is read in large chunks.
+bool updateSHA1FromFile(SHA1_CTX *hashContext, bcc::FileHandle &file,
+                        struct stat const *sfile) {
+  if (sfile && S_ISREG(sfile->st_mode) && sfile->st_size > 0) {
+    size_t size = static_cast<size_t>(sfile->st_size);
+    void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, file.getFD(), 0);
+
+    if (map != MAP_FAILED) {
+      madvise(map, size, MADV_SEQUENTIAL);
+      SHA1Update(hashContext, static_cast<unsigned char const *>(map),
+                 static_cast<unsigned long>(size));
+      munmap(map, size);
+      return true;
+    }
+  }
+
+  std::vector<char> buf(64 * 1024);
+  while (true) {
+    ssize_t nread = file.read(&*buf.begin(), buf.size());
+
+    if (nread < 0) {
+      return false;
+    }
+
+    if (nread == 0) {
+      // finished.
+      return true;
+    }
+
+    SHA1Update(hashContext,
+               reinterpret_cast<unsigned char *>(&*buf.begin()),
+               static_cast<unsigned long>(nread));
+  }
+}
+
+} // anonymous namespace
+
 namespace bcc {
 
 unsigned char sha1LibBCC_SHA1[20];
@@ -47,41 +259,130 @@ void calcSHA1(unsigned char *result, char const *data, size_t size) {
 }
 
 
-void calcFileSHA1(unsigned char *result, char const *filename) {
+void calcFastHash(unsigned char *result, char const *data, size_t size) {
+  FastHash128(result, data, size, 0);
+}
+
+
+bool calcFileSHA1(unsigned char *result, char const *filename) {
   android::StopWatch calcFileSHA1Timer("calcFileSHA1 time");
 
+  // A memo hit only needs the metadata of the file.
+  struct stat sfile;
+  if (stat(filename, &sfile) == 0 && isSHA1Memoizable(sfile)) {
+    SHA1MemoKey key = makeSHA1MemoKey(sfile);
+
+    llvm::MutexGuard locked(SHA1MemoLock);
+    std::map<SHA1MemoKey, SHA1MemoValue>::const_iterator I =
+      SHA1Memo.find(key);
+
+    if (I != SHA1Memo.end()) {
+      memcpy(result, I->second.sha1, 20);
+      return true;
+    }
+  }
+
+  // The files hashed here are replaced rather than modified in place, so
+  // there is no need to wait for a lock.
   FileHandle file;
 
-  if (file.open(filename, OpenMode::Read) < 0) {
+  if (file.open(filename, OpenMode::ReadUnlocked) < 0) {
     LOGE("Unable to calculate the sha1 checksum of %s\n", filename);
     memset(result, '\0', 20);
-    return;
+    return false;
+  }
+
+  // The file may have been replaced since stat(), so the memo key is made
+  // from the file actually read.
+  bool statOK = (fstat(file.getFD(), &sfile) == 0);
+  bool memoizable = statOK && isSHA1Memoizable(sfile);
+
+  SHA1MemoKey key;
+  if (memoizable) {
+    key = makeSHA1MemoKey(sfile);
   }
 
   SHA1_CTX hashContext;
   SHA1Init(&hashContext);
 
-  char buf[256];
-  while (true) {
-    ssize_t nread = file.read(buf, sizeof(buf));
+  if (!updateSHA1FromFile(&hashContext, file, statOK ? &sfile : NULL)) {
+    LOGE("Unable to read %s for the sha1 checksum\n", filename);
+    memset(result, '\0', 20);
+    return false;
+  }
 
-    if (nread < 0) {
-      break;
+  SHA1MemoValue value;
+  SHA1Final(value.sha1, &hashContext);
+  memcpy(result, value.sha1, 20);
+
+  if (memoizable) {
+    llvm::MutexGuard locked(SHA1MemoLock);
+
+    if (SHA1Memo.size() >= SHA1MemoMaxEntries) {
+      // The entries of the replaced files are never hit again.  Start over.
+      SHA1Memo.clear();
     }
 
-    SHA1Update(&hashContext,
-               reinterpret_cast<unsigned char *>(buf),
-               static_cast<unsigned long>(nread));
+    // Written by flushSHA1Memo(), once for all the files of a script
+    SHA1Memo[key] = value;
+    SHA1MemoDirty = true;
+  }
 
-    if ((size_t)nread < sizeof(buf)) {
-      // finished.
-      break;
+  return true;
+}
+
+
+void calcDependencyDigest(unsigned char *result,
+                          std::map<std::string,
+                                   std::pair<uint32_t, unsigned char const *> >
+                            const &deps) {
+  SHA1_CTX hashContext;
+  SHA1Init(&hashContext);
+
+  // std::map is ordered by the resource name, so the digest doesn't depend
+  // on the order in which the dependencies are added.
+  std::map<std::string,
+           std::pair<uint32_t, unsigned char const *> >::const_iterator I, E;
+
+  for (I = deps.begin(), E = deps.end(); I != E; ++I) {
+    unsigned char type[4];
+    for (size_t i = 0; i < 4; ++i) {
+      type[i] = static_cast<unsigned char>(I->second.first >> (i * 8));
     }
+
+    // Include the terminating '\0' to separate the name from the type.
+    SHA1Update(&hashContext,
+               reinterpret_cast<unsigned char const *>(I->first.c_str()),
+               static_cast<unsigned long>(I->first.size() + 1));
+    SHA1Update(&hashContext, type, sizeof(type));
+    SHA1Update(&hashContext, I->second.second, 20);
   }
 
   SHA1Final(result, &hashContext);
 }
 
+
+void setSHA1MemoFile(char const *memoPath) {
+  llvm::MutexGuard locked(SHA1MemoLock);
+
+  if (SHA1MemoPath == memoPath) {
+    return;
+  }
+
+  // The entries computed so far belong to the previous file.
+  saveSHA1Memo();
+
+  SHA1MemoPath = memoPath;
+  loadSHA1Memo();
+}
+
+
+void flushSHA1Memo() {
+  llvm::MutexGuard locked(SHA1MemoLock);
+  saveSHA1Memo();
+}
+
+
 void readSHA1(unsigned char *result, int result_size, char const *filename) {
   FileHandle file;
   if (file.open(filename, OpenMode::Read) < 0) {
@@ -20,6 +20,11 @@
 #include "Config.h"
 
 #include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <utility>
 
 namespace bcc {
   extern unsigned char sha1LibBCC_SHA1[20];
@@ -30,7 +35,32 @@ namespace bcc {
 
   void calcSHA1(unsigned char *result, char const *data, size_t size);
 
-  void calcFileSHA1(unsigned char *result, char const *filename);
+  // Calculate the 128-bit (16 bytes) non-cryptographic hash of the data.
+  // It is much faster than sha1, but only use it for the keys whose
+  // collision is not a security problem.
+  void calcFastHash(unsigned char *result, char const *data, size_t size);
+
+  // Calculate the sha1 checksum of the file.  The checksum is memoized, keyed
+  // by (device, inode, size, modification time) of the file, and the file is
+  // only read again when one of them changes.  Returns false (and zeros) if
+  // the file cannot be read.
+  bool calcFileSHA1(unsigned char *result, char const *filename);
+
+  // Keep the memoized checksums in memoPath, so that they are reused across
+  // the processes.  The entries in memoPath are loaded on the first call.
+  void setSHA1MemoFile(char const *memoPath);
+
+  // Write the checksums computed since the last call to the memo file.
+  // Called once per bccPrepareExecutable() rather than on every checksum.
+  void flushSHA1Memo();
+
+  // Calculate the sha1 of a dependency list, which maps the resource names
+  // to their types and sha1 checksums.
+  void calcDependencyDigest(unsigned char *result,
+                            std::map<std::string,
+                                     std::pair<uint32_t,
+                                               unsigned char const *> >
+                              const &deps);
 
   // Read binary representation of sha1 from filename.
   void readSHA1(unsigned char *result, int resultsize, char const *filename);
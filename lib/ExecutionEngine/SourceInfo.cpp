@@ -94,11 +94,9 @@ SourceInfo *SourceInfo::createFromFile(char const *path,
   result->flags = flags;
 
 #if USE_CACHE
+  // The checksum is calculated in introDependency(), after the sha1 memo
+  // file in the cache directory is known.
   memset(result->sha1, '\0', 20);
-
-  if (!(result->flags & BCC_SKIP_DEP_SHA1)) {
-    calcFileSHA1(result->sha1, path);
-  }
 #endif
 
   return result;
@@ -147,7 +145,7 @@ int SourceInfo::prepareModule(ScriptCompiled *SC) {
         return 1;
       }
 
-      module.reset(SC->parseBitcodeFile(MEM.get()));
+      module.reset(SC->parseBitcodeFile(MEM));
     }
     break;
 
@@ -160,7 +158,7 @@ int SourceInfo::prepareModule(ScriptCompiled *SC) {
         return 1;
       }
 
-      module.reset(SC->parseBitcodeFile(MEM.get()));
+      module.reset(SC->parseBitcodeFile(MEM));
     }
     break;
 
@@ -184,6 +182,7 @@ template <typename T> void SourceInfo::introDependency(T &checker) {
     break;
 
   case SourceKind::File:
+    calcFileSHA1(sha1, file.path);
     checker.addDependency(BCC_FILE_RESOURCE, file.path, sha1);
     break;
 
@@ -192,6 +191,24 @@ template <typename T> void SourceInfo::introDependency(T &checker) {
   }
 }
 
+bool SourceInfo::calcContentSHA1(unsigned char *result) {
+  switch (type) {
+  case SourceKind::Buffer:
+    if (flags & BCC_SKIP_DEP_SHA1) {
+      calcSHA1(result, buffer.bitcode, buffer.bitcodeSize);
+    } else {
+      memcpy(result, sha1, 20);
+    }
+    return true;
+
+  case SourceKind::File:
+    return calcFileSHA1(result, file.path);
+
+  default:
+    return false;
+  }
+}
+
 #if USE_OLD_JIT
 template void SourceInfo::introDependency<CacheReader>(CacheReader &);
 template void SourceInfo::introDependency<CacheWriter>(CacheWriter &);
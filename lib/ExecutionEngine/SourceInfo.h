@@ -88,6 +88,11 @@ namespace bcc {
 
 #if USE_CACHE
     template <typename T> void introDependency(T &checker);
+
+    // Calculate the sha1 checksum of the source content, regardless of
+    // BCC_SKIP_DEP_SHA1.  Returns false if it is not available (i.e. for
+    // llvm::Module).
+    bool calcContentSHA1(unsigned char *result);
 #endif
   };
 
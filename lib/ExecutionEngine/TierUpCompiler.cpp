@@ -0,0 +1,394 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "TierUpCompiler.h"
+
+#include "Compiler.h"
+#include "CompilerResourcePool.h"
+#include "DebugHelper.h"
+#include "ELFObjectMerger.h"
+#include "ModuleUtils.h"
+#include "ObjectBuffer.h"
+#include "ParallelCodeGen.h"
+
+#include "llvm/ADT/OwningPtr.h"
+
+#include "llvm/Bitcode/ReaderWriter.h"
+
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include "llvm/Target/TargetData.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include "llvm/BasicBlock.h"
+#include "llvm/Constants.h"
+#include "llvm/DerivedTypes.h"
+#include "llvm/Function.h"
+#include "llvm/GlobalVariable.h"
+#include "llvm/Instructions.h"
+#include "llvm/LLVMContext.h"
+#include "llvm/Module.h"
+
+#include <set>
+
+namespace {
+
+// The defined functions whose addresses are taken by C.
+void collectFunctions(llvm::Constant *C,
+                      std::set<llvm::Constant *> &visited,
+                      std::vector<llvm::Function *> &functions) {
+  if (!visited.insert(C).second) {
+    return;
+  }
+
+  if (llvm::Function *F = llvm::dyn_cast<llvm::Function>(C)) {
+    if (!F->isDeclaration()) {
+      functions.push_back(F);
+    }
+    return;
+  }
+
+  if (llvm::isa<llvm::GlobalValue>(C)) {
+    return;
+  }
+
+  for (unsigned i = 0, e = C->getNumOperands(); i != e; ++i) {
+    llvm::Value *Op = C->getOperand(i);
+    if (llvm::isa<llvm::Constant>(Op)) {
+      collectFunctions(llvm::cast<llvm::Constant>(Op), visited, functions);
+    }
+  }
+}
+
+
+// Rename F, and put a function calling through the slot "<name>.bcc.slot"
+// (which holds F) in its place.
+void createDispatcher(llvm::Function *F) {
+  llvm::Module *M = F->getParent();
+  llvm::LLVMContext &Context = M->getContext();
+
+  std::string name(F->getName());
+  F->setName(name + ".bcc.tier0");
+
+  llvm::GlobalVariable *Slot = bcc::createSlot(M, name, F);
+
+  llvm::Function *Dispatcher =
+    llvm::Function::Create(F->getFunctionType(),
+                           llvm::GlobalValue::ExternalLinkage, name, M);
+  Dispatcher->setCallingConv(F->getCallingConv());
+  Dispatcher->setAttributes(F->getAttributes());
+
+  llvm::BasicBlock *BB = llvm::BasicBlock::Create(Context, "entry", Dispatcher);
+
+  // The slot is switched by another thread.
+  llvm::Value *Target =
+    new llvm::LoadInst(Slot, "", /* isVolatile= */ true, BB);
+
+  std::vector<llvm::Value *> Args;
+  for (llvm::Function::arg_iterator I = Dispatcher->arg_begin(),
+       E = Dispatcher->arg_end(); I != E; ++I) {
+    Args.push_back(&*I);
+  }
+
+  llvm::CallInst *Call = llvm::CallInst::Create(Target, Args, "", BB);
+  Call->setCallingConv(F->getCallingConv());
+  Call->setAttributes(F->getAttributes());
+  Call->setTailCall();
+
+  if (F->getReturnType()->isVoidTy()) {
+    llvm::ReturnInst::Create(Context, BB);
+  } else {
+    llvm::ReturnInst::Create(Context, Call, BB);
+  }
+}
+
+} // namespace anonymous
+
+namespace bcc {
+
+TierUpCompiler *TierUpCompiler::create(Compiler *compiler) {
+  llvm::Module *M = compiler->mModule;
+
+  if (!canCompileApart(M)) {
+    return NULL;
+  }
+
+  TierUpCompiler *tierUp =
+    new TierUpCompiler(compiler, compiler->mConfig,
+                       compiler->mCompileFlags, compiler->mHasLinked);
+
+  // The global variables are defined by the baseline only, so they (and the
+  // functions their initializers refer to) must have external symbols.
+  std::set<llvm::Constant *> visited;
+  std::vector<llvm::Function *> functions;
+
+  for (llvm::Module::global_iterator
+       I = M->global_begin(), E = M->global_end(); I != E; ++I) {
+    if (I->isDeclaration() || I->getName().startswith("llvm.")) {
+      continue;
+    }
+
+    if (I->hasLocalLinkage()) {
+      promoteToHidden(&*I);
+    }
+    tierUp->mExternalSymbols.push_back(I->getName());
+
+    collectFunctions(I->getInitializer(), visited, functions);
+  }
+
+  for (size_t i = 0; i < functions.size(); ++i) {
+    if (functions[i]->hasLocalLinkage()) {
+      promoteToHidden(functions[i]);
+    }
+    tierUp->mExternalSymbols.push_back(functions[i]->getName());
+  }
+
+  {
+    llvm::raw_svector_ostream OS(tierUp->mBitcode);
+    llvm::WriteBitcodeToFile(M, OS);
+    OS.flush();
+  }
+
+  // Put the dispatchers in front of the entry points of the baseline.
+  std::vector<char const *> entryPoints;
+  compiler->collectExportSymbols(
+    M->getNamedMetadata(Compiler::ExportVarMetadataName),
+    M->getNamedMetadata(Compiler::ExportFuncMetadataName),
+    entryPoints);
+
+  for (size_t i = 0; i < entryPoints.size(); ++i) {
+    std::string name(entryPoints[i]);
+    llvm::Function *F = M->getFunction(name);
+
+    if (!F || F->isDeclaration() || F->hasLocalLinkage() || F->isVarArg() ||
+        M->getNamedGlobal(name + SlotSuffix)) {
+      continue;
+    }
+
+    createDispatcher(F);
+    tierUp->mEntryPoints.push_back(name);
+    tierUp->mExternalSymbols.push_back(name + SlotSuffix);
+  }
+
+  return tierUp;
+}
+
+
+TierUpCompiler::~TierUpCompiler() {
+  wait();
+  rsloaderDisposeExec(mExecutable);
+
+  if (mCacheObject) {
+    mCacheObject->release();
+  }
+}
+
+
+void TierUpCompiler::start(RSExecRef baseline, bool needCacheObject,
+                           CallbackFn pFn, void *pContext) {
+  mBaseline = baseline;
+  mNeedCacheObject = needCacheObject;
+  mpCallback = pFn;
+  mpCallbackContext = pContext;
+
+  if (pthread_create(&mThread, NULL, threadMain, this) == 0) {
+    mThreadStarted = true;
+    return;
+  }
+
+  LOGW("Unable to start the tier-up thread.  Generate the optimized code "
+       "now.\n");
+  run();
+}
+
+
+void TierUpCompiler::wait() {
+  if (mThreadStarted) {
+    pthread_join(mThread, NULL);
+    mThreadStarted = false;
+  }
+}
+
+
+void *TierUpCompiler::threadMain(void *arg) {
+  static_cast<TierUpCompiler *>(arg)->run();
+  return NULL;
+}
+
+
+void *TierUpCompiler::resolveSymbol(void *context, char const *name) {
+  TierUpCompiler *self = static_cast<TierUpCompiler *>(context);
+
+  // The global variables of the baseline
+  if (void *addr = rsloaderGetSymbolAddress(self->mBaseline, name)) {
+    return addr;
+  }
+
+  return Compiler::resolveSymbolAdapter(self->mCompiler, name);
+}
+
+
+void TierUpCompiler::run() {
+  if (!compile()) {
+    LOGE("Unable to generate the optimized code: %s\n", mError.c_str());
+    return;
+  }
+
+  switchEntryPoints();
+
+  if (mpCallback) {
+    mpCallback(mpCallbackContext);
+  }
+}
+
+
+bool TierUpCompiler::compile() {
+  CompilerResourcePool &pool = CompilerResourcePool::get();
+
+  PooledContext context;
+  pool.acquireContext(context);
+  llvm::TargetMachine *TM = NULL;
+  llvm::Module *M = NULL;
+
+  llvm::SmallVector<char, 1024> dataObject;
+  unsigned numPartitions = 1;
+  bool succeeded = false;
+
+  llvm::OwningPtr<llvm::MemoryBuffer> MEM(
+    llvm::MemoryBuffer::getMemBuffer(
+      llvm::StringRef(mBitcode.begin(), mBitcode.size()), "", false));
+
+  TM = pool.acquireTargetMachine(mError);
+  if (TM == NULL)
+    goto on_tier_up_done;
+
+  if (mNeedCacheObject) {
+    M = llvm::ParseBitcodeFile(MEM.get(), *context.mContext, &mError);
+    if (M == NULL || !emitDataObject(M, TM, dataObject))
+      goto on_tier_up_done;
+
+    delete M;
+    M = NULL;
+  }
+
+  M = llvm::ParseBitcodeFile(MEM.get(), *context.mContext, &mError);
+  if (M == NULL)
+    goto on_tier_up_done;
+
+  // Use the variables of the baseline.
+  for (llvm::Module::global_iterator
+       I = M->global_begin(), E = M->global_end(); I != E; ++I) {
+    if (!I->isDeclaration() && !I->getName().startswith("llvm.")) {
+      I->setInitializer(NULL);
+      I->setLinkage(llvm::GlobalValue::ExternalLinkage);
+    }
+  }
+
+  if (mHasLinked) {
+    std::vector<char const *> ExportSymbols;
+    mCompiler->collectExportSymbols(
+      M->getNamedMetadata(Compiler::ExportVarMetadataName),
+      M->getNamedMetadata(Compiler::ExportFuncMetadataName),
+      ExportSymbols);
+
+    for (size_t i = 0; i < mExternalSymbols.size(); ++i) {
+      ExportSymbols.push_back(mExternalSymbols[i].c_str());
+    }
+
+    Compiler::runLTO(M, new llvm::TargetData(M), mConfig, ExportSymbols);
+  }
+
+  numPartitions = (mCompileFlags & BCC_PARALLEL_CODEGEN)
+                  ? ParallelCodeGen::getPartitionCount(M) : 1;
+
+  if (numPartitions > 1) {
+    succeeded = ParallelCodeGen::emit(M, numPartitions, mConfig,
+                                      mObject, mError);
+  } else {
+    succeeded = Compiler::emitMC(M, new llvm::TargetData(M), TM, mConfig,
+                                 mObject, mError);
+  }
+
+on_tier_up_done:
+  delete M;
+
+  if (TM) {
+    pool.releaseTargetMachine(TM);
+  }
+
+  pool.releaseContext(context);
+
+  if (!succeeded) {
+    return false;
+  }
+
+  if (mNeedCacheObject) {
+    ELFObjectMerger merger;
+    merger.addObject(mObject.begin(), mObject.size());
+    merger.addObject(dataObject.begin(), dataObject.size());
+
+    std::vector<char> object;
+    if (!merger.merge(object, mError)) {
+      return false;
+    }
+
+    mCacheObject = ObjectBuffer::acquire(object.size());
+    mCacheObject->getData().append(object.begin(), object.end());
+  }
+
+  mExecutable = rsloaderCreateExec((unsigned char *)mObject.begin(),
+                                   mObject.size(), &resolveSymbol, this);
+
+  if (!mExecutable) {
+    mError = "Fail to load the optimized code";
+    return false;
+  }
+
+  return true;
+}
+
+
+bool TierUpCompiler::emitDataObject(llvm::Module *M, llvm::TargetMachine *TM,
+                                    llvm::SmallVectorImpl<char> &result) {
+  stripFunctions(M, NULL);
+  stripGlobals(M, /* keepVariables= */ true);
+
+  return Compiler::emitMC(M, new llvm::TargetData(M), TM, PipelineConfig(0),
+                          result, mError);
+}
+
+
+void TierUpCompiler::switchEntryPoints() {
+  for (size_t i = 0; i < mEntryPoints.size(); ++i) {
+    std::string const &name = mEntryPoints[i];
+
+    void *code = rsloaderGetSymbolAddress(mExecutable, name.c_str());
+    void * volatile *slot = getSlot(mBaseline, name);
+
+    if (!code || !slot) {
+      LOGW("Unable to switch %s to the optimized code.\n", name.c_str());
+      continue;
+    }
+
+    setSlot(slot, code);
+  }
+
+  LOGV("Switched %lu entry points to the optimized code.\n",
+       (unsigned long)mEntryPoints.size());
+}
+
+} // namespace bcc
@@ -0,0 +1,146 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BCC_TIERUPCOMPILER_H
+#define BCC_TIERUPCOMPILER_H
+
+#include "PipelineConfig.h"
+
+#include "librsloader.h"
+
+#include "llvm/ADT/SmallVector.h"
+
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+
+namespace llvm {
+  class Module;
+  class TargetMachine;
+}
+
+namespace bcc {
+  class Compiler;
+  class ObjectBuffer;
+
+  // Generates the optimized code of a script compiled with
+  // BCC_TIERED_COMPILE, on a thread of its own.
+  //
+  // The script is first compiled at O0 (the baseline) with a dispatcher in
+  // front of each entry point: the entry point calls through a slot (named
+  // "<entry point>.bcc.slot") which initially holds the baseline code.  The
+  // optimized code is generated from a bitcode copy of the module taken
+  // before the baseline is compiled, with its global variables turned into
+  // declarations, so that it shares the variables of the baseline (whose
+  // addresses have been given to the runtime already).  Once it is loaded,
+  // the slots are switched to the optimized entry points.
+  //
+  // For the cache file, the optimized code is merged with an object defining
+  // the global variables only, so that the cached object stands alone.
+  class TierUpCompiler {
+  public:
+    // Called on the tier-up thread once the optimized code is in use.
+    typedef void (*CallbackFn)(void *context);
+
+  private:
+    Compiler *mCompiler;
+
+    PipelineConfig mConfig;
+    unsigned long mCompileFlags;
+
+    // Run the LTO (as the baseline does if the library has been linked)
+    bool mHasLinked;
+
+    llvm::SmallVector<char, 1024> mBitcode;
+
+    // The symbols kept external in both tiers: the global variables, the
+    // functions referred to by their initializers, and the slots.
+    std::vector<std::string> mExternalSymbols;
+
+    // The entry points with a dispatcher
+    std::vector<std::string> mEntryPoints;
+
+    RSExecRef mBaseline;
+    RSExecRef mExecutable;
+
+    // The optimized code, and the object written to the cache
+    llvm::SmallVector<char, 1024> mObject;
+    ObjectBuffer *mCacheObject;
+    bool mNeedCacheObject;
+
+    CallbackFn mpCallback;
+    void *mpCallbackContext;
+
+    pthread_t mThread;
+    bool mThreadStarted;
+
+    std::string mError;
+
+    TierUpCompiler(Compiler *compiler, PipelineConfig const &config,
+                   unsigned long compileFlags, bool hasLinked)
+      : mCompiler(compiler), mConfig(config), mCompileFlags(compileFlags),
+        mHasLinked(hasLinked), mBaseline(NULL), mExecutable(NULL),
+        mCacheObject(NULL), mNeedCacheObject(false), mpCallback(NULL),
+        mpCallbackContext(NULL), mThreadStarted(false) {
+    }
+
+  public:
+    // Prepare the module of compiler to be compiled as the baseline, and
+    // keep a bitcode copy of it for the optimized code of its current
+    // configuration.  Return NULL (and leave the module unchanged) if the
+    // module can't be compiled in tiers.
+    static TierUpCompiler *create(Compiler *compiler);
+
+    ~TierUpCompiler();
+
+    // The symbols to be kept external by the LTO of the baseline
+    std::vector<std::string> const &getExternalSymbols() const {
+      return mExternalSymbols;
+    }
+
+    // Generate the optimized code for the loaded baseline.  It is done on the
+    // calling thread if the tier-up thread can't be started.
+    void start(RSExecRef baseline, bool needCacheObject,
+               CallbackFn pFn, void *pContext);
+
+    // Block until the optimized code is in use (or has failed.)
+    void wait();
+
+    // The object to be written to the cache.  Valid after the callback.
+    ObjectBuffer *getCacheObject() const {
+      return mCacheObject;
+    }
+
+  private:
+    static void *threadMain(void *arg);
+
+    static void *resolveSymbol(void *context, char const *name);
+
+    void run();
+
+    bool compile();
+
+    // Emit the global variables of M (with its function bodies deleted.)
+    bool emitDataObject(llvm::Module *M, llvm::TargetMachine *TM,
+                        llvm::SmallVectorImpl<char> &result);
+
+    void switchEntryPoints();
+  };
+
+} // namespace bcc
+
+#endif // BCC_TIERUPCOMPILER_H
@@ -26,8 +26,14 @@
 #include "DebugHelper.h"
 #include "Script.h"
 
+#if USE_CACHE && USE_MCJIT
+#include "AsyncCacheWriter.h"
+#endif
+
 #include <string>
 
+#include <pthread.h>
+
 #include <utils/StopWatch.h>
 
 using namespace bcc;
@@ -36,14 +42,15 @@ namespace llvm {
   class Module;
 }
 
-static bool bccBuildStampPrinted = false;
+static pthread_once_t bccBuildStampOnce = PTHREAD_ONCE_INIT;
+
+static void bccLogBuildStamp() {
+  LOGI("LIBBCC build time: %s", bccGetBuildTime());
+  LOGI("LIBBCC build revision: %s", bccGetBuildRev());
+}
 
 static void bccPrintBuildStamp() {
-  if (!bccBuildStampPrinted) {
-    LOGI("LIBBCC build time: %s", bccGetBuildTime());
-    LOGI("LIBBCC build revision: %s", bccGetBuildRev());
-    bccBuildStampPrinted = true;
-  }
+  pthread_once(&bccBuildStampOnce, bccLogBuildStamp);
 }
 
 extern "C" BCCScriptRef bccCreateScript() {
@@ -123,6 +130,13 @@ extern "C" void bccMarkExternalSymbol(BCCScriptRef script, char const *name) {
 }
 
 
+extern "C" void bccSetCompileBudget(BCCScriptRef script,
+                                    unsigned long milliseconds) {
+  BCC_FUNC_LOGGER();
+  unwrap(script)->setCompileBudget(milliseconds);
+}
+
+
 extern "C" int bccPrepareSharedObject(BCCScriptRef script,
                                       char const *cacheDir,
                                       char const *cacheName,
@@ -143,6 +157,23 @@ extern "C" int bccPrepareExecutable(BCCScriptRef script,
 }
 
 
+extern "C" void bccRegisterCacheWriteCallback(BCCCacheWriteCallbackFn pFn,
+                                              void *pContext) {
+  BCC_FUNC_LOGGER();
+#if USE_CACHE && USE_MCJIT
+  AsyncCacheWriter::get().registerCallback(pFn, pContext);
+#endif
+}
+
+
+extern "C" void bccWaitForCacheWrites() {
+  BCC_FUNC_LOGGER();
+#if USE_CACHE && USE_MCJIT
+  AsyncCacheWriter::get().waitForIdle();
+#endif
+}
+
+
 extern "C" void *bccGetFuncAddr(BCCScriptRef script, char const *funcname) {
   BCC_FUNC_LOGGER();
 
@@ -56,3 +56,41 @@ LOCAL_MODULE_TAGS := tests
 
 include external/stlport/libstlport.mk
 include $(BUILD_EXECUTABLE)
+
+# Concurrent compilation stress test for target
+# ========================================================
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := bcc_stress
+
+LOCAL_SRC_FILES := \
+  stress.cpp
+
+LOCAL_SHARED_LIBRARIES := libdl libstlport libbcc
+
+LOCAL_C_INCLUDES := \
+  $(LOCAL_PATH)/../include
+
+LOCAL_MODULE_TAGS := tests
+
+include external/stlport/libstlport.mk
+include $(BUILD_EXECUTABLE)
+
+# Shared library object with different symbol lookups, test for target
+# ========================================================
+include $(CLEAR_VARS)
+
+LOCAL_MODULE := bcc_library_lookup
+
+LOCAL_SRC_FILES := \
+  library_lookup.cpp
+
+LOCAL_SHARED_LIBRARIES := libdl libstlport libbcc
+
+LOCAL_C_INCLUDES := \
+  $(LOCAL_PATH)/../include
+
+LOCAL_MODULE_TAGS := tests
+
+include external/stlport/libstlport.mk
+include $(BUILD_EXECUTABLE)
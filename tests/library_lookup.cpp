@@ -0,0 +1,210 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Prepare scripts linked with the same library (BCC_SHARED_LIBRARY), each
+// with a symbol lookup callback of its own, in one process.
+//
+// Usage: bcc_library_lookup [-c cachedir] -l library.bc input.bc
+//
+// The library must import a symbol found by dlsym(), e.g. from libRS.
+//
+// A script is asked for each symbol the library object imports: by the
+// object loaded (or compiled) for it, or, when it shares an object loaded
+// already, to check that it resolves the symbol to the same address.
+//
+// The first two callbacks resolve the symbols alike, so the second script
+// shares the object of the first one: it is asked for each symbol as many
+// times as the first one.  (A script bound to an object of its own would be
+// asked once more.)  The third callback resolves every symbol elsewhere, so
+// the object of the others is rejected as its first import differs, and
+// the third script gets an object resolved by its callback: it is asked for
+// each symbol at least as many times as the first one, and once more in
+// all.  The scripts are prepared again from the cache files when cachedir
+// (empty at first) is given.  None of them is run.
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bcc/bcc.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+namespace {
+
+struct Lookup {
+  char const *mName;
+  bool mRedirect;
+
+  // How many times each symbol was resolved, and in all
+  std::map<std::string, unsigned> mAsked;
+  unsigned mTotal;
+};
+
+char const *cacheDir = NULL;
+
+std::vector<char> bitcode;
+std::vector<char> library;
+
+unsigned numFailures = 0;
+
+// Where the third callback resolves every symbol to.  Never called.
+void redirected() {
+  abort();
+}
+
+void *lookupSymbol(void *pContext, char const *name) {
+  Lookup *lookup = static_cast<Lookup *>(pContext);
+
+  void *addr = dlsym(RTLD_DEFAULT, name);
+  if (!addr) {
+    return NULL;
+  }
+
+  ++lookup->mAsked[name];
+  ++lookup->mTotal;
+  return lookup->mRedirect ? (void *)&redirected : addr;
+}
+
+bool readFile(char const *path, std::vector<char> &result) {
+  FILE *in = fopen(path, "rb");
+  if (!in) {
+    fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  char buf[4096];
+  size_t nread;
+  while ((nread = fread(buf, 1, sizeof(buf), in)) > 0) {
+    result.insert(result.end(), buf, buf + nread);
+  }
+
+  fclose(in);
+  return !result.empty();
+}
+
+void fail(Lookup const &lookup, char const *what) {
+  fprintf(stderr, "%s: %s\n", lookup.mName, what);
+  ++numFailures;
+}
+
+void prepare(Lookup &lookup) {
+  BCCScriptRef script = bccCreateScript();
+
+  if (bccReadBC(script, "input", &*bitcode.begin(), bitcode.size(), 0) != 0 ||
+      bccLinkBC(script, "library", &*library.begin(), library.size(),
+                0) != 0) {
+    fail(lookup, "unable to read the bitcode");
+    bccDisposeScript(script);
+    return;
+  }
+
+  bccRegisterSymbolCallback(script, lookupSymbol, &lookup);
+
+  if (bccPrepareExecutable(script, cacheDir, cacheDir ? lookup.mName : NULL,
+                           BCC_SHARED_LIBRARY) != 0) {
+    fail(lookup, "bccPrepareExecutable failed");
+  } else if (!bccGetFuncAddr(script, "root")) {
+    fail(lookup, "root() not found");
+  }
+
+  bccDisposeScript(script);
+}
+
+} // namespace anonymous
+
+int main(int argc, char** argv) {
+  int c;
+  while ((c = getopt(argc, argv, "c:l:")) != -1) {
+    switch (c) {
+      case 'c':
+        cacheDir = optarg;
+        break;
+
+      case 'l':
+        if (!readFile(optarg, library)) {
+          return 1;
+        }
+        break;
+
+      default:
+        fprintf(stderr, "Unknown option\n");
+        return 1;
+    }
+  }
+
+  if (library.empty()) {
+    fprintf(stderr, "library file required\n");
+    return 1;
+  }
+
+  if (optind >= argc || !readFile(argv[optind], bitcode)) {
+    fprintf(stderr, "input file required\n");
+    return 1;
+  }
+
+  // Compiled, and then (with cachedir) loaded from the cache.
+  for (int pass = 0; pass < (cacheDir ? 2 : 1); ++pass) {
+    Lookup lookups[] = {
+      { "lookup-first", false, std::map<std::string, unsigned>(), 0 },
+      { "lookup-second", false, std::map<std::string, unsigned>(), 0 },
+      { "lookup-redirect", true, std::map<std::string, unsigned>(), 0 },
+    };
+
+    for (size_t i = 0; i < sizeof(lookups) / sizeof(lookups[0]); ++i) {
+      prepare(lookups[i]);
+    }
+
+    // The next pass reads the cache files of this one.
+    bccWaitForCacheWrites();
+
+    Lookup &first = lookups[0];
+    Lookup &second = lookups[1];
+    Lookup &redirect = lookups[2];
+
+    for (std::map<std::string, unsigned>::const_iterator
+         I = first.mAsked.begin(), E = first.mAsked.end(); I != E; ++I) {
+      unsigned asked = second.mAsked[I->first];
+      if (asked != I->second) {
+        fprintf(stderr, "%s: asked %u times for %s, not %u: the library "
+                "object is not shared\n", second.mName, asked,
+                I->first.c_str(), I->second);
+        ++numFailures;
+      }
+
+      asked = redirect.mAsked[I->first];
+      if (asked < I->second) {
+        fprintf(stderr, "%s: asked %u times for %s, not %u at least\n",
+                redirect.mName, asked, I->first.c_str(), I->second);
+        ++numFailures;
+      }
+    }
+
+    if (!first.mAsked.empty() && redirect.mTotal <= first.mTotal) {
+      fprintf(stderr, "%s: bound to the library object of the others\n",
+              redirect.mName);
+      ++numFailures;
+    }
+  }
+
+  fprintf(stderr, "%u failure(s)\n", numFailures);
+  return (numFailures == 0) ? 0 : 2;
+}
@@ -0,0 +1,324 @@
+/*
+ * Copyright 2011, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// Compile the same bitcode on several threads at once, as an application
+// preparing its scripts at start-up does.
+//
+// Usage: bcc_stress [-t threads] [-n iterations] [-c cachedir]
+//                   [-l library.bc] [-f flags] [-s] [-r] input.bc
+//
+// Each thread prepares its own scripts, with the cache files of its own
+// (under cachedir, if given), and checks that every one of them exports
+// what a script prepared up front does.  Options:
+//
+//   -s  All the threads use the same cache file, so they race to write and
+//       load it.
+//   -r  Read the bitcode with bccReadFile and bccLinkFile, so the real
+//       dependency checksums are computed (and memoized) on every thread,
+//       instead of being skipped with BCC_SKIP_DEP_SHA1.
+//
+// With cachedir, the cache files must exist at the end (unless the flags
+// keep them from being written there).
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <bcc/bcc.h>
+
+#include <string>
+#include <vector>
+
+static unsigned numThreads = 8;
+static unsigned numIterations = 4;
+static char const *cacheDir = NULL;
+static unsigned long prepareFlags = 0;
+static bool sharedCacheName = false;
+static bool realDependencies = false;
+
+static char const *bitcodePath = NULL;
+static char const *libraryPath = NULL;
+static std::vector<char> bitcode;
+static std::vector<char> library;
+
+// What every script must export, taken from the script prepared up front
+static size_t const MaxExports = 1024;
+static size_t numExportVars = 0;
+static size_t numExportFuncs = 0;
+static bool hasRoot = false;
+
+// Marks the entries of an export list not filled in
+static char unsetExport;
+
+static pthread_mutex_t failureLock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned numFailures = 0;
+
+static void* lookupSymbol(void* pContext, const char* name) {
+  return (void*) dlsym(RTLD_DEFAULT, name);
+}
+
+static bool readFile(char const *path, std::vector<char> &result) {
+  FILE *in = fopen(path, "rb");
+  if (!in) {
+    fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  char buf[4096];
+  size_t nread;
+  while ((nread = fread(buf, 1, sizeof(buf), in)) > 0) {
+    result.insert(result.end(), buf, buf + nread);
+  }
+
+  fclose(in);
+  return !result.empty();
+}
+
+static void fail(unsigned thread, unsigned iteration, char const *what) {
+  pthread_mutex_lock(&failureLock);
+  fprintf(stderr, "thread %u, iteration %u: %s\n", thread, iteration, what);
+  ++numFailures;
+  pthread_mutex_unlock(&failureLock);
+}
+
+// The number of leading entries of list filled in by bccGetExport*List,
+// all of which must be set.
+static size_t countExports(std::vector<void *> const &list, bool &hasNull) {
+  size_t count = 0;
+
+  hasNull = false;
+  while (count < list.size() && list[count] != &unsetExport) {
+    if (!list[count]) {
+      hasNull = true;
+    }
+    ++count;
+  }
+
+  return count;
+}
+
+static BCCScriptRef createScript() {
+  BCCScriptRef script = bccCreateScript();
+
+  int result;
+  if (realDependencies) {
+    result = bccReadFile(script, bitcodePath, 0);
+    if (result == 0 && libraryPath) {
+      result = bccLinkFile(script, libraryPath, 0);
+    }
+  } else {
+    result = bccReadBC(script, "input", &*bitcode.begin(), bitcode.size(),
+                       BCC_SKIP_DEP_SHA1);
+    if (result == 0 && !library.empty()) {
+      result = bccLinkBC(script, "library", &*library.begin(), library.size(),
+                         BCC_SKIP_DEP_SHA1);
+    }
+  }
+
+  if (result != 0) {
+    bccDisposeScript(script);
+    return NULL;
+  }
+
+  bccRegisterSymbolCallback(script, lookupSymbol, NULL);
+  return script;
+}
+
+// Check that script exports what the script prepared up front does, or
+// (if reference) record that.
+static bool checkExports(BCCScriptRef script, bool reference,
+                         char const *&what) {
+  std::vector<void *> vars(MaxExports, &unsetExport);
+  std::vector<void *> funcs(MaxExports, &unsetExport);
+  bool varsHaveNull, funcsHaveNull;
+
+  bccGetExportVarList(script, vars.size(), &*vars.begin());
+  bccGetExportFuncList(script, funcs.size(), &*funcs.begin());
+
+  size_t varCount = countExports(vars, varsHaveNull);
+  size_t funcCount = countExports(funcs, funcsHaveNull);
+  bool root = (bccGetFuncAddr(script, "root") != NULL);
+
+  if (reference) {
+    numExportVars = varCount;
+    numExportFuncs = funcCount;
+    hasRoot = root;
+  }
+
+  if (varCount != numExportVars) {
+    what = "wrong number of exported variables";
+  } else if (funcCount != numExportFuncs) {
+    what = "wrong number of exported functions";
+  } else if (varsHaveNull || funcsHaveNull) {
+    what = "exported symbol without an address";
+  } else if (root != hasRoot) {
+    what = hasRoot ? "root() not found" : "unexpected root()";
+  } else {
+    return true;
+  }
+
+  return false;
+}
+
+static void getCacheName(unsigned thread, unsigned iteration,
+                         char *cacheName, size_t size) {
+  // Every other iteration loads the cache file of the previous one.
+  if (sharedCacheName) {
+    snprintf(cacheName, size, "stress-shared");
+  } else {
+    snprintf(cacheName, size, "stress-%u-%u", thread, iteration / 2);
+  }
+}
+
+static void compileOnce(unsigned thread, unsigned iteration) {
+  BCCScriptRef script = createScript();
+  if (!script) {
+    fail(thread, iteration, "unable to read the bitcode");
+    return;
+  }
+
+  char cacheName[32];
+  getCacheName(thread, iteration, cacheName, sizeof(cacheName));
+
+  char const *what;
+  if (bccPrepareExecutable(script, cacheDir, cacheDir ? cacheName : NULL,
+                           prepareFlags) != 0) {
+    fail(thread, iteration, "bccPrepareExecutable failed");
+  } else if (!checkExports(script, false, what)) {
+    fail(thread, iteration, what);
+  }
+
+  bccDisposeScript(script);
+}
+
+static void *threadMain(void *arg) {
+  unsigned thread = (unsigned)(uintptr_t)arg;
+
+  for (unsigned i = 0; i < numIterations; ++i) {
+    compileOnce(thread, i);
+  }
+
+  return NULL;
+}
+
+int main(int argc, char** argv) {
+  int c;
+  while ((c = getopt(argc, argv, "t:n:c:l:f:sr")) != -1) {
+    switch (c) {
+      case 't':
+        numThreads = strtoul(optarg, NULL, 0);
+        break;
+
+      case 'n':
+        numIterations = strtoul(optarg, NULL, 0);
+        break;
+
+      case 'c':
+        cacheDir = optarg;
+        break;
+
+      case 'l':
+        libraryPath = optarg;
+        if (!readFile(optarg, library)) {
+          return 1;
+        }
+        break;
+
+      case 'f':
+        prepareFlags = strtoul(optarg, NULL, 0);
+        break;
+
+      case 's':
+        sharedCacheName = true;
+        break;
+
+      case 'r':
+        realDependencies = true;
+        break;
+
+      default:
+        fprintf(stderr, "Unknown option\n");
+        return 1;
+    }
+  }
+
+  if (optind >= argc || !readFile(argv[optind], bitcode)) {
+    fprintf(stderr, "input file required\n");
+    return 1;
+  }
+  bitcodePath = argv[optind];
+
+  // The reference, compiled without the cache
+  BCCScriptRef reference = createScript();
+  char const *what;
+  if (!reference ||
+      bccPrepareExecutable(reference, NULL, NULL, prepareFlags) != 0 ||
+      !checkExports(reference, true, what)) {
+    fprintf(stderr, "Unable to prepare the reference script\n");
+    return 1;
+  }
+  bccDisposeScript(reference);
+
+  std::vector<pthread_t> threads(numThreads);
+  for (unsigned i = 0; i < numThreads; ++i) {
+    if (pthread_create(&threads[i], NULL, threadMain,
+                       (void *)(uintptr_t)i) != 0) {
+      fprintf(stderr, "Unable to start thread %u\n", i);
+      return 1;
+    }
+  }
+
+  for (unsigned i = 0; i < numThreads; ++i) {
+    pthread_join(threads[i], NULL);
+  }
+
+  // The cache files may still be written in the background.
+  bccWaitForCacheWrites();
+
+  // The scripts compiled lazily are not cached, and the cache of the uid
+  // is not in cachedir.
+  if (cacheDir && !(prepareFlags & (BCC_LAZY_COMPILE |
+                                    BCC_UID_SHARED_CACHE))) {
+    unsigned cachedThreads = sharedCacheName ? 1 : numThreads;
+    unsigned cachedIterations = sharedCacheName ? 1 : numIterations;
+
+    for (unsigned i = 0; i < cachedThreads; ++i) {
+      for (unsigned j = 0; j < cachedIterations; j += 2) {
+        char cacheName[32];
+        getCacheName(i, j, cacheName, sizeof(cacheName));
+
+        std::string path(cacheDir);
+        path.append("/").append(cacheName).append(".mco");
+
+        if (access(path.c_str(), R_OK) != 0) {
+          fprintf(stderr, "Cache file not written: %s\n", path.c_str());
+          ++numFailures;
+        }
+      }
+    }
+  }
+
+  fprintf(stderr, "%u threads x %u iterations: %u failure(s)\n",
+          numThreads, numIterations, numFailures);
+
+  return (numFailures == 0) ? 0 : 2;
+}